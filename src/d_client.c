@@ -43,6 +43,7 @@
 #include "g_game.h"
 #include "m_menu.h"
 
+#include "p_hash.h"
 #include "protocol.h"
 #include "i_network.h"
 #include "i_system.h"
@@ -50,6 +51,7 @@
 #include "i_video.h"
 
 #include "lprintf.h"
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -59,12 +61,58 @@ static int       remotetic; // Tic expected from the remote
 static int       remotesend; // Tic expected by the remote
 ticcmd_t         netcmds[MAXPLAYERS][BACKUPTICS];
 static ticcmd_t* localcmds;
-static unsigned          numqueuedpackets;
+
+// NetUpdate is called over and over by TryRunTics, so the packets it
+// receives, queues and sends live in fixed buffers, not the zone. Only
+// queued packets that don't fit the pool go in the zone.
+#define RECVBUFSIZE 10000
+#define MAXQUEUEDPACKETS 64
+#define QUEUEDPACKETSIZE 256
+#define SENDBUFSIZE (sizeof(packet_header_t) + 2 + BACKUPTICS * MAXTICBYTES)
+
+static union {
+  packet_header_t head;
+  byte            data[RECVBUFSIZE];
+} recvbuf;
+
+static union {
+  packet_header_t head;
+  byte            data[SENDBUFSIZE];
+} sendbuf;
+
+// PKT_EXTRA and PKT_QUIT packets held until their tic, in arrival order,
+// in slots from a fixed pool, or zone blocks when it is full or they are
+// too big. They can't be dropped: a lost quit leaves the game waiting
+// for the player's tics, a lost extra puts the players out of sync.
+static union {
+  packet_header_t head;
+  byte            data[QUEUEDPACKETSIZE];
+} queuepool[MAXQUEUEDPACKETS];
+
+#define POOLEDPACKET(p) \
+  ((void*)(p) >= (void*)queuepool && \
+   (void*)(p) < (void*)(queuepool + MAXQUEUEDPACKETS))
+
+static unsigned          numqueuedpackets, maxqueuedpackets;
 static packet_header_t** queuedpacket;
+static unsigned          numfreequeued;
+static packet_header_t*  freequeued[MAXQUEUEDPACKETS];
 doomcom_t*      doomcom;        
 int maketic;
 int ticdup = 1;
 static int xtratics = 0;
+static int ticencoding = TICENC_RAW; // Chosen by the server
+
+// Recent state hashes, ours and the other players', for the tic in each
+// slot's *hashtic, to compare when both have arrived
+#define HASHTICS 256
+static unsigned long localhash[HASHTICS];
+static int           localhashtic[HASHTICS];
+static unsigned long remotehash[MAXPLAYERS][HASHTICS];
+static int           remotehashtic[MAXPLAYERS][HASHTICS];
+static int hashsendtic;        // First tic whose hash is not yet sent
+static int desynctic = -1;     // First tic found to differ
+static int dumptic = -1;       // Tic to dump the state at
 
 void D_InitNetGame (void)
 {
@@ -79,12 +127,29 @@ void D_InitNetGame (void)
     // Get game info from server
     packet_header_t *packet = Z_Malloc(1000, PU_STATIC, NULL);
     struct setup_packet_s *sinfo = (void*)(packet+1);
+    const byte *p = NULL, *end;
+    size_t len;
 
     doomcom->numnodes = 1;
     do {
-      while (!I_GetPacket(packet, 1000)) 
+      while (!(len = I_GetPacket(packet, 1000))) 
 	I_uSleep(10000);
+      if (packet->type == PKT_DOWN)
+	I_Error("D_InitNetGame: Server refused us; it may run a different "
+		"version, see its output");
     } while (packet->type != PKT_SETUP);
+    netsession = doom_ntohs(packet->session); // The game the server put us in
+
+    // The server's protocol version follows the wad names, then the
+    // ticcmd encoding it picked for us
+    end = (const byte*)packet + len;
+    if (len >= sizeof *packet + offsetof(struct setup_packet_s, wadnames))
+      for (p = sinfo->wadnames, i = sinfo->numwads;
+	   i && (p = memchr(p, 0, end - p)); i--)
+	p++;
+    if (!p || p >= end || *p != PROTOCOL_VERSION)
+      I_Error("D_InitNetGame: Server uses protocol version %d, we need %d",
+	      p && p < end ? *p : 1, PROTOCOL_VERSION);
 
     // Get info from the setup packet
     doomcom->consoleplayer = sinfo->yourplayer;
@@ -96,12 +161,15 @@ void D_InitNetGame (void)
     startepisode = sinfo->episode;
     ticdup = sinfo->ticdup;
     xtratics = sinfo->extratic;
+    ticencoding = p+1 < end ? p[1] : TICENC_RAW;
     G_ReadOptions(sinfo->game_options);
     Z_Free(packet);
     localcmds = netcmds[consoleplayer];
+    memset(localhashtic, 0xff, sizeof localhashtic);
+    memset(remotehashtic, 0xff, sizeof remotehashtic);
 
-    lprintf(LO_INFO, "\tjoined game as player %d/%d; %d WADs specified\n", 
-	    doomcom->consoleplayer+1, doomcom->numplayers, sinfo->numwads);
+    lprintf(LO_INFO, "\tjoined game %d as player %d/%d; %d WADs specified\n", 
+	    netsession, doomcom->consoleplayer+1, doomcom->numplayers, sinfo->numwads);
     {
       int i = sinfo->numwads;
       char *p = sinfo->wadnames;
@@ -202,12 +270,169 @@ boolean D_NetGetWad(const char* name)
 #endif
 }
 
+// Holds a packet until CheckQueuedPackets finds its tic has come
+static void QueuePacket(const packet_header_t* packet, size_t len)
+{
+  static boolean initialised;
+  packet_header_t *copy;
+
+  if (!initialised) {
+    for (numfreequeued = 0; numfreequeued < MAXQUEUEDPACKETS; numfreequeued++)
+      freequeued[numfreequeued] = &queuepool[numfreequeued].head;
+    initialised = true;
+  }
+  if (numqueuedpackets == maxqueuedpackets) {
+    maxqueuedpackets = maxqueuedpackets ? maxqueuedpackets*2 : MAXQUEUEDPACKETS;
+    queuedpacket = realloc(queuedpacket,
+			   maxqueuedpackets * sizeof *queuedpacket);
+  }
+  if (numfreequeued && len <= QUEUEDPACKETSIZE)
+    copy = freequeued[--numfreequeued];
+  else
+    copy = Z_Malloc(len, PU_STATIC, NULL);
+  memcpy(queuedpacket[numqueuedpackets++] = copy, packet, len);
+}
+
+// Unpacks TICENC_DELTA tics from a PKT_TICS, from remotetic on
+static void ReadDeltaTics(const byte *p, const byte *end, int tics)
+{
+  ticcmd_t cmds[MAXPLAYERS];
+  int lastplayers = 0; // Bitmask of players in the previous tic
+
+  memset(cmds, 0, sizeof cmds);
+  while (tics > 0 && p < end) {
+    int n, players = *p++;
+
+    if (players & TICS_REPEAT) { // Same again
+      players = (players & ~TICS_REPEAT) + 1;
+      while (players-- && tics > 0) {
+	for (n=0; n<MAXPLAYERS; n++)
+	  if (lastplayers & (1<<n))
+	    GetTicSwap(&netcmds[n][remotetic%BACKUPTICS], &cmds[n]);
+	remotetic++; tics--;
+      }
+    } else {
+      lastplayers = 0;
+      while (players--) {
+	if (!(p = ReadTicDelta(p, end, &n, cmds))) return;
+	lastplayers |= 1<<n;
+	GetTicSwap(&netcmds[n][remotetic%BACKUPTICS], &cmds[n]);
+      }
+      remotetic++; tics--;
+    }
+  }
+}
+
+// Called when another player's hash or ours for a tic arrives. On the
+// first difference, both sides pick the same later tic to dump the state
+// at, so the two dumps can be compared.
+static void CheckStateHash(int player, int tic)
+{
+  int slot = tic % HASHTICS;
+
+  if (desynctic >= 0 || localhashtic[slot] != tic ||
+      remotehashtic[player][slot] != tic ||
+      localhash[slot] == remotehash[player][slot])
+    return;
+
+  desynctic = tic;
+  dumptic = (tic / TICRATE + 3) * TICRATE;
+  if (dumptic <= gametic)
+    dumptic = gametic + 1;
+  lprintf(LO_WARN, "CheckStateHash: out of sync with player %d at tic %d, "
+	  "dumping state at tic %d\n", player+1, tic, dumptic);
+  doom_printf("Out of sync with player %d", player+1);
+}
+
+static void ReadStateHashes(const packet_header_t* packet, size_t len)
+{
+  const byte *p = (const void*)(packet+1);
+  int from, count, i;
+
+  if (len < sizeof *packet + 2) return;
+  from = *p++; count = *p++;
+  if (from >= MAXPLAYERS || from == consoleplayer ||
+      len < sizeof *packet + 2 + 4*count)
+    return;
+
+  for (i=0; i<count; i++, p += 4) {
+    int tic = packet->tic + i, slot = tic % HASHTICS;
+    unsigned int hash;
+
+    memcpy(&hash, p, 4);
+    remotehash[from][slot] = (unsigned int)doom_ntohl(hash);
+    remotehashtic[from][slot] = tic;
+    CheckStateHash(from, tic);
+  }
+}
+
+// Sends the hashes of the tics run since the last lot; it goes
+// through sendbuf, which is big enough for HASHBATCH of them
+static void SendStateHashes(void)
+{
+  packet_header_t *packet = &sendbuf.head;
+  byte *p = (void*)(packet+1);
+  int count = gametic - hashsendtic;
+
+  if (count <= 0) return;
+  if (count > HASHBATCH) {
+    hashsendtic = gametic - HASHBATCH;
+    count = HASHBATCH;
+  }
+  packet->tic = hashsendtic;
+  packet->type = PKT_HASH;
+  *p++ = consoleplayer; *p++ = count;
+  while (count--) {
+    unsigned int hash = doom_htonl(localhash[hashsendtic++ % HASHTICS]);
+    memcpy(p, &hash, 4); p += 4;
+  }
+  I_SendPacket(packet, p - (byte*)packet);
+}
+
+static void DumpState(void)
+{
+  char name[32];
+  FILE *f;
+
+  sprintf(name, "desync-%d-p%d.txt", gametic, consoleplayer+1);
+  if (!(f = fopen(name, "w"))) {
+    lprintf(LO_WARN, "DumpState: failed to open %s\n", name);
+    return;
+  }
+  fprintf(f, "desync at tic %d\n", desynctic);
+  P_DumpState(f);
+  fclose(f);
+  doom_printf("Game state written to %s", name);
+}
+
+// Hashes the state after the tic just run, and passes the hashes on
+static void UpdateStateHash(void)
+{
+  int tic = gametic - 1, i;
+
+  if (gamestate == GS_LEVEL) {
+    localhash[tic % HASHTICS] = P_StateHash();
+    localhashtic[tic % HASHTICS] = tic;
+    for (i=0; i<MAXPLAYERS; i++)
+      if (i != consoleplayer && playeringame[i])
+	CheckStateHash(i, tic);
+    if (gametic - hashsendtic >= HASHBATCH)
+      SendStateHashes();
+  } else { // No playsim; send what is left, and skip this tic
+    SendStateHashes();
+    hashsendtic = gametic;
+  }
+
+  if (gametic == dumptic)
+    DumpState();
+}
+
 void NetUpdate(void)
 {
   if (server) { // Receive network packets
     size_t recvlen;
-    packet_header_t *packet = Z_Malloc(10000, PU_STATIC, NULL);
-    while ((recvlen = I_GetPacket(packet, 10000))) {
+    packet_header_t *packet = &recvbuf.head;
+    while ((recvlen = I_GetPacket(packet, sizeof recvbuf))) {
       switch(packet->type) {
       case PKT_TICS:
 	{
@@ -221,7 +446,9 @@ void NetUpdate(void)
 	  } else {
 	    if (packet->tic + tics <= remotetic) break; // Will not improve things
 	    remotetic = packet->tic;
-	    while (tics--) {
+	    if (ticencoding == TICENC_DELTA)
+	      ReadDeltaTics(p, (byte*)packet + recvlen, tics);
+	    else while (tics--) {
 	      int players = *p++;
 	      while (players--) {
 		int n = *p++;
@@ -245,19 +472,18 @@ void NetUpdate(void)
 	  doom_printf("Server is down\nAll other players are no longer in the game\n");
 	}
 	break;
+      case PKT_HASH: // Another player's state hashes
+	ReadStateHashes(packet, recvlen);
+	break;
       case PKT_EXTRA: // Misc stuff
       case PKT_QUIT: // Player quit
 	// Queue packet to be processed when its tic time is reached
-	queuedpacket = Z_Realloc(queuedpacket, ++numqueuedpackets * sizeof *queuedpacket, 
-				 PU_STATIC, NULL);
-	queuedpacket[numqueuedpackets-1] = Z_Malloc(recvlen, PU_STATIC, NULL);
-	memcpy(queuedpacket[numqueuedpackets-1], packet, recvlen);
+	QueuePacket(packet, recvlen);
 	break;
       default: // Other packet, unrecognised or redundant
 	break;
       }
     }
-    Z_Free(packet);
   }
   { // Build new ticcmds
     static int lastmadetic;
@@ -274,21 +500,30 @@ void NetUpdate(void)
     if (server && maketic > remotesend) { // Send the tics to the server
       int sendtics;
       remotesend -= xtratics;
+      // Older tics than this are gone from localcmds anyway
+      if (remotesend < maketic - BACKUPTICS)
+	remotesend = maketic - BACKUPTICS;
       sendtics = maketic - remotesend;
       {
-	size_t pkt_size = sizeof(packet_header_t) + 2 + sendtics * sizeof(ticcmd_t);
-	packet_header_t *packet = Z_Malloc(pkt_size, PU_STATIC, NULL);
+	packet_header_t *packet = &sendbuf.head;
+	byte *p = ((byte*)(packet+1)) + 2;
+	ticcmd_t cmd, last;
 	
 	packet->tic = maketic - sendtics;
 	packet->type = PKT_TICC;
 	*(byte*)(packet+1) = sendtics;
 	*(((byte*)(packet+1))+1) = consoleplayer;
-	{
-	  ticcmd_t *tic = (void*)(((char*)(packet+1)) +2);
-	  while (sendtics--) GetTicSwap(tic++, &localcmds[remotesend++%BACKUPTICS]);
+	memset(&last, 0, sizeof last);
+	while (sendtics--) {
+	  GetTicSwap(&cmd, &localcmds[remotesend++%BACKUPTICS]);
+	  if (ticencoding == TICENC_DELTA) {
+	    p = WriteTicDelta(p, consoleplayer, &cmd, &last);
+	    last = cmd;
+	  } else {
+	    memcpy(p, &cmd, sizeof cmd); p += sizeof cmd;
+	  }
 	}
-	I_SendPacket(packet, pkt_size);
-	Z_Free(packet);
+	I_SendPacket(packet, p - (byte*)packet);
       }
     }
   }
@@ -346,19 +581,18 @@ static void CheckQueuedPackets(void)
 	break;
       }
 
-  { // Requeue remaining packets
+  { // Requeue remaining packets, in order, and free the slots of the rest
     int newnum = 0;
-    packet_header_t **newqueue = NULL;
 
     for (i=0; i<numqueuedpackets; i++)
-      if (queuedpacket[i]->tic > gametic) {
-	newqueue = Z_Realloc(newqueue, ++newnum * sizeof *newqueue, 
-			     PU_STATIC, NULL);
-	newqueue[newnum-1] = queuedpacket[i];
-      } else Z_Free(queuedpacket[i]);
-
-    Z_Free(queuedpacket);
-    numqueuedpackets = newnum; queuedpacket = newqueue;
+      if (queuedpacket[i]->tic > gametic)
+	queuedpacket[newnum++] = queuedpacket[i];
+      else if (POOLEDPACKET(queuedpacket[i]))
+	freequeued[numfreequeued++] = queuedpacket[i];
+      else
+	Z_Free(queuedpacket[i]);
+
+    numqueuedpackets = newnum;
   }
 }
 
@@ -389,6 +623,7 @@ void TryRunTics (void)
     M_Ticker ();
     G_Ticker ();
     gametic++;
+    if (server) UpdateStateHash();
     NetUpdate(); // Keep sending our tics to avoid stalling remote nodes
   }
 }
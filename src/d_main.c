@@ -53,6 +53,8 @@ static const char rcsid[] = "$Id: d_main.c,v 1.46 2000/03/27 10:33:49 cph Exp $"
 #include "m_argv.h"
 #include "m_misc.h"
 #include "m_menu.h"
+#include "m_viddump.h"
+#include "m_demosync.h"
 #include "i_main.h"
 #include "i_system.h"
 #include "i_sound.h"
@@ -184,8 +186,12 @@ static void D_Wipe(void)
       int nowtime, tics;
       do
         {
-	  I_uSleep(10000); // CPhipps - don't thrash cpu in this loop
-          nowtime = I_GetTime();
+	  if (viddump_active) {
+	    nowtime = wipestart + 1; // one tic per dumped frame, no waiting
+	  } else {
+	    I_uSleep(10000); // CPhipps - don't thrash cpu in this loop
+	    nowtime = I_GetTime();
+	  }
           tics = nowtime - wipestart;
         }
       while (!tics);
@@ -194,6 +200,7 @@ static void D_Wipe(void)
       I_UpdateNoBlit();
       M_Drawer();                   // menu is drawn even on top of wipes
       I_FinishUpdate();             // page flip or blit buffer
+      M_VidDumpFrame();
     }
   while (!done);
 }
@@ -275,12 +282,16 @@ void D_Display (void)
     // Now do the drawing
     if (viewactive)
       R_RenderPlayerView (&players[displayplayer]);
+    R_ProfileBegin(rprof_hud);
     if (automapmode & am_active)
       AM_Drawer();
     ST_Drawer(viewheight == SCREENHEIGHT, redrawborderstuff);
     R_DrawViewBorder();
     if (isborder) R_CopyStatusBar();
     HU_Drawer();
+    R_ProfileEnd(rprof_hud);
+    if (rendering_profile && viewactive)
+      R_DrawProfile();
   }
 
   inhelpscreensstate = inhelpscreens;
@@ -309,9 +320,13 @@ void D_Display (void)
   NetUpdate();         // send out any new accumulation
   
   // normal update
-  if (!wipe)
+  if (!wipe) {
+    R_ProfileBegin(rprof_blit);
     I_FinishUpdate ();              // page flip or blit buffer
-  else {
+    R_ProfileEnd(rprof_blit);
+    M_VidDumpFrame();
+    R_ProfileEndFrame();
+  } else {
     // wipe update
     wipe_EndScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
     D_Wipe();
@@ -353,7 +368,9 @@ static void D_DoomLoop(void)
       I_StartFrame ();
 
       // process one or more tics
-      if (singletics)
+      if (demoseektic >= 0 && gameaction != ga_playdemo)
+        G_DoDemoSeek (); // playsim only, up to the tic asked for
+      else if (singletics)
         {
           I_StartTic ();
           D_ProcessEvents ();
@@ -1173,6 +1190,7 @@ unsigned int desired_screenwidth, desired_screenheight;
 void D_DoomMainSetup(void)
 {
   int p,i,slot;
+  const char *demosyncname;
   const char *cena="ICWEFDA",*pos;  //jff 9/3/98 use this for parsing console masks // CPhipps - const char*'s
 
   //jff 9/3/98 get mask for console output filter
@@ -1365,7 +1383,7 @@ void D_DoomMainSetup(void)
 
   //jff 1/22/98 add command line parms to disable sound and music
   {
-    int nosound = M_CheckParm("-nosound");
+    int nosound = M_CheckParm("-nosound") || M_CheckParm("-syncdemos");
     nomusicparm = nosound || M_CheckParm("-nomusic");
     nosfxparm   = nosound || M_CheckParm("-nosfx");
   }
@@ -1419,6 +1437,10 @@ void D_DoomMainSetup(void)
 	}
       }
 
+    // -width, -height and -geom are not checked like the config file is
+    if (w > MAX_SCREENWIDTH) w = MAX_SCREENWIDTH;
+    if (h > MAX_SCREENHEIGHT) h = MAX_SCREENHEIGHT;
+
     I_SetRes(w, h);
   }
 
@@ -1502,6 +1524,8 @@ void D_DoomMainSetup(void)
       lprintf(LO_CONFIRM,"Playing demo %s\n",file);
     }
 
+  M_DemoSyncAddFiles();
+
   // internal translucency set to config file value               // phares
   general_translucency = default_translucency;                    // phares
 
@@ -1552,6 +1576,11 @@ void D_DoomMainSetup(void)
   lprintf(LO_INFO,"\nP_Init: Init Playloop state.\n");
   P_Init();
 
+  // Before I_Init, which sets up sound differently when dumping
+  M_VidDumpInit();
+  if (viddump_active)
+    singletics = true;  // every tic drawn, and no waiting for the clock
+
   //jff 9/3/98 use logical output routine
   lprintf(LO_INFO,"I_Init: Setting up machine state.\n");
   I_Init();
@@ -1606,6 +1635,15 @@ void D_DoomMainSetup(void)
 	}
     }
 
+  if ((demosyncname = M_DemoSyncStart()))
+    {
+      // A -syncdemos child: play the one demo as fast as possible
+      nodrawers = true;
+      singletics = true;
+      G_DeferedPlayDemo(demosyncname);
+      singledemo = true;
+    }
+  else
   if ((p = M_CheckParm ("-fastdemo")) && ++p < myargc)
     {                                 // killough
       fastdemo = true;                // run at fastest speed possible
@@ -1628,6 +1666,10 @@ void D_DoomMainSetup(void)
 	  singledemo = true;          // quit after one demo
 	}
 
+  // Start the demo part way through
+  if (singledemo && (p = M_CheckParm("-demoseek")) && ++p < myargc)
+    G_DemoSeek(atoi(myargv[p]));
+
   if (slot && ++slot < myargc)
     {
       slot = atoi(myargv[slot]);        // killough 3/16/98: add slot info
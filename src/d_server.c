@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <time.h>
 #include <sys/time.h>
 #include <limits.h>
@@ -41,8 +42,14 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
 #include <sys/socket.h>
 
+#include "../config.h"
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #define SERVER
@@ -70,16 +77,47 @@ void I_Error(const char *error, ...) // killough 3/20/98: add const
   exit(-1);
 }
 
-int playerjoingame[MAXPLAYERS], playerleftgame[MAXPLAYERS];
-#define playeringame(i) ((playerjoingame[i] < INT_MAX) && (playerleftgame[i] == INT_MAX))
-struct sockaddr_in remoteaddr[MAXPLAYERS];
+// Each game being served is a session, numbered from 1. Clients put the
+// session number in every packet header; a PKT_INIT for session 0 joins
+// any game still waiting for players, or starts a new one. Sessions are
+// all allocated at startup and reused once their game is over.
+
+typedef struct {
+  boolean active;             // Slot in use
+  boolean ingame;             // All players joined, game running
+  boolean newtics;            // Tics arrived since we last sent any
+  int curplayers;
+  int exectics;               // gametics completed
+  int playerjoingame[MAXPLAYERS], playerleftgame[MAXPLAYERS];
+  int remoteticfrom[MAXPLAYERS], remoteticto[MAXPLAYERS];
+  struct sockaddr_in remoteaddr[MAXPLAYERS];
+  ticcmd_t netcmds[MAXPLAYERS][BACKUPTICS];
+  byte ticencoding[MAXPLAYERS]; // TICENC_* each client gets
+  struct setup_packet_s setupinfo;
+} session_t;
+
+#define playeringame(s,i) (((s)->playerjoingame[i] < INT_MAX) && ((s)->playerleftgame[i] == INT_MAX))
+#define SessionNum(s) ((int)((s) - sessions) + 1)
+
+static session_t *sessions;
+static int maxsessions = 64;
+
+// Packet buffers, allocated once
+#define MAXPACKETSIZE 10000
+static packet_header_t *recvpacket, *sendpacket;
+
+void SendPacketTo(session_t *s, packet_header_t *packet, size_t len, int n)
+{
+  packet->session = doom_htons(SessionNum(s));
+  I_SendPacketTo(packet, len, &s->remoteaddr[n]);
+}
 
-void BroadcastPacket(packet_header_t *packet, size_t len)
+void BroadcastPacket(session_t *s, packet_header_t *packet, size_t len)
 {
   int i;
   for (i=0; i<MAXPLAYERS; i++)
-    if (playeringame(i))
-      I_SendPacketTo(packet, len, &remoteaddr[i]);
+    if (playeringame(s,i))
+      SendPacketTo(s, packet, len, i);
 }
 
 byte def_game_options[GAME_OPTIONS_SIZE] = \
@@ -97,6 +135,66 @@ byte def_game_options[GAME_OPTIONS_SIZE] = \
 
 int verbose;
 
+// Game settings from the command line, used for every session
+static struct setup_packet_s setupinfo = { 2, 0, 1, 1, 1, 0, 3};
+static int numplayers = 2, xtratics = 0;
+static char**wadname = NULL;
+static char**wadget = NULL;
+static int numwads = 0;
+
+static session_t *StartSession(int id)
+{
+  session_t *s = &sessions[id-1];
+  int i;
+
+  memset(s, 0, sizeof *s);
+  s->active = true;
+  for (i=0; i<MAXPLAYERS; i++) { // no players initially
+    s->playerjoingame[i] = INT_MAX; s->playerleftgame[i] = 0;
+  }
+  s->setupinfo = setupinfo;
+  { /* Random number seed 
+     * Mirrors the corresponding code in G_ReadOptions */
+    int rngseed = time(NULL) + id;
+    s->setupinfo.game_options[13] = rngseed & 0xff;
+    rngseed >>= 8;
+    s->setupinfo.game_options[12] = rngseed & 0xff;
+    rngseed >>= 8;
+    s->setupinfo.game_options[11] = rngseed & 0xff;
+    rngseed >>= 8;
+    s->setupinfo.game_options[10] = rngseed & 0xff;
+  }
+  printf("Session %d: waiting for %d players\n", id, numplayers);
+  return s;
+}
+
+static boolean SessionFull(const session_t *s)
+{
+  int i, joined = 0;
+
+  for (i=0; i<MAXPLAYERS; i++)
+    if (s->playerjoingame[i] != INT_MAX)
+      joined++;
+  return joined >= numplayers;
+}
+
+// Finds the session a PKT_INIT wants to join, starting it if need be
+static session_t *JoinSession(int id)
+{
+  if (id) { // A particular game
+    if (id > maxsessions) return NULL;
+    return sessions[id-1].active ? &sessions[id-1] : StartSession(id);
+  }
+  for (id=1; id<=maxsessions; id++) // Any game still waiting for players
+    if (sessions[id-1].active && !sessions[id-1].ingame && 
+	!SessionFull(&sessions[id-1]))
+      return &sessions[id-1];
+  for (id=1; id<=maxsessions; id++)
+    if (!sessions[id-1].active)
+      return StartSession(id);
+  return NULL; // No room
+}
+
 void sig_handler(int signum)
 {
   char buf[80];
@@ -110,27 +208,350 @@ void sig_handler(int signum)
 void doexit(void)
 {
   packet_header_t packet;
+  int i;
 
   // Send "downed" packet
   packet.type = PKT_DOWN; 
   packet.tic = 0; // Clients should not need the tic number, can't see a use for it
-  BroadcastPacket(&packet, sizeof packet);
+  for (i=0; i<maxsessions; i++)
+    if (sessions[i].active)
+      BroadcastPacket(&sessions[i], &packet, sizeof packet);
+}
+
+//
+// Event loop
+//
+// The server sleeps until the socket has something for it, so packets
+// are handled as soon as they arrive. Uses epoll(7) where available.
+//
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epollfd;
+#endif
+
+static void InitEventLoop(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  if ((epollfd = epoll_create(1)) < 0) {
+    perror("epoll_create"); exit(1);
+  }
+  memset(&ev, 0, sizeof ev);
+  ev.events = EPOLLIN; ev.data.fd = recvsocket;
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, recvsocket, &ev) < 0) {
+    perror("epoll_ctl"); exit(1);
+  }
+#endif
+}
+
+static void WaitForPackets(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  if (epoll_wait(epollfd, &ev, 1, -1) < 0 && errno != EINTR)
+    perror("epoll_wait");
+#else
+  fd_set fds;
+
+  FD_ZERO(&fds); FD_SET(recvsocket, &fds);
+  if (select(recvsocket+1, &fds, NULL, NULL, NULL) < 0 && errno != EINTR)
+    perror("select");
+#endif
+}
+
+static void ProcessPacket(packet_header_t *packet, size_t len)
+{
+  int id = (unsigned short)doom_ntohs(packet->session);
+  session_t *s;
+
+  if (verbose>2) printf("Received packet:");
+  if (packet->type == PKT_INIT) {
+    int n;
+    struct setup_packet_s *sinfo = (void*)(packet+1);
+    const struct init_packet_s *iinfo = (void*)(packet+1);
+    const char *rname = iinfo->myaddr;
+    byte encodings;
+
+    printf("INIT\n");
+    if (len < sizeof *packet + offsetof(struct init_packet_s, version) + 1 ||
+	iinfo->version != PROTOCOL_VERSION) {
+      // An older or newer client; its packets would be misread, so turn
+      // it away, with a PKT_DOWN in case it knows to expect one
+      struct sockaddr_in to = sentfrom;
+
+      printf("Refused client at %s: protocol version %d, not %d\n",
+	     inet_ntoa(sentfrom.sin_addr),
+	     len < sizeof *packet + offsetof(struct init_packet_s, version) + 1 ?
+	     1 : iinfo->version, PROTOCOL_VERSION);
+      if (len >= sizeof *packet + offsetof(struct init_packet_s, myaddr))
+	to.sin_port = iinfo->port;
+      packet->type = PKT_DOWN; packet->tic = 0; packet->session = 0;
+      I_SendPacketTo(packet, sizeof *packet, &to);
+      return;
+    }
+    encodings = iinfo->ticencodings;
+    if (!(s = JoinSession(id)) || s->ingame) return;
+
+    // Add player to the game
+    for (n=0; n<MAXPLAYERS; n++)
+      if (s->playerjoingame[n] == INT_MAX) break;
+
+    if (n == MAXPLAYERS) return; // Full game
+    s->playerjoingame[n] = 0;
+    s->remoteaddr[n] = sentfrom;
+    s->remoteaddr[n].sin_port = iinfo->port;
+    s->ticencoding[n] = (encodings & (1<<TICENC_DELTA)) ? TICENC_DELTA : TICENC_RAW;
+
+    if (!memchr(rname,0,len - sizeof *packet - offsetof(struct init_packet_s, myaddr)))
+      rname = "Invalid";
+    printf("%s(%s:%u) joined session %d\n", rname,
+	   inet_ntoa(s->remoteaddr[n].sin_addr), 
+	   ntohs(s->remoteaddr[n].sin_port), SessionNum(s));
+    {
+      int i;
+      size_t extrabytes = 0;
+      // Send setup packet, twice in case one is lost
+      packet->type = PKT_SETUP;
+      packet->tic = 0;
+      memcpy(sinfo, &s->setupinfo, sizeof s->setupinfo);
+      sinfo->yourplayer = n;
+      sinfo->numwads = numwads;
+      for (i=0; i<numwads; i++) {
+	strcpy(sinfo->wadnames + extrabytes, wadname[i]);
+	extrabytes += strlen(wadname[i]) + 1;
+      }
+      sinfo->wadnames[extrabytes++] = PROTOCOL_VERSION;
+      sinfo->wadnames[extrabytes++] = s->ticencoding[n];
+      SendPacketTo(s, packet, sizeof *packet + sizeof s->setupinfo + extrabytes, n);
+      SendPacketTo(s, packet, sizeof *packet + sizeof s->setupinfo + extrabytes, n);
+    }
+    return;
+  }
+
+  if (!id || id > maxsessions || !(s = &sessions[id-1])->active) {
+    if (verbose) printf("Packet for unknown session %d\n", id);
+    return;
+  }
+
+  switch (packet->type) {
+  case PKT_GO:
+    if (!s->ingame) {
+      int from = *(byte*)(packet+1);
+
+      if (from >= MAXPLAYERS || s->playerleftgame[from] == INT_MAX) break;
+      s->playerleftgame[from] = INT_MAX;
+      if (++s->curplayers == numplayers) {
+	s->ingame=true;
+	printf("Session %d: all players joined, beginning game.\n", id);
+	packet->type = PKT_GO; packet->tic = 0;
+	BroadcastPacket(s, packet, sizeof *packet);
+	BroadcastPacket(s, packet, sizeof *packet);
+      }
+    }
+    break;
+  case PKT_TICC:
+    {
+      byte tics = *(byte*)(packet+1);
+      int from = *(((byte*)(packet+1))+1);
+
+      if (from >= MAXPLAYERS) break;
+      if (verbose>2)
+	printf("tics %d - %d from %d\n", packet->tic, packet->tic + tics - 1, from);
+      if (packet->tic > s->remoteticfrom[from]) {
+	// Missed tics, so request a resend
+	packet->tic = s->remoteticfrom[from];
+	packet->type = PKT_RETRANS;
+	SendPacketTo(s, packet, sizeof *packet, from);
+      } else {
+	const byte *p = ((byte*)(packet+1))+2, *end = (byte*)packet + len;
+	if (packet->tic + tics < s->remoteticfrom[from]) break; // Won't help
+	s->remoteticfrom[from] = packet->tic;
+	if (s->ticencoding[from] == TICENC_DELTA) {
+	  ticcmd_t cmds[MAXPLAYERS];
+	  int n;
+
+	  memset(cmds, 0, sizeof cmds);
+	  while (tics-- && (p = ReadTicDelta(p, end, &n, cmds)) && n == from)
+	    s->netcmds[from][s->remoteticfrom[from]++%BACKUPTICS] = cmds[n];
+	} else
+	  while (tics-- && p + sizeof(ticcmd_t) <= end) {
+	    memcpy(&s->netcmds[from][s->remoteticfrom[from]++%BACKUPTICS], p, 
+		   sizeof(ticcmd_t));
+	    p += sizeof(ticcmd_t);
+	  }
+	s->newtics = true;
+      }
+    }
+    break;
+  case PKT_RETRANS:
+    {
+      int from = *(byte*)(packet+1);
+
+      if (from >= MAXPLAYERS) break;
+      if (verbose>2) printf("%d requests resend from %d\n", from, packet->tic);
+      s->remoteticto[from] = packet->tic;
+      s->newtics = true;
+    }
+    break;
+  case PKT_QUIT:
+    { 
+      int from = *(byte*)(packet+1);
+
+      if (from >= MAXPLAYERS) break;
+      if (verbose>2) printf("%d quits at %d\n", from, packet->tic);
+      if (s->playerleftgame[from] == INT_MAX) { // In the game
+	s->playerleftgame[from] = packet->tic;
+	if (s->ingame && !--s->curplayers) { // All players have exited
+	  printf("Session %d: game over\n", id);
+	  s->active = false;
+	  break;
+	}
+	s->newtics = true; // May be able to run more tics without them
+      }
+    }
+    // Fall through and broadcast it
+  case PKT_HASH:
+  case PKT_EXTRA:
+    BroadcastPacket(s, packet, len);
+    if (packet->type == PKT_EXTRA) {
+      if (verbose>2) printf("misc from %d\n", *(((byte*)(packet+1))+1));
+    }
+    break;
+  case PKT_WAD:
+    {
+      int i;
+      int from = *(byte*)(packet+1);
+      char *name = 1 + (char*)(packet+1);
+      size_t size = sizeof(packet_header_t);
+
+      if (from >= MAXPLAYERS || !memchr(name, 0, len - size - 1)) break;
+      if (verbose) printf("Request for %s ", name);
+      for (i=0; i<numwads; i++)
+	if (!strcasecmp(name, wadname[i]))
+	  break;
+
+      if ((i==numwads) || !wadget[i] ||
+	  size + strlen(wadname[i]) + strlen(wadget[i]) + 2 > MAXPACKETSIZE) {
+	if (verbose) printf("n/a\n");
+	*(char*)(packet+1) = 0;
+	SendPacketTo(s, packet, size+1, from); 
+      } else {
+	size += strlen(wadname[i]) + strlen(wadget[i]) + 2;
+	sendpacket->type = PKT_WAD; sendpacket->tic = 0;
+	strcpy((char*)(sendpacket+1), wadname[i]);
+	strcpy((char*)(sendpacket+1) + strlen(wadname[i]) + 1, wadget[i]);
+	printf("sending %s\n", wadget[i]);
+	SendPacketTo(s, sendpacket, size, from);
+      }
+    }
+    break;
+  default:
+    printf("Unrecognised packet type %d\n", packet->type);
+    break;
+  }
+}
+
+// Most tics in one PKT_TICS, the count is a byte
+#define MAXSENDTICS 255
+
+// Is tic the same as the last one sent, for the players in it?
+static boolean RepeatedTic(const session_t *s, int tic, int players, 
+			   const ticcmd_t *last)
+{
+  int j;
+
+  for (j=0; j<MAXPLAYERS; j++)
+    if ((players & (1<<j)) && 
+	memcmp(&s->netcmds[j][tic%BACKUPTICS], &last[j], sizeof *last))
+      return false;
+  return true;
+}
+
+static void RunTics(session_t *s)
+{
+  int lowtic = INT_MAX;
+  int i;
+
+  for (i=0; i<MAXPLAYERS; i++) 
+    if (playeringame(s,i))
+      if (s->remoteticfrom[i]<lowtic)
+	lowtic = s->remoteticfrom[i];
+
+  if (verbose>1) printf("%d new tics can be run\n", lowtic - s->exectics);
+
+  if (lowtic > s->exectics) 
+    s->exectics = lowtic; // count exec'ed tics
+  // Now send all tics up to lowtic
+  for (i=0; i<MAXPLAYERS; i++) 
+    if (playeringame(s,i)) {
+      int tics;
+      boolean delta = s->ticencoding[i] == TICENC_DELTA;
+      if (lowtic <= s->remoteticto[i]) continue;
+      s->remoteticto[i] -= xtratics;
+      tics = lowtic - s->remoteticto[i]; 
+      if (verbose>1) printf("sending %d tics to %d\n", tics, i);
+      while (tics) { // As many packets as it takes
+	byte *p = (void*)(sendpacket+1), *count = p++, *run = NULL;
+	const byte *full = (byte*)sendpacket + MAXTICPACKET - 
+	  (1 + MAXPLAYERS * MAXTICBYTES);
+	ticcmd_t last[MAXPLAYERS];
+	int lastplayers = -1; // None yet, so the first tic is never a repeat
+
+	memset(last, 0, sizeof last);
+	sendpacket->type = PKT_TICS; sendpacket->tic = s->remoteticto[i] - xtratics;
+	*count = 0;
+	while (tics && *count < MAXSENDTICS && p <= full) {
+	  int j, players = 0, tic = s->remoteticto[i];
+
+	  for (j=0; j<MAXPLAYERS; j++)
+	    if ((s->playerjoingame[j] < tic) && (s->playerleftgame[j] > tic))
+	      players |= 1<<j;
+
+	  if (delta && players == lastplayers && RepeatedTic(s, tic, players, last)) {
+	    if (run && *run < (TICS_REPEAT | (TICS_MAXREPEAT-1)))
+	      (*run)++;
+	    else
+	      *(run = p++) = TICS_REPEAT;
+	  } else {
+	    int playersthistic = 0;
+	    byte *q = p++;
+
+	    for (j=0; j<MAXPLAYERS; j++)
+	      if (players & (1<<j)) {
+		const ticcmd_t *cmd = &s->netcmds[j][tic%BACKUPTICS];
+
+		if (delta) {
+		  p = WriteTicDelta(p, j, cmd, &last[j]);
+		  last[j] = *cmd;
+		} else {
+		  *p++ = j;
+		  memcpy(p, cmd, sizeof(ticcmd_t));
+		  p += sizeof(ticcmd_t);
+		}
+		playersthistic++;
+	      }
+	    *q = playersthistic;
+	    lastplayers = players;
+	    run = NULL;
+	  }
+	  (*count)++; s->remoteticto[i]++; tics--;
+	}
+	SendPacketTo(s, sendpacket, p - ((byte*)sendpacket), i);
+      }
+    }
 }
 
 int main(int argc, char** argv)
 {
-  int localport = 5030, numplayers = 2, xtratics = 0, ticdup = 1;
-  int exectics = 0; // gametics completed
-  struct setup_packet_s setupinfo = { 2, 0, 1, 1, 1, 0, 3};
-  char**wadname = NULL;
-  char**wadget = NULL;
-  int numwads = 0;
+  int localport = 5030, ticdup = 1;
   {
     int opt;
     byte *gameopt = setupinfo.game_options;
 
     memcpy(gameopt, &def_game_options, sizeof (setupinfo.game_options));
-    while ((opt = getopt(argc, argv, "p:e:l:adrfns:c:N:x:t:vw:")) != EOF)
+    while ((opt = getopt(argc, argv, "p:e:l:adrfns:c:N:x:t:vw:S:")) != EOF)
       switch (opt) {
       case 't':
 	if (optarg) ticdup = atoi(optarg);
@@ -168,6 +589,9 @@ int main(int argc, char** argv)
       case 'N':
 	if (optarg) setupinfo.players = numplayers = atoi(optarg);
 	break;
+      case 'S':
+	if (optarg) maxsessions = atoi(optarg);
+	break;
       case 'v':
 	verbose++;
 	break;
@@ -186,28 +610,25 @@ int main(int argc, char** argv)
   }
 
   setupinfo.ticdup = ticdup; setupinfo.extratic = xtratics;
-  { /* Random number seed 
-     * Mirrors the corresponding code in G_ReadOptions */
-    int rngseed = time(NULL);
-    setupinfo.game_options[13] = rngseed & 0xff;
-    rngseed >>= 8;
-    setupinfo.game_options[12] = rngseed & 0xff;
-    rngseed >>= 8;
-    setupinfo.game_options[11] = rngseed & 0xff;
-    rngseed >>= 8;
-    setupinfo.game_options[10] = rngseed & 0xff;
+  if (maxsessions < 1) maxsessions = 1;
+  if (maxsessions > USHRT_MAX) maxsessions = USHRT_MAX;
+
+  sessions = calloc(maxsessions, sizeof *sessions);
+  recvpacket = malloc(MAXPACKETSIZE);
+  sendpacket = malloc(MAXPACKETSIZE);
+  if (!sessions || !recvpacket || !sendpacket) {
+    printf("Not enough memory for %d sessions\n", maxsessions);
+    return 1;
   }
               
   I_InitSockets(localport);
+  InitEventLoop();
 
-  printf("Listening on port %d, waiting for %d players\n", localport, numplayers);
+  printf("Listening on port %d, up to %d games of %d players\n", 
+	 localport, maxsessions, numplayers);
 
-  { // no players initially
+  { // Print wads
     int i;
-    for (i=0; i<MAXPLAYERS; i++)
-      playerjoingame[i] = INT_MAX; playerleftgame[i] = 0;
-
-    // Print wads
     for (i=0; i<numwads; i++)
       printf("Wad %s (%s)\n", wadname[i], wadget[i]);
   }
@@ -220,210 +641,19 @@ int main(int argc, char** argv)
   signal(SIGKILL, sig_handler);
   signal(SIGHUP , sig_handler);
   
-  {
-    int remoteticfrom[MAXPLAYERS] = { 0, 0, 0, 0 };
-    int remoteticto[MAXPLAYERS] = { 0, 0, 0, 0 };
-    int curplayers = 0;
-    boolean ingame = false;
-    ticcmd_t netcmds[MAXPLAYERS][BACKUPTICS];
-
-    while (1) {
-      {
-	packet_header_t *packet = malloc(10000);
-	size_t len;
-	
-	usleep(10000);
-	while ((len = I_GetPacket(packet, 10000))) {
-	  if (verbose>2) printf("Received packet:");
-	  switch (packet->type) {
-	  case PKT_INIT:
-	    printf("INIT\n");
-	    if (!ingame) {
-	      {
-		int n;
-		struct setup_packet_s *sinfo = (void*)(packet+1);
-		const char *rname = (void*)((short*)(packet+1)+1);
-		
-		// Add player to the game
-		for (n=0; n<MAXPLAYERS; n++)
-		  if (playerjoingame[n] == INT_MAX) break;
-
-		if (n == MAXPLAYERS) break; // Full game
-		playerjoingame[n] = 0;
-		remoteaddr[n] = sentfrom;
-		remoteaddr[n].sin_port = *(short*)(packet+1);
-
-		if (!memchr(rname,0,1000)) rname = "Invalid";
-		printf("%s(%s:%u) joined\n", rname,
-		       inet_ntoa(remoteaddr[n].sin_addr), 
-		       ntohs(remoteaddr[n].sin_port));
-		{
-		  int i;
-		  size_t extrabytes = 0;
-		  // Send setup packet
-		  packet->type = PKT_SETUP;
-		  packet->tic = 0;
-		  memcpy(sinfo, &setupinfo, sizeof setupinfo);
-		  sinfo->yourplayer = n;
-		  sinfo->numwads = numwads;
-		  for (i=0; i<numwads; i++) {
-		    strcpy(sinfo->wadnames + extrabytes, wadname[i]);
-		    extrabytes += strlen(wadname[i]) + 1;
-		  }
-		  I_SendPacketTo(packet, sizeof *packet + sizeof setupinfo + extrabytes, 
-				 remoteaddr+n);
-		  usleep(10000);
-		  I_SendPacketTo(packet, sizeof *packet + sizeof setupinfo + extrabytes, 
-				 remoteaddr+n);
-		}
-	      }
-	    }
-	    break;
-	  case PKT_GO:
-	    if (!ingame) {
-	      int from = *(byte*)(packet+1);
-
-	      if (playerleftgame[from] == INT_MAX) break;
-	      playerleftgame[from] = INT_MAX;
-	      if (++curplayers == numplayers) {
-		ingame=true;
-		printf("All players joined, beginning game.\n");
-		packet->type = PKT_GO; packet->tic = 0;
-		BroadcastPacket(packet, sizeof *packet);
-		usleep(10000);
-		BroadcastPacket(packet, sizeof *packet);
-		usleep(100000);
-	      }
-	    }
-	    break;
-	  case PKT_TICC:
-	    {
-	      byte tics = *(byte*)(packet+1);
-	      int from = *(((byte*)(packet+1))+1);
-
-	      if (verbose>2)
-		printf("tics %d - %d from %d\n", packet->tic, packet->tic + tics - 1, from);
-	      if (packet->tic > remoteticfrom[from]) {
-		// Missed tics, so request a resend
-		packet->tic = remoteticfrom[from];
-		packet->type = PKT_RETRANS;
-		I_SendPacketTo(packet, sizeof *packet, remoteaddr+from);
-	      } else {
-		ticcmd_t *newtic = (void*)(((byte*)(packet+1))+2);
-		if (packet->tic + tics < remoteticfrom[from]) break; // Won't help
-		remoteticfrom[from] = packet->tic;
-		while (tics--)
-		  netcmds[from][remoteticfrom[from]++%BACKUPTICS] =  *newtic++;
-	      }
-	    }
-	    break;
-	  case PKT_RETRANS:
-	    {
-	      int from = *(byte*)(packet+1);
-	      if (verbose>2) printf("%d requests resend from %d\n", from, packet->tic);
-	      remoteticto[from] = packet->tic;
-	    }
-	    break;
-	  case PKT_QUIT:
-	    { 
-	      int from = *(byte*)(packet+1);
-
-	      if (verbose>2) printf("%d quits at %d\n", from, packet->tic);
-	      if (playerleftgame[from] == INT_MAX) { // In the game
-		playerleftgame[from] = packet->tic;
-		if (ingame && !--curplayers) exit(0); // All players have exited
-	      }
-	    }
-	    // Fall through and broadcast it
-	  case PKT_EXTRA:
-	    BroadcastPacket(packet, len);
-	    if (packet->type == PKT_EXTRA) {
-	      if (verbose>2) printf("misc from %d\n", *(((byte*)(packet+1))+1));
-	    }
-	    break;
-	  case PKT_WAD:
-	    {
-	      int i;
-	      int from = *(byte*)(packet+1);
-	      char *name = 1 + (char*)(packet+1);
-	      size_t size = sizeof(packet_header_t);
-	      packet_header_t *reply;
-
-	      if (verbose) printf("Request for %s ", name);
-	      for (i=0; i<numwads; i++)
-		if (!strcasecmp(name, wadname[i]))
-		  break;
-
-	      if ((i==numwads) || !wadget[i]) {
-		if (verbose) printf("n/a\n");
-		*(char*)(packet+1) = 0;
-		I_SendPacketTo(packet, size+1, remoteaddr + from); 
-	      } else {
-		size += strlen(wadname[i]) + strlen(wadget[i]) + 2;
-		reply = malloc(size);
-		reply->type = PKT_WAD; reply->tic = 0;
-		strcpy((char*)(reply+1), wadname[i]);
-		strcpy((char*)(reply+1) + strlen(wadname[i]) + 1, wadget[i]);
-		printf("sending %s\n", wadget[i]);
-		I_SendPacketTo(reply, size, remoteaddr + from);
-		free(reply);
-	      }
-	    }
-	    break;
-	  default:
-	    printf("Unrecognised packet type %d\n", packet->type);
-	    break;
-	  }
-	}
-	free(packet);
-      }
+  while (1) {
+    size_t len;
+    int i;
 
-      if (ingame) { // Run some tics
-	int lowtic = INT_MAX;
-	int i;
-	for (i=0; i<MAXPLAYERS; i++) 
-	  if (playeringame(i))
-	    if (remoteticfrom[i]<lowtic)
-	      lowtic = remoteticfrom[i];
-
-	if (verbose>1) printf("%d new tics can be run\n", lowtic - exectics);
-
-	if (lowtic > exectics) 
-	  exectics = lowtic; // count exec'ed tics
-	// Now send all tics up to lowtic
-	for (i=0; i<MAXPLAYERS; i++) 
-	  if (playeringame(i)) {
-	    int tics;
-	    if (lowtic <= remoteticto[i]) continue;
-	    remoteticto[i] -= xtratics;
-	    tics = lowtic - remoteticto[i]; 
-	    {
-	      packet_header_t *packet = malloc(sizeof(packet_header_t) + 1 +
-				 tics * (1 + numplayers * (1 + sizeof(ticcmd_t))));
-	      byte *p = (void*)(packet+1);
-	      packet->type = PKT_TICS; packet->tic = remoteticto[i] - xtratics;
-	      *p++ = tics;
-	      if (verbose>1) printf("sending %d tics to %d\n", tics, i);
-	      while (tics--) {
-		int j, playersthistic = 0;
-		byte *q = p++;
-		for (j=0; j<MAXPLAYERS; j++)
-		  if ((playerjoingame[j] < remoteticto[i]) && 
-		      (playerleftgame[j] > remoteticto[i])) {
-		    *p++ = j;
-		    memcpy(p, &netcmds[j][remoteticto[i]%BACKUPTICS], sizeof(ticcmd_t));
-		    p += sizeof(ticcmd_t);
-		    playersthistic++;
-		  }
-		*q = playersthistic;
-		remoteticto[i]++;
-	      }
-	      I_SendPacketTo(packet, p - ((byte*)packet), remoteaddr+i);
-	      free(packet);
-	    }
-	  }
+    WaitForPackets();
+    while ((len = I_GetPacket(recvpacket, MAXPACKETSIZE)))
+      ProcessPacket(recvpacket, len);
+
+    for (i=0; i<maxsessions; i++) // Run some tics
+      if (sessions[i].active && sessions[i].ingame && sessions[i].newtics) {
+	sessions[i].newtics = false;
+	RunTics(&sessions[i]);
       }
-    }
   }
 }
 
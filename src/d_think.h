@@ -72,7 +72,11 @@ typedef struct thinker_s
   struct thinker_s*   prev;
   struct thinker_s*   next;
   think_t             function;
-    
+
+  /* Links in the list of thinkers of the same class, so code that only
+   * wants mobjs need not step over every door and light */
+  struct thinker_s*   cprev;
+  struct thinker_s*   cnext;
 } thinker_t;
 
 #endif
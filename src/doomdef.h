@@ -100,14 +100,15 @@ typedef enum {
 
 #define INV_ASPECT_RATIO   0.625 /* 0.75, ideally */
 
-// killough 2/8/98: MAX versions for maximum screen sizes
-// allows us to avoid the overhead of dynamic allocation
-// when multiple screen sizes are supported
+// The renderer's per column and per row buffers are allocated at startup
+// for the chosen size. The only limit is that rows and columns are kept
+// in shorts (clip arrays, openings, visplane top[] with 0xffff as empty),
+// and the size is rounded up to a multiple of 4.
 
-#ifndef HIGHRES
+#define MAX_SCREENWIDTH  32764
+#define MAX_SCREENHEIGHT 32764
 
-#define MAX_SCREENWIDTH  320
-#define MAX_SCREENHEIGHT 200
+#ifndef HIGHRES
 
 #define SCREENWIDTH      320
 #define SCREENHEIGHT     200
@@ -115,9 +116,6 @@ typedef enum {
 #else
 
 // proff 08/17/98: Changed for high-res
-#define MAX_SCREENWIDTH  1600
-#define MAX_SCREENHEIGHT 1200
-
 extern int SCREENWIDTH;
 extern int SCREENHEIGHT;
 
@@ -50,7 +50,8 @@ R_DrawColumn_Normal:
  movl dc_yh,%esi
  movl dc_yl,%edx
  incl %esi
- movl ylookup(,%edx,4),%ebx
+ movl ylookup,%ebx
+ movl (%ebx,%edx,4),%ebx
  subl %edx,%esi
  jle 9f
  addl dc_x,%ebx
@@ -205,7 +206,8 @@ R_DrawTLColumn_Normal:
  movl dc_yh,%esi
  movl dc_yl,%edx
  incl %esi
- movl ylookup(,%edx,4),%ebx
+ movl ylookup,%ebx
+ movl (%ebx,%edx,4),%ebx
  subl %edx,%esi
  jle 9f
  addl dc_x,%ebx
@@ -395,7 +397,8 @@ R_DrawColumn_HighRes:
  movl dc_yh,%esi
  movl dc_yl,%edx
  incl %esi
- movl ylookup(,%edx,4),%ebx
+ movl ylookup,%ebx
+ movl (%ebx,%edx,4),%ebx
  subl %edx,%esi
  jle 9f
  addl dc_x,%ebx
@@ -549,7 +552,8 @@ R_DrawTLColumn_HighRes:
  movl dc_yh,%esi
  movl dc_yl,%edx
  incl %esi
- movl ylookup(,%edx,4),%ebx
+ movl ylookup,%ebx
+ movl (%ebx,%edx,4),%ebx
  subl %edx,%esi
  jle 9f
  addl dc_x,%ebx
@@ -91,8 +91,9 @@ R_DrawSpan:
 
  movl ds_y,%ebx
  movl ds_x1,%edi
+ movl ylookup,%esi
+ addl (%esi,%ebx,4),%edi
  movl ds_source,%esi
- addl ylookup(,%ebx,4),%edi
 
 //
 // build composite step
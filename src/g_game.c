@@ -64,6 +64,7 @@ rcsid[] = "$Id: g_game.c,v 1.36 2000/03/17 20:50:30 cph Exp $";
 #include "d_deh.h"              // Ty 3/27/98 deh declarations
 #include "p_inter.h"
 #include "g_game.h"
+#include "m_demosync.h"
 #include "lprintf.h"
 #include "i_main.h"
 #include "i_system.h"
@@ -78,6 +79,10 @@ static byte     *demobuffer;   // made some static -- killough
 static size_t   maxdemosize;
 static byte     *demo_p;
 static short    consistancy[MAXPLAYERS][BACKUPTICS];
+static int      demostarttic;  // gametic the demo being played started at
+int             demoseektic = -1; // tic of the demo to go to, -1 if none
+
+static void G_DemoSnapshot(void);
 
 gameaction_t    gameaction;
 gamestate_t     gamestate;
@@ -184,6 +189,8 @@ int     key_weapon8;                                                //    |
 int     key_weapon9;                                                // phares
 
 int     key_screenshot;             // killough 2/22/98: screenshot key
+int     key_demo_back;
+int     key_demo_forward;
 int     mousebfire;
 int     mousebstrafe;
 int     mousebforward;
@@ -631,6 +638,15 @@ boolean G_Responder (event_t* ev)
       return true;
     }
 
+  // skip back or forward through a demo
+  if (demoplayback && ev->type == ev_keydown &&
+      (ev->data1 == key_demo_back || ev->data1 == key_demo_forward))
+    {
+      G_DemoSeek((demoseektic >= 0 ? demoseektic : gametic - demostarttic) +
+		 (ev->data1 == key_demo_back ? -DEMOSKIPTICS : DEMOSKIPTICS));
+      return true;
+    }
+
   // any other key pops up menu if in demos
   if (gameaction == ga_nothing && !singledemo &&
       (demoplayback || gamestate == GS_DEMOSCREEN))
@@ -773,6 +789,9 @@ void G_Ticker (void)
         }
     }
 
+  if (demoplayback && gamestate == GS_LEVEL)
+    G_DemoSnapshot();
+
   // get commands, check consistancy, and build new consistancy check
   buf = (gametic/ticdup)%BACKUPTICS;
 
@@ -1400,14 +1419,17 @@ static const struct {
   int version;
 } version_headers[] = {
   { boom_compatibility, "BoomVer %d", 202 },
-  { lxdoom_1_compatibility, "LxD %d", 203 },
+  { lxdoom_1_compatibility, "LxD %d", 204 },
   { boom_compatibility_compatibility, "BoomVer %d", 202 }};
 
 static const size_t num_version_headers = sizeof(version_headers) / sizeof(version_headers[0]);
 
+static void G_ArchiveGame(boolean snapshot);
+static void G_UnArchiveGame(boolean snapshot);
+
 void G_DoLoadGame(void)
 {
-  int  length, i, a, b, c;
+  int  length, i;
   // CPhipps - do savegame filename stuff here
   char name[PATH_MAX+1];     // killough 3/22/98
   int savegame_compatibility = forced_loadgame ? boom_compatibility /* Default to Boom v2.02 */
@@ -1470,6 +1492,28 @@ void G_DoLoadGame(void)
   else 
     compatibility_level = *save_p++;
 
+  G_UnArchiveGame(false);
+
+  // done
+  Z_Free (savebuffer);
+
+  if (setsizeneeded)
+    R_ExecuteSetViewSize ();
+
+  // draw the pattern into the back screen
+  R_FillBackScreen ();
+}
+
+//
+// G_UnArchiveGame
+//
+// Restores the game from save_p; the other end of G_ArchiveGame.
+//
+
+static void G_UnArchiveGame(boolean snapshot)
+{
+  int i, a, b, c;
+
   gameskill = *save_p++;
   gameepisode = *save_p++;
   gamemap = *save_p++;
@@ -1504,21 +1548,18 @@ void G_DoLoadGame(void)
   P_UnArchivePlayers ();
   P_UnArchiveWorld ();
   P_UnArchiveThinkers ();
+  if (snapshot) {
+    P_UnArchiveThingLinks ();
+    P_UnArchiveRespawnQueues ();
+  }
   P_UnArchiveSpecials ();
   P_UnArchiveRNG ();    // killough 1/18/98: load RNG information
   P_UnArchiveMap ();    // killough 1/22/98: load automap information
+  if (snapshot)
+    P_UnArchiveThinkerOrder ();
 
   if (*save_p != 0xe6)
     I_Error ("Bad savegame");
-
-  // done
-  Z_Free (savebuffer);
-
-  if (setsizeneeded)
-    R_ExecuteSetViewSize ();
-
-  // draw the pattern into the back screen
-  R_FillBackScreen ();
 }
 
 //
@@ -1619,8 +1660,6 @@ void G_DoSaveGame (void)
     save_p += strlen(save_p)+1;
   }
 
-  CheckSaveGame(GAME_OPTION_SIZE+MIN_MAXPLAYERS+10);
-
   // CPhipps - Save compatibility level
   if (compatibility_level == boom_compatibility_compatibility
       || compatibility_level == boom_compatibility)
@@ -1628,6 +1667,35 @@ void G_DoSaveGame (void)
   else
     *save_p++ = compatibility_level;
 
+  G_ArchiveGame(false);
+
+  length = save_p - savebuffer;
+
+  Z_CheckHeap();
+  doom_printf( "%s", M_WriteFile(name, savebuffer, length) 
+	       ? s_GGSAVED /* Ty - externalised */
+	       : "Game save failed!"); // CPhipps - not externalised
+
+  free(savebuffer);  // killough
+  savebuffer = save_p = NULL;
+
+  savedescription[0] = 0;
+}
+
+//
+// G_ArchiveGame
+//
+// Writes the state of the game to save_p. A demo snapshot also keeps the
+// order things are linked and thinkers run in, so playback carries on
+// from it exactly as it would have.
+//
+
+static void G_ArchiveGame(boolean snapshot)
+{
+  int i;
+
+  CheckSaveGame(GAME_OPTION_SIZE+MIN_MAXPLAYERS+10);
+
   *save_p++ = gameskill;
   *save_p++ = gameepisode;
   *save_p++ = gamemap;
@@ -1667,6 +1735,10 @@ void G_DoSaveGame (void)
   P_ArchiveWorld();
   Z_CheckHeap();
   P_ArchiveThinkers();
+  if (snapshot) {
+    P_ArchiveThingLinks();
+    P_ArchiveRespawnQueues();
+  }
 
   // phares 9/13/98: Move index->mobj_t out of P_ArchiveThinkers, simply
   // for symmetry with the P_ThinkerToIndex call above.
@@ -1678,20 +1750,10 @@ void G_DoSaveGame (void)
   P_ArchiveRNG();    // killough 1/18/98: save RNG information
   Z_CheckHeap();
   P_ArchiveMap();    // killough 1/22/98: save automap information
+  if (snapshot)
+    P_ArchiveThinkerOrder();
 
   *save_p++ = 0xe6;   // consistancy marker
-
-  length = save_p - savebuffer;
-
-  Z_CheckHeap();
-  doom_printf( "%s", M_WriteFile(name, savebuffer, length) 
-	       ? s_GGSAVED /* Ty - externalised */
-	       : "Game save failed!"); // CPhipps - not externalised
-
-  free(savebuffer);  // killough
-  savebuffer = save_p = NULL;
-
-  savedescription[0] = 0;
 }
 
 static skill_t d_skill;
@@ -2090,6 +2152,168 @@ void G_BeginRecording (void)
       *demo_p++ = playeringame[i];
   }
 }
+//
+// DEMO SNAPSHOTS
+//
+// While a demo plays, the game is saved into memory every so often, so
+// G_DemoSeek can get to any tic by loading the latest snapshot before it
+// and running the playsim on from there. When there are too many the
+// older ones are thinned out, so memory and the time to seek both stay
+// bounded, however long the demo is.
+//
+
+#define MAXDEMOSNAPSHOTS 64
+
+typedef struct {
+  int     gametic;
+  int     levelstarttic;     // m_random.c and p_enemy.c use the level time
+  boolean paused;
+  size_t  demopos;           // offset of the next ticcmd in the demo
+  byte    *data;             // from G_ArchiveGame
+} demosnapshot_t;
+
+static demosnapshot_t demosnapshots[MAXDEMOSNAPSHOTS];
+static int            numdemosnapshots;
+static int            demosnapshottics;    // tics between snapshots
+
+static void G_FreeDemoSnapshots(void)
+{
+  while (numdemosnapshots)
+    free(demosnapshots[--numdemosnapshots].data);
+  demosnapshottics = 30*TICRATE;
+}
+
+//
+// G_DemoSnapshot
+//
+// Called each tic of demo playback, before the ticcmds are read
+//
+
+static void G_DemoSnapshot(void)
+{
+  demosnapshot_t *s;
+
+  if (numdemosnapshots &&
+      gametic - demosnapshots[numdemosnapshots-1].gametic < demosnapshottics)
+    return;
+
+  if (numdemosnapshots == MAXDEMOSNAPSHOTS)
+    {
+      // Keep every other one, and take them half as often from now on
+      int i;
+
+      for (i=0; i<MAXDEMOSNAPSHOTS; i++)
+        if (i & 1)
+          free(demosnapshots[i].data);
+        else
+          demosnapshots[i/2] = demosnapshots[i];
+      numdemosnapshots /= 2;
+      demosnapshottics *= 2;
+    }
+
+  s = &demosnapshots[numdemosnapshots++];
+  s->gametic = gametic;
+  s->levelstarttic = levelstarttic;
+  s->paused = paused;
+  s->demopos = demo_p - demobuffer;
+
+  save_p = savebuffer = malloc(savegamesize);
+  G_ArchiveGame(true);
+  s->data = realloc(savebuffer, save_p - savebuffer);
+  savebuffer = save_p = NULL;
+}
+
+static void G_RestoreDemoSnapshot(const demosnapshot_t *s)
+{
+  int dp = displayplayer, am = automapmode;
+
+  save_p = s->data;
+  G_UnArchiveGame(true);
+  save_p = NULL;
+
+  // G_InitNew took this for a new game
+  demoplayback = true;
+  usergame = false;
+  gameaction = ga_nothing;
+
+  demo_p = demobuffer + s->demopos;
+  gametic = s->gametic;
+  levelstarttic = s->levelstarttic;
+  paused = s->paused;
+
+  // Keep watching the same player, with the automap as it was
+  if (playeringame[dp] && dp != displayplayer)
+    {
+      displayplayer = dp;
+      ST_Start();
+      HU_Start();
+    }
+  automapmode = (automapmode & am_active) | (am & ~am_active);
+  if ((automapmode ^ am) & am_active)
+    {
+      if (am & am_active)
+        AM_Start();
+      else
+        AM_Stop();
+    }
+
+  if (setsizeneeded)
+    R_ExecuteSetViewSize ();
+  R_FillBackScreen ();
+}
+
+//
+// G_DemoSeek
+//
+// Asks for demo playback to go to the given tic, counted from the start
+// of the demo. The seek itself is done by G_DoDemoSeek, between tics.
+//
+
+void G_DemoSeek(int tic)
+{
+  demoseektic = tic < 0 ? 0 : tic;
+}
+
+//
+// G_DoDemoSeek
+//
+// Goes back to the latest snapshot before the tic if that's nearer, then
+// runs the playsim up to the tic without drawing or sound.
+//
+
+extern boolean nosfxparm;
+
+void G_DoDemoSeek(void)
+{
+  int     tic = demostarttic + demoseektic, i;
+  boolean nosfx = nosfxparm;
+
+  demoseektic = -1;
+  if (!demoplayback)
+    return;
+
+  for (i = numdemosnapshots; i--; )
+    if (demosnapshots[i].gametic <= tic)
+      {
+        if (tic < gametic || demosnapshots[i].gametic > gametic)
+          G_RestoreDemoSnapshot(&demosnapshots[i]);
+        break;
+      }
+
+  S_Start();    // stop sounds from before, whose origins may be freed
+  nosfxparm = true;
+  while (gametic < tic && demoplayback)
+    {
+      G_Ticker ();
+      gametic++;
+    }
+  nosfxparm = nosfx;
+
+  // Carry on from here, without a screen wipe or tics to catch up on
+  maketic = gametic;
+  wipegamestate = gamestate;
+}
+
 //
 // G_PlayDemo
 //
@@ -2113,6 +2337,7 @@ void G_DoPlayDemo (void)
 
   ExtractFileBase(defdemoname,basename);           // killough
   gameaction = ga_nothing;
+  G_FreeDemoSnapshots();
   demobuffer = demo_p = W_CacheLumpNum(demolumpnum = W_GetNumForName(basename));  
   // cph - store lump number for unlocking later
 
@@ -2203,6 +2428,7 @@ void G_DoPlayDemo (void)
   usergame = false;
 
   demoplayback = true;
+  demostarttic = gametic;
 
   for (i=0; i<MAXPLAYERS;i++)         // killough 4/24/98
     players[i].cheats = 0;
@@ -2255,6 +2481,7 @@ boolean G_CheckDemoStatus (void)
 
   if (demoplayback)
     {
+      M_DemoSyncDone();      // reports and exits, for -syncdemos
       if (singledemo)
         exit(0);  // killough
 
@@ -2263,6 +2490,7 @@ boolean G_CheckDemoStatus (void)
 	W_UnlockLumpNum(demolumpnum);
 	demolumpnum = -1;
       }
+      G_FreeDemoSnapshots();
       G_ReloadDefaults();    // killough 3/1/98
       netgame = false;       // killough 3/29/98
       deathmatch = false;
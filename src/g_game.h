@@ -84,6 +84,13 @@ void G_DoVictory(void);
 void G_BuildTiccmd (ticcmd_t* cmd); // CPhipps - move decl to header
 void G_ChangedPlayerColour(int pn, int cl); // CPhipps - On-the-fly player colour changing
 
+// Seeking in demo playback; G_DemoSeek takes a tic counted from the start
+// of the demo, and D_DoomLoop calls G_DoDemoSeek while demoseektic >= 0
+#define DEMOSKIPTICS (10*TICRATE)    // for key_demo_back/forward
+extern int demoseektic;
+void G_DemoSeek(int tic);
+void G_DoDemoSeek(void);
+
 // killough 1/18/98: Doom-style printf;   killough 4/25/98: add gcc attributes
 // CPhipps - renames to doom_printf to avoid name collision with glibc
 void doom_printf(const char *, ...) __attribute__((format(printf,1,2)));
@@ -159,6 +166,8 @@ extern int  key_map_grid;                                           // phares
 extern int  key_map_rotate; // cph - map rotation
 extern int  key_map_overlay;// cph - map overlay
 extern int  key_screenshot;    // killough 2/22/98 -- add key for screenshot
+extern int  key_demo_back;     // skip back and forward in demo playback
+extern int  key_demo_forward;
 extern int  autorun;           // always running?                   // phares
 
 extern int  defaultskill;      //jff 3/24/98 default skill
@@ -34,9 +34,11 @@ void I_SendPacket(packet_header_t* packet, size_t len);
 void I_SendPacketTo(packet_header_t* packet, size_t len, struct sockaddr_in* to);
 void I_InitSockets(int localport);
 extern struct sockaddr_in sentfrom;
+extern int recvsocket;
 #endif
 
 extern size_t sentbytes, recvdbytes;
+extern unsigned short netsession;
 
 /*
  * $Log: i_network.h,v $
@@ -32,12 +32,16 @@
 #ifndef __I_SYSTEM__
 #define __I_SYSTEM__
 
+#include "doomtype.h"
+
 #ifdef __GNUG__
 #pragma interface
 #endif
 
 int I_GetTime_RealTime(void);     /* killough */
 
+int_64_t I_GetTime_uSecs(void);   /* microsecond clock for profiling */
+
 unsigned long I_GetRandomTimeSeed(void); /* cphipps */
 
 void I_uSleep(unsigned long usecs);
@@ -58,6 +58,9 @@ rcsid[] = "$Id: l_sound.c,v 1.39 2000/03/19 20:14:32 cph Exp $";
 #include "d_main.h"
 
 #include "sounds.h"
+#include "s_sound.h"
+#include "l_soundgen.h"
+#include "m_viddump.h"
 
 #include "lprintf.h"
 
@@ -76,6 +79,9 @@ int detect_voices = 0; // God knows
 // Separate sound server process.
 static FILE*	sndserver=0;
 
+// Or mixing in this process, for -wavdump
+static boolean  localsound;
+
 //
 // MUSIC API.
 //
@@ -302,7 +308,10 @@ int I_StartSound(int id, int vol, int sep, int pitch, int priority)
   priority = 0; 
   vol<<=2;
   
-  if (sndserver) {
+  if (localsound) {
+    if (lengths[id]) // Missing sounds have no data at all
+      I_AddSfx(id, vol, pitch, sep);
+  } else if (sndserver) {
     fprintf(sndserver, "p%2.2x%2.2x%2.2x%2.2x\n", id, pitch, vol, sep);
     fflush(sndserver);
     PIPE_CHECK(sndserver);
@@ -347,14 +356,50 @@ void I_ShutdownSound(void)
   return;
 }
 
+//
+// I_InitLocalSound
+//
+// Loads the sounds into l_soundgen.c, as the sound server would, for
+// M_VidDumpFrame to mix
+//
+static void I_InitLocalSound(void)
+{
+  int i;
+
+  I_InitSoundGenMemory(numChannels);
+  for (i=0; i<NUMSFX; i++) {
+    int lump;
+
+    if (S_sfx[i].link) {
+      int link = S_sfx[i].link - S_sfx;
+
+      S_sfx[i].data = S_sfx[link].data;
+      lengths[i] = lengths[link];
+    } else if ((lump = I_GetSfxLumpNum(&S_sfx[i])) != -1) {
+      lengths[i] = W_LumpLength(lump);
+      S_sfx[i].data = (void*)I_PadSfx(W_CacheLumpNum(lump), &lengths[i]);
+      W_UnlockLumpNum(lump);
+    }
+  }
+  localsound = true;
+  lprintf(LO_INFO, "I_InitSound: mixing sound effects for -wavdump\n");
+}
+
 void I_InitSound(void)
 { 
+  // No server or music when dumping video, it would not keep time
+  if (viddump_active) {
+    if (viddump_sound)
+      I_InitLocalSound();
+    return;
+  }
+
   // start sound process
   if ( !access(sndserver_filename, X_OK) ) {
     char buf[1024];
 
-    snprintf(buf, sizeof(buf), "%s %s %s", sndserver_filename, snd_device,
-	    devparm ? "-devparm" : "");
+    snprintf(buf, sizeof(buf), "%s %s %s -channels %d", sndserver_filename,
+	    snd_device, devparm ? "-devparm" : "", numChannels);
     sndserver = popen(buf, "w");
     atexit(I_ShutdownSound);
 
@@ -41,6 +41,10 @@ rcsid[] = "$Id: l_soundgen.c,v 1.19 1999/10/12 13:01:11 cphipps Exp $";
 #include <math.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
 
@@ -51,7 +55,11 @@ rcsid[] = "$Id: l_soundgen.c,v 1.19 1999/10/12 13:01:11 cphipps Exp $";
 #elif defined(HAVE_MACHINE_SOUNDCARD_H)
 #include <machine/soundcard.h>
 #else
-#error No sound card header?
+// No OSS, so sound can only be mixed into memory for I_MixSound
+#define NO_SOUND_DEVICE
+#define AFMT_U8     0x00000008
+#define AFMT_S16_LE 0x00000010
+#define AFMT_S16_BE 0x00000020
 #endif
 
 #else
@@ -80,18 +88,17 @@ rcsid[] = "$Id: l_soundgen.c,v 1.19 1999/10/12 13:01:11 cphipps Exp $";
 #include "sounds.h"
 #include "m_swap.h"
 
-// The number of internal mixing channels,
+// The default number of internal mixing channels,
 //  the samples calculated for each mixing step,
 //  the size of the 16bit, 2 hardware channel (stereo)
 //  mixing buffer, and the samplerate of the raw data.
 
 // Needed for calling the actual sound output.
-#define SAMPLECOUNT		512
+// SAMPLECOUNT and SAMPLERATE are in l_soundgen.h
 #define NUM_CHANNELS		8
 // It is 2 for 16bit, and 2 for two channels.
 #define BUFMUL                  4
 
-#define SAMPLERATE		11025	// Hz
 #define SAMPLESIZE		2   	// 16bit
 
 // Format that corresponds to unsigned bytes, Doom's own internal format
@@ -134,10 +141,14 @@ static int      startnum = 0;
 // Pitch to stepping lookup, unused.
 static int*	steptable;
 
-// Volume lookups.
-static signed short *	sw_vol_lookup;
+// Volume lookup, for 8 bit output only.
 static unsigned char *	ub_vol_lookup;
 
+// 32 bit mixing buffer for 16 bit output, so loud mixes are clamped
+// rather than wrapping round, and one channel's resampled data.
+static int *		mix32;
+static signed short *	chanbuf;
+
 typedef struct {
   // The channel data pointers, start and end.
   const unsigned char* data;
@@ -165,14 +176,16 @@ typedef struct {
   // Used to catch duplicates (like chainsaw).
   int sfxid;			
 
-  // Hardware left and right channel volume lookup.
+  // Hardware left and right channel volumes, for 16 bit output...
+  int leftvol, rightvol;
+  // ... or the volume lookup, for 8 bit.
   const unsigned char* vol_lookup;
-  const signed short* leftvol_lookup;
-  const signed short* rightvol_lookup;
 } channel_t;
 
 static channel_t* channel;
+static int numchannels;
 
+#ifndef NO_SOUND_DEVICE
 //
 // Safe ioctl, convenience.
 //
@@ -188,6 +201,7 @@ static void I_Ioctl( int fd, int command, int*	arg )
     exit(-1);
   }
 }
+#endif
 
 //
 // This function adds a sound to the
@@ -211,7 +225,7 @@ int I_AddSfx(int sfxid, int volume, int pitch, int seperation )
   signed int	rightvol;
   signed int	leftvol;
   
-  if (audio_fd < 0) return 0;
+  if (!channel) return 0;
   
   // Chainsaw troubles.
   // Play these sound effects only one at a time.
@@ -223,7 +237,7 @@ int I_AddSfx(int sfxid, int volume, int pitch, int seperation )
        || sfxid == sfx_pistol	 )
     {
       // Loop all channels, check.
-      for (i=0 ; i<NUM_CHANNELS ; i++) {
+      for (i=0 ; i<numchannels ; i++) {
 	// Active, and using the same SFX?
 	if ( (channel[i].data) && (channel[i].sfxid == sfxid) ) {
 	  // Reset.
@@ -236,7 +250,7 @@ int I_AddSfx(int sfxid, int volume, int pitch, int seperation )
     }
   
   // Loop all channels to find oldest SFX.
-  for (i=0; (i<NUM_CHANNELS) && (channel[i].data); i++) {
+  for (i=0; (i<numchannels) && (channel[i].data); i++) {
     if (channel[i].starttime < oldest) {
       oldestnum = i;
       oldest = channel[i].starttime;
@@ -247,7 +261,7 @@ int I_AddSfx(int sfxid, int volume, int pitch, int seperation )
   // If we found a channel, fine.
   // If not, we simply overwrite the first one, 0.
   // Probably only happens at startup.
-  if (i == NUM_CHANNELS)
+  if (i == numchannels)
     slot = oldestnum;
   else
     slot = i;
@@ -299,8 +313,8 @@ int I_AddSfx(int sfxid, int volume, int pitch, int seperation )
       leftvol = (leftvol < 0) ? 0 : VOL_MAX-1;
     }
     
-    channel[slot].leftvol_lookup = &sw_vol_lookup[leftvol*256];
-    channel[slot].rightvol_lookup = &sw_vol_lookup[rightvol*256];
+    channel[slot].leftvol = leftvol;
+    channel[slot].rightvol = rightvol;
   } else {
     if (volume < 0 || volume >= VOL_MAX) {
       volume = 0;
@@ -323,7 +337,7 @@ const void* I_PadSfx(const void* data, int* size)
   unsigned char* paddedsfx;
   int paddedsize, i;
 
-  if (audio_fd < 0) return NULL;
+  if (!channel) return NULL;
 
   // Pads the sound effect out to the mixing buffer size.
   // The original realloc would interfere with zone memory.
@@ -357,58 +371,123 @@ const void* I_PadSfx(const void* data, int* size)
 // CPhipps - rewritten. This code doesn't assemble individual samples one-by-one// but instead does a pass of the mixing buffer for each playing sample. This 
 // gives a performance saving when fewer sounds are playing. Saves the CPU
 // having to query every channel structure for every sound sample.
+//
+// For 16 bit output each channel is first resampled into chanbuf, then
+// scaled and added into the 32 bit mix32, which is clamped into the
+// mixbuffer at the end. The scaling and clamping are done 8 samples at
+// a time with SSE2 where the compiler supports it.
+
+// Resamples up to n samples from the channel into chanbuf,
+// centred on 0, returning how many there were
+static int I_ResampleChannel(channel_t* pchan, int n)
+{
+  register const unsigned char* data = pchan->data;
+  register signed short* pbuf = chanbuf;
+
+  if (pchan->step == 1<<16) {
+    // Unpitched, so no stepping
+    if (n > pchan->end - data)
+      n = pchan->end - data;
+    pchan->data += n;
+    do {
+      *pbuf++ = *data++ - BYTE_SAMP_ZERO;
+    } while (pbuf < chanbuf + n);
+  } else {
+    register unsigned int pos = pchan->stepremainder;
+    register const unsigned int step = pchan->step;
 
-void I_UpdateSound(void)
+    do {
+      *pbuf++ = data[pos >> 16] - BYTE_SAMP_ZERO;
+      pos += step;
+    } while (--n && (data + (pos >> 16) < pchan->end));
+
+    pchan->data += pos >> 16;
+    pchan->stepremainder = pos & ((1 << 16) - 1);
+    n = pbuf - chanbuf;
+  }
+  return n;
+}
+
+// Adds n samples from chanbuf into mix32, at the channel's volumes
+static void I_MixChannel(const channel_t* pchan, int n)
+{
+  register const signed short* pbuf = chanbuf;
+  register int* pmix = mix32;
+  register const int leftvol = pchan->leftvol, rightvol = pchan->rightvol;
+
+#ifdef __SSE2__
+  // Samples are at most 128*VOL_MAX, so the products fit in 16 bits
+  const __m128i vol = _mm_set_epi16(rightvol, leftvol, rightvol, leftvol,
+				    rightvol, leftvol, rightvol, leftvol);
+
+  for (; n >= 8; n -= 8, pbuf += 8, pmix += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)pbuf);
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi16(s, s), vol);
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi16(s, s), vol);
+
+    // Sign extend to 32 bits and accumulate
+    _mm_storeu_si128((__m128i*)pmix, 
+      _mm_add_epi32(_mm_loadu_si128((const __m128i*)pmix),
+		    _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16)));
+    _mm_storeu_si128((__m128i*)(pmix+4), 
+      _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pmix+4)),
+		    _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16)));
+    _mm_storeu_si128((__m128i*)(pmix+8), 
+      _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pmix+8)),
+		    _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16)));
+    _mm_storeu_si128((__m128i*)(pmix+12), 
+      _mm_add_epi32(_mm_loadu_si128((const __m128i*)(pmix+12)),
+		    _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)));
+  }
+#endif
+  for (; n; n--, pmix += 2) {
+    register int sample = *pbuf++;
+
+    pmix[0] += sample * leftvol;
+    pmix[1] += sample * rightvol;
+  }
+}
+
+// Clamps n samples of mix32 into the 16 bit mixbuffer
+static void I_ClampMix(int n)
+{
+  register const int* pmix = mix32;
+  register signed short* pbuf = (signed short*)mixbuffer;
+
+  n *= 2;
+
+#ifdef __SSE2__
+  for (; n >= 8; n -= 8, pmix += 8, pbuf += 8)
+    _mm_storeu_si128((__m128i*)pbuf,
+      _mm_packs_epi32(_mm_loadu_si128((const __m128i*)pmix),
+		      _mm_loadu_si128((const __m128i*)(pmix+4))));
+#endif
+  for (; n; n--) {
+    register int sample = *pmix++;
+
+    *pbuf++ = sample > SHRT_MAX ? SHRT_MAX : sample < SHRT_MIN ? SHRT_MIN :
+      sample;
+  }
+}
+
+// Mixes the next count samples of all playing channels into mixbuffer
+static void I_MixSamples(int count)
 {
   int chan;
   int active_chans = 0;
 
-  if (audio_fd <=0) return;
-
-  for (chan=0; chan<NUM_CHANNELS; chan++)
+  for (chan=0; chan<numchannels; chan++)
     if (channel[chan].data != NULL) {
 
       switch(out_format) {
       case SIGNED_WORDS:
 	{
 	  register channel_t* pchan = &channel[chan];
-	  register signed short* pbuf = (signed short*)mixbuffer;
-	  
-	  int n = SAMPLECOUNT;
 	  
-	  if (!active_chans++) {
-	    // First channel to output
-	    do {
-	      { // Output sample
-		register int sample = pchan->data[0];
-		
-		pbuf[0] = pchan->leftvol_lookup[sample];
-		pbuf[1] = pchan->rightvol_lookup[sample];
-		pbuf+=2;
-	      }
-	      {// Move data pointer
-		register unsigned int pos = pchan->stepremainder + pchan->step;
-		
-		pchan->data += pos >> 16;
-		pchan->stepremainder = pos & ((1 << 16) - 1); 
-	      }
-	    } while (--n && (pchan->data < pchan->end));
-	  } else
-	    do {
-	      { // Output sample
-		register int sample = pchan->data[0];
-		
-		pbuf[0] += pchan->leftvol_lookup[sample];
-		pbuf[1] += pchan->rightvol_lookup[sample];
-		pbuf+=2;
-	      }
-	      {// Move data pointer
-		register unsigned int pos = pchan->stepremainder + pchan->step;
-		
-		pchan->data += pos >> 16;
-		pchan->stepremainder = pos & ((1 << 16) - 1); 
-	      }
-	    } while (--n && (pchan->data < pchan->end));
+	  if (!active_chans++)
+	    memset(mix32, 0, count*2*sizeof(*mix32));
+
+	  I_MixChannel(pchan, I_ResampleChannel(pchan, count));
 	  
 	  if (pchan->data >= pchan->end) {
 	    // End sound effect
@@ -422,12 +501,12 @@ void I_UpdateSound(void)
 	  register unsigned char* pbuf = (unsigned char*)mixbuffer;
 	  register const unsigned char* const vol_lookup = pchan->vol_lookup;
 	  
-	  int n = SAMPLECOUNT;
+	  int n = count;
 	  
 	  if (!active_chans++) {
 	    // First channel to output
 	    // Output sample
-	    register size_t bytes = SAMPLECOUNT;
+	    register size_t bytes = count;
 	    
 	    if (pchan->data + bytes > pchan->end)
 	      bytes = pchan->end - pchan->data;
@@ -454,8 +533,24 @@ void I_UpdateSound(void)
     // Write 0's so soundcard doesn't stutter
     memset(mixbuffer, 
 	   (out_format == SIGNED_WORDS) ? 0 : BYTE_SAMP_ZERO, 
-	   MIXBUFFERSIZE);
-  }
+	   MIXBUFFERSIZE / SAMPLECOUNT * count);
+  } else if (out_format == SIGNED_WORDS)
+    I_ClampMix(count);
+}
+
+void I_UpdateSound(void)
+{
+  if (audio_fd <=0) return;
+
+  I_MixSamples(SAMPLECOUNT);
+}
+
+const signed short* I_MixSound(int samples)
+{
+  if (!channel) return NULL;
+
+  I_MixSamples(samples);
+  return mixbuffer;
 }
 
 // 
@@ -475,22 +570,71 @@ void I_SubmitSound(void)
 
 void I_EndSoundGen(void)
 {
-  if (audio_fd < 0) return; // Never init'ed or already cleaned
+  if (!channel) return; // Never init'ed or already cleaned
 
   free(mixbuffer);
   free(lengths);
-  free(channel);
+  free(channel); channel = NULL;
   free(steptable);
-  free((out_format == SIGNED_WORDS) ? (void*)sw_vol_lookup : (void*)ub_vol_lookup);
+  free(mix32);
+  free(chanbuf);
+  free(ub_vol_lookup);
+
+  if (audio_fd >= 0) {
+    close(audio_fd); audio_fd = -1;
+  }
+}
+
+static void I_InitMixer(int channels)
+{
+  // Initialize external data (all sounds) at start, keep static.
+  // CPhipps - dynamically allocate all data structures, to save memory
+  // for non-sound users.
+  mixbuffer   = calloc(MIXBUFFERSIZE, 1);
+  lengths     = calloc(NUMSFX, sizeof(*lengths));
+  steptable   = calloc(256, sizeof(*steptable));
 
-  close(audio_fd); audio_fd = -1;
+  if (out_format == SIGNED_WORDS) {
+    mix32 = calloc(SAMPLECOUNT*2, sizeof(*mix32));
+    chanbuf = calloc(SAMPLECOUNT, sizeof(*chanbuf));
+  } else 
+    ub_vol_lookup = calloc(VOL_MAX*256, sizeof(*ub_vol_lookup));
+
+  // As many channels as the game has, so none get dropped here
+  numchannels = (channels > 0) ? channels : NUM_CHANNELS;
+  channel     = calloc(numchannels, sizeof(*channel));
+
+  // CPhipps - used to be in I_SetChannels, but might as well do it now
+  {
+    // Init internal lookups (raw data, mixing buffer, channels).
+    // This function sets up internal lookups used during
+    //  the mixing process. 
+    register signed int i, j;
+    
+    // CPhipps - remove non-portable addressing before start of array
+    // This table provides step widths for pitch parameters.
+    for (i=-128 ; i<128 ; i++)
+      steptable[128+i] = // CPhipps - replace pow call, to save -lm
+	(unsigned int)(1<<16) + (i << ((i>0) ? 9 : 8));
+   
+    // CPhipps - replace /127 by >>7 for speed
+    // Generates volume lookup tables, 16 bit output just multiplies
+    if (out_format == UNSIGNED_BYTES)
+      for (i=0 ; i<VOL_MAX ; i++)
+	for (j=0 ; j<256 ; j++)
+	  ub_vol_lookup[i*256+j] = 
+	    BYTE_SAMP_ZERO + (((signed int)i*(j-BYTE_SAMP_ZERO)) >> 6);
+  }
 }
 
-void I_InitSoundGen(const char* snd_dev)
+void I_InitSoundGen(const char* snd_dev, int channels)
 {
   // Secure and configure sound device first.
   fprintf( stderr, "I_InitSoundGen: ");
   
+#ifdef NO_SOUND_DEVICE
+  fprintf(stderr, "no sound device support\n");
+#else
   audio_fd = open(snd_dev, O_WRONLY);
   if (audio_fd<0) {
     fprintf(stderr, "Could not open %s\n", snd_dev);
@@ -531,49 +675,15 @@ void I_InitSoundGen(const char* snd_dev)
 
     MIXBUFFERSIZE= (out_format==SIGNED_WORDS) ? SAMPLECOUNT*BUFMUL : SAMPLECOUNT;
   }
-    
-  // Initialize external data (all sounds) at start, keep static.
-  // CPhipps - dynamically allocate all data structures, to save memory
-  // for non-sound users.
-  mixbuffer   = calloc(MIXBUFFERSIZE, 1);
-  lengths     = calloc(NUMSFX, sizeof(*lengths));
-  steptable   = calloc(256, sizeof(*steptable));
-
-  if (out_format == SIGNED_WORDS) 
-    sw_vol_lookup = calloc(VOL_MAX*256, sizeof(*sw_vol_lookup));
-  else 
-    ub_vol_lookup = calloc(VOL_MAX*256, sizeof(*ub_vol_lookup));
-
-  channel     = calloc(NUM_CHANNELS, sizeof(*channel));
+  I_InitMixer(channels);
+#endif
+}
 
-  // CPhipps - used to be in I_SetChannels, but might as well do it now
-  {
-    // Init internal lookups (raw data, mixing buffer, channels).
-    // This function sets up internal lookups used during
-    //  the mixing process. 
-    register signed int i, j;
-    
-    // CPhipps - remove non-portable addressing before start of array
-    // This table provides step widths for pitch parameters.
-    for (i=-128 ; i<128 ; i++)
-      steptable[128+i] = // CPhipps - replace pow call, to save -lm
-	(unsigned int)(1<<16) + (i << ((i>0) ? 9 : 8));
-   
-    // CPhipps - replace /127 by >>7 for speed
-    // Generates volume lookup tables
-    if (out_format == SIGNED_WORDS) {
-      //  Also turn the unsigned char samples
-      //  into signed word samples.
-      for (i=0 ; i<VOL_MAX ; i++)
-	for (j=0 ; j<256 ; j++)
-	  sw_vol_lookup[i*256+j] = i*(j-BYTE_SAMP_ZERO);
-    } else {
-      for (i=0 ; i<VOL_MAX ; i++)
-	for (j=0 ; j<256 ; j++)
-	  ub_vol_lookup[i*256+j] = 
-	    BYTE_SAMP_ZERO + (((signed int)i*(j-BYTE_SAMP_ZERO)) >> 6);
-    }
-  }
+void I_InitSoundGenMemory(int channels)
+{
+  out_format = SIGNED_WORDS;
+  MIXBUFFERSIZE = SAMPLECOUNT*BUFMUL;
+  I_InitMixer(channels);
 }
 
 /*
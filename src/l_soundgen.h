@@ -28,12 +28,24 @@
  *-----------------------------------------------------------------------------
  */
 
+/* Output is at SAMPLERATE, mixed SAMPLECOUNT samples at a time */
+#define SAMPLECOUNT		512
+#define SAMPLERATE		11025	/* Hz */
+
 /* ... update sound buffer and audio device at runtime... */
 void I_UpdateSound(void);
 
+/* Mixes the next samples (at most SAMPLECOUNT) of the playing sounds,
+ * returning them as 16 bit stereo, for callers with no sound device */
+const signed short* I_MixSound(int samples);
+
 void I_SubmitSound(void);
 
-void I_InitSoundGen(const char* snd_dev);
+/* channels is the number of sounds to mix at once, or 0 for the default */
+void I_InitSoundGen(const char* snd_dev, int channels);
+
+/* Sets up for mixing with I_MixSound only, without a device */
+void I_InitSoundGenMemory(int channels);
 
 void I_EndSoundGen(void);
 
@@ -135,7 +135,16 @@ int main(int argc, const char** argv)
       if (!stricmp(argv[3], "-devparm"))
 	snd_verbose = 1;
 
-    I_InitSoundGen((argv[1] != NULL) ? argv[1] : "/dev/dsp");
+    {
+      // Mix as many channels as the game is using, if it told us
+      int i, channels = 0;
+
+      for (i=2; i<argc-1; i++)
+	if (!stricmp(argv[i], "-channels"))
+	  channels = atoi(argv[i+1]);
+
+      I_InitSoundGen((argv[1] != NULL) ? argv[1] : "/dev/dsp", channels);
+    }
 
     usleep(200000);
     // get sound data
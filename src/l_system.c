@@ -87,6 +87,24 @@ int I_GetTime_RealTime (void)
   return (lasttimereply = thistimereply);
 }
 
+/*
+ * I_GetTime_uSecs
+ *
+ * High resolution clock for timing and profiling code, in microseconds
+ * since the first call. Not for game timing, use I_GetTime for that.
+ */
+int_64_t I_GetTime_uSecs(void)
+{
+  static int_64_t basetime_us;
+  struct timeval tv;
+  int_64_t now;
+
+  gettimeofday(&tv, NULL);
+  now = (int_64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  if (!basetime_us) basetime_us = now;
+  return now - basetime_us;
+}
+
 /*
  * I_GetRandomTimeSeed
  *
@@ -64,6 +64,7 @@
 int sendsocket, recvsocket;
 struct sockaddr_in sendtoaddr;
 size_t sentbytes, recvdbytes;
+unsigned short netsession; // Which game on the server we are in
 
 //
 // UDPsocket
@@ -146,6 +147,7 @@ size_t I_GetPacket(packet_header_t* buffer, size_t buflen)
 
 void I_SendPacket(packet_header_t* packet, size_t len)
 {
+  packet->session = doom_htons(netsession);
   packet->checksum = ChecksumPacket(packet, len);
   if (sendto(sendsocket, packet, len, 0, (struct sockaddr *)&sendtoaddr, 
 	     sizeof sendtoaddr) < 0)
@@ -181,7 +183,7 @@ void I_InitSockets(int localport)
 boolean I_InitNetwork(void)
 {
   int p, localport = 5029;
-  struct { packet_header_t head; short port; char myaddr[200]; } initpacket;
+  struct { packet_header_t head; struct init_packet_s info; } initpacket;
 
   // Get local & remote network addresses
   if (!(p=M_CheckParm("-net"))) return false;
@@ -190,12 +192,16 @@ boolean I_InitNetwork(void)
     I_Error("I_InitNetwork: Unable to locate server.\n");
   if ((p=M_CheckParm("-port")) && (++p<myargc)) 
     localport = atoi(myargv[p]);
-  if (gethostname(initpacket.myaddr, 200)<0) 
-    strcpy(initpacket.myaddr, "too.long");
+  if ((p=M_CheckParm("-session")) && (++p<myargc)) 
+    netsession = atoi(myargv[p]); // else the server picks one
+  if (gethostname(initpacket.info.myaddr, 200)<0) 
+    strcpy(initpacket.info.myaddr, "too.long");
 
   I_InitSockets(localport);
   // Send init packet
-  initpacket.port = htons(localport);
+  initpacket.info.port = htons(localport);
+  initpacket.info.ticencodings = (1<<TICENC_RAW) | (1<<TICENC_DELTA);
+  initpacket.info.version = PROTOCOL_VERSION;
   initpacket.head.type = PKT_INIT; initpacket.head.tic = 0;
   I_SendPacket(&initpacket.head, sizeof(initpacket));
   return 1;
@@ -0,0 +1,247 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *  Headless "display" for benchmarking. Everything is rendered into
+ *  screens[0] as normal, but nothing is ever shown. Instead the time
+ *  between each I_FinishUpdate is recorded, and a summary is printed
+ *  on exit, so -timedemo runs can be compared on machines with no display.
+ *
+ *  Output is one key=value pair per line on stdout. With -benchlog <file>
+ *  the individual frame times are also written to <file>, one
+ *  "frame,gametic,usecs" line per frame.
+ *-----------------------------------------------------------------------------*/
+
+#ifndef lint
+static const char
+rcsid[] = "$Id$";
+#endif /* lint */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../config.h"
+#include "z_zone.h"
+#include "i_video.h"
+#include "i_system.h"
+#include "doomtype.h"
+#include "doomdef.h"
+#include "doomstat.h"
+#include "v_video.h"
+#include "r_draw.h"
+#include "r_main.h"
+#include "p_map.h"
+#include "m_argv.h"
+#include "lprintf.h"
+
+int leds_always_off; // Nothing to turn on
+int use_vsync;       // Nothing to sync to
+
+#ifdef I386
+void (*R_DrawColumn)(void);
+void (*R_DrawTLColumn)(void);
+#endif
+
+static boolean initialised = false;
+
+/* Frame timing records. Grown in chunks as the demo goes on, like the
+ * demo recording buffer. */
+typedef struct {
+  int      gametic;
+  unsigned usecs;
+  int      visplanes, planesplits, planeprobes;
+} frametime_t;
+
+static frametime_t *frametimes;
+static size_t       numframes, maxframes;
+static int_64_t     lastframe_us, firstframe_us;
+static int          firstframe_tic;
+static boolean      timing;
+
+void I_StartTic(void)
+{
+}
+
+void I_StartFrame (void)
+{
+}
+
+void I_UpdateNoBlit (void)
+{
+}
+
+//
+// I_FinishUpdate
+//
+// The frame is complete; record how long it took since the last one
+//
+void I_FinishUpdate(void)
+{
+  int_64_t now;
+
+  if (!initialised) return;
+
+  now = I_GetTime_uSecs();
+  if (!timing) {
+    // Nothing to measure against yet
+    firstframe_us = lastframe_us = now;
+    firstframe_tic = gametic;
+    timing = true;
+    return;
+  }
+
+  if (numframes == maxframes)
+    frametimes = realloc(frametimes,
+			 (maxframes += 4096) * sizeof(*frametimes));
+
+  frametimes[numframes].gametic = gametic;
+  frametimes[numframes].usecs = (unsigned)(now - lastframe_us);
+  frametimes[numframes].visplanes = rendered_visplanes;
+  frametimes[numframes].planesplits = rendered_planesplits;
+  frametimes[numframes].planeprobes = rendered_planeprobes;
+  numframes++;
+  lastframe_us = now;
+}
+
+void I_ReadScreen (byte* scr)
+{
+  memcpy(scr, screens[0], SCREENWIDTH*SCREENHEIGHT);
+}
+
+void I_SetPalette (int pal)
+{
+}
+
+static int I_CompareFrameTimes(const void* a, const void* b)
+{
+  unsigned ua = *(const unsigned*)a, ub = *(const unsigned*)b;
+
+  return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+//
+// I_ShutdownGraphics
+//
+// Reports the collected frame timings
+//
+void I_ShutdownGraphics(void)
+{
+  unsigned* sorted;
+  int       p, maxvisplanes = 0;
+  size_t    i;
+  double    elapsed, splits = 0, probes = 0;
+
+  if (!initialised || !numframes) return;
+  initialised = false;
+
+  if ((p = M_CheckParm("-benchlog")) && ++p < myargc) {
+    FILE* f = fopen(myargv[p], "w");
+
+    if (!f)
+      lprintf(LO_WARN, "I_ShutdownGraphics: failed to open %s\n", myargv[p]);
+    else {
+      fprintf(f, "frame,gametic,usecs,visplanes,plane_splits,plane_probes\n");
+      for (i=0; i<numframes; i++)
+	fprintf(f, "%u,%d,%u,%d,%d,%d\n", (unsigned)i, frametimes[i].gametic,
+		frametimes[i].usecs, frametimes[i].visplanes,
+		frametimes[i].planesplits, frametimes[i].planeprobes);
+      fclose(f);
+    }
+  }
+
+  sorted = malloc(numframes * sizeof(*sorted));
+  for (i=0; i<numframes; i++) {
+    sorted[i] = frametimes[i].usecs;
+    if (frametimes[i].visplanes > maxvisplanes)
+      maxvisplanes = frametimes[i].visplanes;
+    splits += frametimes[i].planesplits;
+    probes += frametimes[i].planeprobes;
+  }
+  qsort(sorted, numframes, sizeof(*sorted), I_CompareFrameTimes);
+
+  elapsed = (lastframe_us - firstframe_us) / 1000000.0;
+
+  printf("frames=%u\n", (unsigned)numframes);
+  printf("gametics=%d\n", frametimes[numframes-1].gametic - firstframe_tic);
+  printf("seconds=%.3f\n", elapsed);
+  printf("frametime_min_usecs=%u\n", sorted[0]);
+  printf("frametime_median_usecs=%u\n", sorted[numframes/2]);
+  printf("frametime_p99_usecs=%u\n", sorted[(numframes*99)/100]);
+  printf("frametime_max_usecs=%u\n", sorted[numframes-1]);
+  printf("gametics_per_sec=%.2f\n", elapsed > 0 ?
+	 (frametimes[numframes-1].gametic - firstframe_tic) / elapsed : 0);
+  printf("sight_checks=%u\n", sight_checks);
+  printf("sight_cache_hits=%u\n", sight_cachehits);
+  printf("visplanes_max=%d\n", maxvisplanes);
+  printf("plane_splits_per_frame=%.2f\n", splits / numframes);
+  printf("plane_probes_per_frame=%.2f\n", probes / numframes);
+  fflush(stdout);
+
+  free(sorted);
+  free(frametimes);
+  frametimes = NULL;
+  numframes = maxframes = 0;
+}
+
+void I_PreInitGraphics(void)
+{
+#ifdef HIGHRES
+  SCREENWIDTH = 320; SCREENHEIGHT = 200;
+#endif
+#ifdef I386
+  R_DrawColumn = R_DrawColumn_Normal;
+  R_DrawTLColumn = R_DrawTLColumn_Normal;
+#endif
+}
+
+void I_SetRes(unsigned int width, unsigned int height)
+{
+#ifdef HIGHRES
+  SCREENWIDTH = (width+3) & ~3;
+  SCREENHEIGHT = (height+3) & ~3;
+#endif
+
+#ifdef I386
+  if (SCREENWIDTH == 320) {
+    R_DrawColumn = R_DrawColumn_Normal;
+    R_DrawTLColumn = R_DrawTLColumn_Normal;
+  } else {
+    R_DrawColumn = R_DrawColumn_HighRes;
+    R_DrawTLColumn = R_DrawTLColumn_HighRes;
+  }
+#endif
+  printf("I_SetRes: Using resolution %dx%d\n", SCREENWIDTH, SCREENHEIGHT);
+}
+
+void I_InitGraphics(void)
+{
+  if (initialised) return;
+
+  lprintf(LO_INFO, "I_InitGraphics: null display, timing frames\n");
+  atexit(I_ShutdownGraphics);
+  initialised = true;
+}
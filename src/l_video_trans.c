@@ -51,6 +51,12 @@ static const inline unsigned long ffz(unsigned long x)
 
 #endif
 
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "doomtype.h"
 #include "v_video.h"
 #include "i_video.h"
@@ -122,215 +128,167 @@ void I_SetPaletteTranslation(const byte* palette)
     
     palette+=3;
   } while (--i);
+
+  // Every pixel on screen needs converting again
+  V_MarkRect(0, 0, SCREENWIDTH, SCREENHEIGHT);
 }
 
 //
 // Image expanding
 //
+// Only rows of screens[0] marked by V_MarkRect since the last frame are
+// converted. Each expander widens one source row into the first of its
+// output lines, and I_ExpandImage copies that line to the other
+// multiply-1. SSE2 has no gather, so palette lookups are still scalar,
+// but the widened pixels are put together and stored a register at a time.
+//
 
-static void I_Double8Buf(pval* out_buffer, const byte* src)
-{
-  register unsigned long *olineptr = out_buffer;
-  register const unsigned long *ilineptr = (const unsigned long*)src;
-  int y = SCREENHEIGHT;
+typedef void (*expand_func_t)(void* dest, const byte* src, int width);
 
-  do {
-    register int x = SCREENWIDTH/4;
-    do {
-      register unsigned int twoopixels;
-      register unsigned int twomoreopixels;
-      unsigned long* oline2ptr = olineptr + SCREENWIDTH*2 / sizeof(*olineptr);
-#ifndef I386
-      unsigned int fouripixels = *ilineptr++;
-      twoopixels =	(fouripixels & 0xff000000)
-	|	((fouripixels>>8) & 0xffff00)
-	|	((fouripixels>>16) & 0xff);
-      twomoreopixels =	((fouripixels<<16) & 0xff000000)
-	|	((fouripixels<<8) & 0xffff00)
-	|	(fouripixels & 0xff);
-#else
-      asm( "movl %%eax, %%edx ; "
-	       "shrl $16, %%eax ; "
-	       "movb %%dh, %%cl ; "
-	       "movb %%dh, %%ch ; "
-	       "movb %%ah, %%bh ; "
-	       "shll $16, %%ecx ; "
-	       "movb %%ah, %%bl ; "
-	       "shll $16, %%ebx ; "
-	       "movb %%dl, %%ch ; "
-	       "movb %%al, %%bh ; "
-	       "movb %%dl, %%cl ; "
-	       "movb %%al, %%bl ; "
-	       : "=b" (twoopixels), "=c" (twomoreopixels)
-	       : "a" (*ilineptr++) : "%cc", "%edx");
-#endif
-#ifdef __BIG_ENDIAN__
-      olineptr[0] = oline2ptr[0] = twoopixels;
-      olineptr[1] = oline2ptr[1] = twomoreopixels;
-#else
-      olineptr[0] = oline2ptr[0] = twomoreopixels;
-      olineptr[1] = oline2ptr[1] = twoopixels;
-#endif
-      olineptr+=2;
-    } while (--x);
+static expand_func_t expander;
 
-    olineptr += SCREENWIDTH * 2 / sizeof(*olineptr);
-  } while (--y);
-}
+// pixelvals in the sizes the expanders write, rebuilt when it changes
+static unsigned short pixel16[256];
+static unsigned int   pixel32[256];
+static unsigned int   pixelpair16[256];
 
-static void I_Triple8Buf(pval* out_buffer, const byte* src)
+static void I_BuildPixelTables(void)
 {
-  register unsigned long *olineptr = out_buffer;
-  const unsigned long *ilineptr = (const unsigned long*)src;
-  int x, y;
-  unsigned int fouropixels[3];
-  unsigned int fouripixels;
-  const int lineadd = SCREENWIDTH * 3 / sizeof(*olineptr);
-  
-  y = SCREENHEIGHT;
-  while (y--) {
-    x = SCREENWIDTH/4;
-    do {
-      fouripixels = *ilineptr++;
-      fouropixels[0] = (fouripixels & 0xff000000)
-	|	((fouripixels>>8) & 0xff0000)
-	|	((fouripixels>>16) & 0xffff);
-      fouropixels[1] = ((fouripixels<<8) & 0xff000000)
-	|	(fouripixels & 0xffff00)
-	|	((fouripixels>>8) & 0xff);
-      fouropixels[2] = ((fouripixels<<16) & 0xffff0000)
-	|	((fouripixels<<8) & 0xff00)
-	|	(fouripixels & 0xff);
-#ifdef __BIG_ENDIAN__
-      olineptr[0] = fouropixels[0];
-      olineptr[lineadd / sizeof (*olineptr)] = fouropixels[0];
-      olineptr[2 * lineadd] = fouropixels[0];
-      olineptr[1] = fouropixels[1];
-      olineptr[1 + lineadd] = fouropixels[1];
-      olineptr[1 + 2 * lineadd] = fouropixels[1];
-      olineptr[2] = fouropixels[2];
-      olineptr[2 + lineadd] = fouropixels[2];
-      olineptr[2 + 2 * lineadd] = fouropixels[2];
-#else
-      olineptr[0] = fouropixels[2];
-      olineptr[lineadd] = fouropixels[2];
-      olineptr[2 * lineadd] = fouropixels[2];
-      olineptr[1] = fouropixels[1];
-      olineptr[1 + lineadd] = fouropixels[1];
-      olineptr[1 + 2 * lineadd] = fouropixels[1];
-      olineptr[2] = fouropixels[0];
-      olineptr[2 + lineadd] = fouropixels[0];
-      olineptr[2 + 2 * lineadd] = fouropixels[0];
-#endif
-      olineptr += 3;
-    } while (--x);
-    olineptr += 2*lineadd;
+  int i;
+
+  for (i=0; i<256; i++) {
+    pixel16[i] = (unsigned short)pixelvals[i];
+    pixel32[i] = (unsigned int)pixelvals[i];
+    // Avoid all the shifts necessary to 'double' the 16bit pixel value
+    // into 2 adjacent 16-bit pixels, by pre-doubling a lookup table.
+    pixelpair16[i] = (pixel32[i] << 16) | pixel16[i];
   }
+  pv_changed = false;
 }
 
-static const void* fake; // Force gcc to include some asm of mine
+#ifdef __SSE2__
+// The next 8 or 4 pixels of src looked up in pixel16 or pixel32
+#define GATHER16(s) _mm_set_epi16(pixel16[(s)[7]], pixel16[(s)[6]], \
+  pixel16[(s)[5]], pixel16[(s)[4]], pixel16[(s)[3]], pixel16[(s)[2]], \
+  pixel16[(s)[1]], pixel16[(s)[0]])
+#define GATHER32(s) _mm_set_epi32(pixel32[(s)[3]], pixel32[(s)[2]], \
+  pixel32[(s)[1]], pixel32[(s)[0]])
+#endif
 
-static void I_Copyto16Buf(pval* out_buffer, const byte* src)
+//
+// 8 bpp, PseudoColor, so scaling only
+//
+
+static void I_Double8Row(void* dest, const byte* src, int width)
 {
-  register const byte* iptr = src;
-  register unsigned short* optr = (unsigned short*)out_buffer;
-  int count = SCREENHEIGHT * SCREENWIDTH / 4;
+  register byte* optr = dest;
 
-  if (pixelvals == NULL) return;
+#ifdef __SSE2__
+  for (; width >= 16; width -= 16, src += 16, optr += 32) {
+    __m128i v = _mm_loadu_si128((const __m128i*)src);
 
-#ifndef I386
-  do {
-    optr[0] = pixelvals[iptr[0]];
-    optr[1] = pixelvals[iptr[1]];
-    optr[2] = pixelvals[iptr[2]];
-    optr[3] = pixelvals[iptr[3]];
-
-    iptr += 4; optr += 4;
-  } while (--count);
-#else
-  asm("xorl %%eax,%%eax ; "
-      ".align 8 ; "
-      "0:"
-      "movb (%%esi),%%al ; "
-      "addl $4,%%esi ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movb -3(%%esi),%%al ; "
-      "movw %%dx,(%%edi) ; "
-      "addl $8,%%edi ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movb -2(%%esi),%%al ; "
-      "movw %%dx,-6(%%edi) ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movb -1(%%esi),%%al ; "
-      "movw %%dx,-4(%%edi) ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movw %%dx,-2(%%edi) ; "
-      "dec %%ecx ; jg 0b"
-      :: "D" (optr), "S" (iptr), "b" (pixelvals), "c" (count)
-      : "%eax", "%edx");
+    _mm_storeu_si128((__m128i*)optr, _mm_unpacklo_epi8(v, v));
+    _mm_storeu_si128((__m128i*)(optr+16), _mm_unpackhi_epi8(v, v));
+  }
 #endif
+  while (width--) {
+    optr[0] = optr[1] = *src++;
+    optr += 2;
+  }
 }
 
-static void I_Double16Buf(pval* out_buffer, const byte* src)
+static void I_Triple8Row(void* dest, const byte* src, int width)
 {
-  register const byte* iptr = src;
-  register unsigned long* optr = out_buffer;
-  int y = SCREENHEIGHT;
-  static unsigned long* pixelpair = NULL;
+  register byte* optr = dest;
 
-  if (pixelvals == NULL) return;
+  while (width--) {
+    optr[0] = optr[1] = optr[2] = *src++;
+    optr += 3;
+  }
+}
 
-  if (pv_changed || (pixelpair == NULL)) {
-    int i;
+static void I_Scale8Row(void* dest, const byte* src, int width)
+{
+  register byte* optr = dest;
 
-    // Avoid all the shifts necessary to 'double' the 16bit pixel value
-    // into 2 adjacent 16-bit pixels, by pre-doubling a lookup table.
+  while (width--) {
+    memset(optr, *src++, multiply);
+    optr += multiply;
+  }
+}
 
-    if (pixelpair == NULL)
-      pixelpair = Z_Malloc(256 * sizeof(*pixelpair), PU_STATIC, NULL);
+//
+// 15/16 bpp
+//
 
-    for (i = 0; i<256; i++)
-      pixelpair[i] = (pixelvals[i] << 16) | pixelvals[i];
+static void I_Copyto16Row(void* dest, const byte* src, int width)
+{
+  register unsigned short* optr = dest;
 
-    pv_changed = false;
-  }
+#ifdef __SSE2__
+  for (; width >= 8; width -= 8, src += 8, optr += 8)
+    _mm_storeu_si128((__m128i*)optr, GATHER16(src));
+#endif
+  while (width--)
+    *optr++ = pixel16[*src++];
+}
 
-  do {
-    int x = SCREENWIDTH/4;
+static void I_Double16Row(void* dest, const byte* src, int width)
+{
+  register unsigned int* optr = dest;
 
-    do {
-      unsigned long* optr2 = optr + 4*SCREENWIDTH / sizeof(*optr);
+#ifdef __SSE2__
+  for (; width >= 8; width -= 8, src += 8, optr += 8) {
+    __m128i v = GATHER16(src);
 
-      optr[0] = optr2[0] = pixelpair[iptr[0]];
-      optr[1] = optr2[1] = pixelpair[iptr[1]];
-      optr[2] = optr2[2] = pixelpair[iptr[2]];
-      optr[3] = optr2[3] = pixelpair[iptr[3]];
+    _mm_storeu_si128((__m128i*)optr, _mm_unpacklo_epi16(v, v));
+    _mm_storeu_si128((__m128i*)(optr+4), _mm_unpackhi_epi16(v, v));
+  }
+#endif
+  while (width--)
+    *optr++ = pixelpair16[*src++];
+}
 
-      iptr+=4; optr+=4;
-    } while (--x);
+static void I_Triple16Row(void* dest, const byte* src, int width)
+{
+  register unsigned short* optr = dest;
 
-    optr+=4*SCREENWIDTH/sizeof(*optr);
-  } while (--y);
+  while (width--) {
+    optr[0] = optr[1] = optr[2] = pixel16[*src++];
+    optr += 3;
+  }
+}
+
+static void I_Scale16Row(void* dest, const byte* src, int width)
+{
+  register unsigned short* optr = dest;
 
-  fake = iptr;
+  while (width--) {
+    register unsigned short p = pixel16[*src++];
+    register int i = multiply;
+
+    do *optr++ = p; while (--i);
+  }
 }
 
 #ifdef I386
+//
+// 24 bpp
+//
+
 // Nasty cast needed for outputting 3-byte pixelvals
 #define LONG_AT(p) *((unsigned long*)(p))
 
 static byte buffor24bpp[4*3+1];
 
-static void I_Copyto24Buf(pval* out_buffer, const byte* src)
+static void I_Copyto24Row(void* dest, const byte* src, int width)
 {
 #ifndef I386
 #error Warning!! Non-portable
 #endif
   register const byte* iptr = src;
-  register unsigned char* optr = (unsigned char*)out_buffer;
-  register int count = SCREENHEIGHT * SCREENWIDTH / 4;
-
-  if (pixelvals == NULL) return;
+  register unsigned char* optr = dest;
+  register int count = width / 4;
 
   do {
     LONG_AT(buffor24bpp+9) = pixelvals[iptr[3]];
@@ -343,104 +301,91 @@ static void I_Copyto24Buf(pval* out_buffer, const byte* src)
   } while (--count);
 }
 
-static void I_Double24Buf(pval* out_buffer, const byte* src)
+static void I_Double24Row(void* dest, const byte* src, int width)
 {
   register const byte* iptr = src;
-  register unsigned char* optr = (unsigned char*)out_buffer;
-  register int y = SCREENHEIGHT;
-
-  if (pixelvals == NULL) return;
+  register unsigned char* optr = dest;
+  register int x = width / 2;
 
   do {
-    register int x = SCREENWIDTH / 4;
-
-    do {
-      unsigned int w;
-      // Note - order is important in these overlapping writes
-      LONG_AT(buffor24bpp+9) = w = pixelvals[iptr[1]];
-      LONG_AT(buffor24bpp+6) = w;
-      LONG_AT(buffor24bpp+3) = w = pixelvals[iptr[0]];
-      LONG_AT(buffor24bpp) = w;
-      iptr += 2;
-      memcpy(optr, buffor24bpp+1, 3*4);
-      memcpy(optr + (6*SCREENWIDTH / sizeof(*optr)), buffor24bpp+1, 3*4);
-      optr += 3*4; 
-    } while (--x);
-
-    optr += 6*SCREENWIDTH / sizeof(*optr);
-  } while (--y);
+    unsigned int w;
+    // Note - order is important in these overlapping writes
+    LONG_AT(buffor24bpp+9) = w = pixelvals[iptr[1]];
+    LONG_AT(buffor24bpp+6) = w;
+    LONG_AT(buffor24bpp+3) = w = pixelvals[iptr[0]];
+    LONG_AT(buffor24bpp) = w;
+    iptr += 2;
+    memcpy(optr, buffor24bpp+1, 3*4);
+    optr += 3*4; 
+  } while (--x);
 }
 
 #undef LONG_AT
 #endif
 
-static void I_Copyto32Buf(pval* out_buffer, const byte* src)
-{
-  register const byte* iptr = src;
-  register unsigned long* optr = (unsigned long*)out_buffer;
-  int count = SCREENHEIGHT * SCREENWIDTH / 4;
-
-  if (pixelvals == NULL) return;
+//
+// 32 bpp
+//
 
-#ifndef I386
-  do {
-    optr[0] = pixelvals[iptr[0]];
-    optr[1] = pixelvals[iptr[1]];
-    optr[2] = pixelvals[iptr[2]];
-    optr[3] = pixelvals[iptr[3]];
+static void I_Copyto32Row(void* dest, const byte* src, int width)
+{
+  register unsigned int* optr = dest;
 
-    iptr += 4; optr += 4;
-  } while (--count);
-#else
-  asm("xorl %%eax,%%eax ; "
-      ".align 8 ; " 
-      "0:"
-      "movb (%%esi),%%al ; "
-      "addl $4,%%esi ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movb -3(%%esi),%%al ; "
-      "movl %%edx,(%%edi) ; "
-      "addl $16,%%edi ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movb -2(%%esi),%%al ; "
-      "movl %%edx,-12(%%edi) ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movb -1(%%esi),%%al ; "
-      "movl %%edx,-8(%%edi) ; "
-      "movl (%%ebx,%%eax,4),%%edx ; "
-      "movl %%edx,-4(%%edi) ; "
-      "dec %%ecx ; jg 0b"
-      :: "D" (optr), "S" (iptr), "b" (pixelvals), "c" (count)
-      : "%eax", "%edx");
+#ifdef __SSE2__
+  for (; width >= 4; width -= 4, src += 4, optr += 4)
+    _mm_storeu_si128((__m128i*)optr, GATHER32(src));
 #endif
+  while (width--)
+    *optr++ = pixel32[*src++];
 }
 
-static void I_Double32Buf(pval* out_buffer, const byte* src)
+static void I_Double32Row(void* dest, const byte* src, int width)
 {
-  register const byte* iptr = src;
-  register unsigned long* optr = (unsigned long*)out_buffer;
-  int y = SCREENHEIGHT;
+  register unsigned int* optr = dest;
 
-  if (pixelvals == NULL) return;
+#ifdef __SSE2__
+  for (; width >= 4; width -= 4, src += 4, optr += 8) {
+    __m128i v = GATHER32(src);
 
-  do {
-    int x = SCREENWIDTH/4;
+    _mm_storeu_si128((__m128i*)optr, _mm_unpacklo_epi32(v, v));
+    _mm_storeu_si128((__m128i*)(optr+4), _mm_unpackhi_epi32(v, v));
+  }
+#endif
+  while (width--) {
+    optr[0] = optr[1] = pixel32[*src++];
+    optr += 2;
+  }
+}
 
-    do {
-      unsigned long* optr2 = optr + 4*SCREENWIDTH / sizeof(*optr);
+static void I_Triple32Row(void* dest, const byte* src, int width)
+{
+  register unsigned int* optr = dest;
 
-      optr[0] = optr[1] = optr2[0] = optr2[1] = pixelvals[iptr[0]];
-      optr[2] = optr[3] = optr2[2] = optr2[3] = pixelvals[iptr[1]];
-      optr[4] = optr[5] = optr2[4] = optr2[5] = pixelvals[iptr[2]];
-      optr[6] = optr[7] = optr2[6] = optr2[7] = pixelvals[iptr[3]];
+#ifdef __SSE2__
+  for (; width >= 4; width -= 4, src += 4, optr += 12) {
+    __m128i v = GATHER32(src);
 
-      iptr+=4; optr+=8; // phew, 4 bytes to 8 dwords!
-    } while (--x);
+    _mm_storeu_si128((__m128i*)optr, _mm_shuffle_epi32(v, 0x40)); // 0001
+    _mm_storeu_si128((__m128i*)(optr+4), _mm_shuffle_epi32(v, 0xa5)); // 1122
+    _mm_storeu_si128((__m128i*)(optr+8), _mm_shuffle_epi32(v, 0xfe)); // 2333
+  }
+#endif
+  while (width--) {
+    optr[0] = optr[1] = optr[2] = pixel32[*src++];
+    optr += 3;
+  }
+}
+
+static void I_Scale32Row(void* dest, const byte* src, int width)
+{
+  register unsigned int* optr = dest;
 
-    optr+=8*SCREENWIDTH/sizeof(*optr);
-  } while (--y);
+  while (width--) {
+    register unsigned int p = pixel32[*src++];
+    register int i = multiply;
 
-  fake = iptr;
+    do *optr++ = p; while (--i);
+  }
 }
 
 //
@@ -452,21 +397,43 @@ static void I_Double32Buf(pval* out_buffer, const byte* src)
 #define MAX_BYTESPP 4
 #define MAX_MULT 4
 
-typedef void (*expand_func_t)(pval*, const byte*);
-
-void (*I_ExpandImage)(pval* dest, const byte* src);
-
 const expand_func_t pExpander[MAX_BYTESPP][MAX_MULT] = 
-{ { NULL, I_Double8Buf, I_Triple8Buf, NULL }, // 8 bpp modes
-  { I_Copyto16Buf, I_Double16Buf, NULL, NULL }, // 15/16 bpp modes
+{ { NULL, I_Double8Row, I_Triple8Row, I_Scale8Row }, // 8 bpp modes
+  { I_Copyto16Row, I_Double16Row, I_Triple16Row, I_Scale16Row }, // 15/16 bpp
 #ifdef I386
-  { I_Copyto24Buf, I_Double24Buf, NULL, NULL }, // 24 bpp modes
+  { I_Copyto24Row, I_Double24Row, NULL, NULL }, // 24 bpp modes
 #else
   { NULL, NULL, NULL, NULL }, // 24 bpp modes unsupported on other arch's
 #endif
-  { I_Copyto32Buf, I_Double32Buf, NULL, NULL }, // 32 bpp modes
+  { I_Copyto32Row, I_Double32Row, I_Triple32Row, I_Scale32Row }, // 32 bpp
 };
 
+//
+// I_ExpandImage
+//
+// Converts the rows of src changed since the last call into dest
+//
+void I_ExpandImage(pval* dest, const byte* src)
+{
+  const size_t linesize = SCREENWIDTH * multiply * BYTESPP;
+  byte* line = (byte*)dest;
+  int y, i;
+
+  if (true_color) {
+    if (pixelvals == NULL) return;
+    if (pv_changed) I_BuildPixelTables();
+  }
+
+  for (y=0; y<SCREENHEIGHT; y++, src += SCREENWIDTH, line += linesize*multiply)
+    if (dirtyrows[y]) {
+      (*expander)(line, src, SCREENWIDTH);
+      for (i=1; i<multiply; i++)
+	memcpy(line + i*linesize, line, linesize);
+    }
+
+  memset(dirtyrows, 0, SCREENHEIGHT);
+}
+
 boolean I_QueryImageTranslation(void)
 {
   if (multiply > MAX_MULT   ) return false;
@@ -483,8 +450,11 @@ size_t I_InitImageTranslation(void)
 {
   I_QueryImageTranslation(); // Set flags
 
-  I_ExpandImage = pExpander[BYTESPP -1][multiply-1];
+  expander = pExpander[BYTESPP -1][multiply-1];
   
+  // The output buffer is new, so it all needs converting
+  V_MarkRect(0, 0, SCREENWIDTH, SCREENHEIGHT);
+
   if (expand_buffer)
     return (SCREENWIDTH*multiply*SCREENHEIGHT*multiply*BYTESPP);
   else
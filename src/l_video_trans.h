@@ -61,7 +61,8 @@ extern int multiply, dest_bpp;
 
 boolean I_QueryImageTranslation(void); /* Is current image translation doable */
 size_t I_InitImageTranslation(void); /* Use it then */
-extern void (*I_ExpandImage)(pval* dest, const byte* src);
+/* Converts the rows of src marked by V_MarkRect since the last call */
+void I_ExpandImage(pval* dest, const byte* src);
 void I_EndImageTranslation(void);
 
 extern boolean expand_buffer; /* Do we need to use expanded buffer */
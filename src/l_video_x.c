@@ -912,7 +912,7 @@ void I_FinishUpdate (void)
   
   // scales the screen size before blitting it
   if (expand_buffer)
-    (*I_ExpandImage)(out_buffer, screens[0]);
+    I_ExpandImage(out_buffer, screens[0]);
   
 #ifdef HAVE_LIBXXF86DGA
   if (doDga) {
@@ -0,0 +1,339 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *  On-disk cache of data derived from wad lumps, like the translucency
+ *  map, texture column lookups and composites, and generated blockmaps.
+ *
+ *  Each entry is a file in ~/.lxdoom/cache, named by a hash of the lumps
+ *  (and any settings) it was built from, so a changed wad just misses the
+ *  cache rather than getting stale data. A lump in a wad is identified by
+ *  the file's inode, size, modification and status change times and the
+ *  lump's place in it, so checking the cache doesn't mean reading every
+ *  lump involved. The times are to the nanosecond where the system has
+ *  POSIX.1-2008 stat times and the filesystem keeps them, otherwise to
+ *  the second: a wad rewritten in place at the same size within the
+ *  same second as its last change can then still get stale entries.
+ *  Entries are mmap()ed in place when loaded. -nocache disables it.
+ *
+ *  Loading an entry touches its file, so the modification times order
+ *  the entries by last use. When the directory holds more than
+ *  cache_size megabytes, the least recently used are deleted.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef lint
+static const char
+rcsid[] = "$Id$";
+#endif /* lint */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "doomstat.h"
+#include "d_main.h"
+#include "m_argv.h"
+#include "m_cache.h"
+#include "w_wad.h"
+#include "lprintf.h"
+
+// Change this whenever the layout of any cached data changes
+#define CACHE_VERSION 1
+
+// 64 bit FNV-1a
+#define FNV_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+typedef struct {
+  char       magic[4];        // "LXDC"
+  int        version;
+  cachekey_t key;
+  uint_64_t  length;          // of the data following this header
+} cacheheader_t;
+
+static int cache_state;       // 0 not yet initialised, 1 enabled, -1 off
+static char *cache_dir;
+
+int cache_size;               // Megabytes the cache may hold, 0 for no limit
+static uint_64_t cache_bytes; // What it holds, as of the last M_CachePrune
+
+// Entries mapped by M_CacheLoad, so M_CacheRelease knows their lengths
+typedef struct {
+  const cacheheader_t *header;
+  size_t              size;
+} cachemap_t;
+
+static cachemap_t *cachemaps;
+static int        numcachemaps, maxcachemaps;
+
+// Lump hashes, each worked out once
+static uint_64_t *lumphash;
+static byte      *lumphashed;
+
+typedef struct {
+  char     *name;
+  time_t   mtime;
+  off_t    size;
+} cachefile_t;
+
+static int M_CompareCacheFiles(const void *a, const void *b)
+{
+  time_t ta = ((const cachefile_t*)a)->mtime;
+  time_t tb = ((const cachefile_t*)b)->mtime;
+
+  return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+//
+// M_CachePrune
+//
+// Totals up the cache directory, and if that is over cache_size deletes
+// the least recently used entries until it isn't. Temporary files are
+// left alone for an hour, in case another game is still writing them.
+//
+
+static void M_CachePrune(void)
+{
+  DIR           *dir;
+  struct dirent *de;
+  cachefile_t   *files = NULL;
+  int           numfiles = 0, maxfiles = 0, i;
+  time_t        now = time(NULL);
+
+  if (!(dir = opendir(cache_dir)))
+    return;
+
+  cache_bytes = 0;
+  while ((de = readdir(dir))) {
+    char path[PATH_MAX+1];
+    struct stat sbuf;
+
+    if (de->d_name[0] == '.' ||
+	snprintf(path, sizeof path, "%s/%s", cache_dir, de->d_name)
+	>= sizeof path)
+      continue;
+    if (stat(path, &sbuf) || !S_ISREG(sbuf.st_mode) ||
+	(strchr(de->d_name, '.') && now - sbuf.st_mtime < 3600))
+      continue;
+
+    if (numfiles == maxfiles)
+      files = realloc(files, (maxfiles = maxfiles ? maxfiles*2 : 64) *
+		      sizeof *files);
+    files[numfiles].name = strdup(path);
+    files[numfiles].mtime = sbuf.st_mtime;
+    files[numfiles].size = sbuf.st_size;
+    cache_bytes += sbuf.st_size;
+    numfiles++;
+  }
+  closedir(dir);
+
+  if (cache_size) {
+    qsort(files, numfiles, sizeof *files, M_CompareCacheFiles);
+    for (i=0; i<numfiles && cache_bytes > (uint_64_t)cache_size << 20; i++)
+      if (!remove(files[i].name))
+	cache_bytes -= files[i].size;
+  }
+
+  for (i=0; i<numfiles; i++)
+    free(files[i].name);
+  free(files);
+}
+
+static boolean M_CacheEnabled(void)
+{
+  if (!cache_state) {
+    cache_state = -1;
+    if (!M_CheckParm("-nocache")) {
+      const char *base = D_DoomExeDir();
+
+      cache_dir = malloc(strlen(base) + sizeof "/cache");
+      sprintf(cache_dir, "%s/cache", base);
+      mkdir(cache_dir, S_IRUSR | S_IWUSR | S_IXUSR);
+      if (!access(cache_dir, W_OK)) {
+	cache_state = 1;
+	M_CachePrune();
+      } else
+	lprintf(LO_WARN, "M_CacheEnabled: can't write to %s, not caching\n",
+		cache_dir);
+    }
+  }
+  return cache_state > 0;
+}
+
+// False if the name doesn't fit in size bytes
+static boolean M_CacheFileName(char *buf, size_t size, cachekey_t key)
+{
+  return snprintf(buf, size, "%s/%08lx%08lx", cache_dir,
+		  (unsigned long)(key >> 32),
+		  (unsigned long)(key & 0xffffffff)) < size;
+}
+
+void M_CacheKeyInit(cachekey_t* key, const char* kind)
+{
+  int version = CACHE_VERSION;
+
+  *key = FNV_BASIS;
+  M_CacheKeyData(key, kind, strlen(kind));
+  M_CacheKeyData(key, &version, sizeof version);
+}
+
+void M_CacheKeyData(cachekey_t* key, const void* data, size_t len)
+{
+  register const byte *p = data;
+  register uint_64_t h = *key;
+
+  while (len--)
+    h = (h ^ *p++) * FNV_PRIME;
+  *key = h;
+}
+
+void M_CacheKeyLump(cachekey_t* key, int lump)
+{
+  if (!lumphash) {
+    lumphash = malloc(numlumps * sizeof *lumphash);
+    lumphashed = calloc(numlumps, 1);
+  }
+  if (!lumphashed[lump]) {
+    const lumpinfo_t *l = &lumpinfo[lump];
+    uint_64_t *h = &lumphash[lump];
+    struct stat sbuf;
+
+    *h = FNV_BASIS;
+    M_CacheKeyData(h, &l->size, sizeof l->size);
+    if (l->handle >= 0 && !fstat(l->handle, &sbuf)) {
+      M_CacheKeyData(h, &sbuf.st_dev, sizeof sbuf.st_dev);
+      M_CacheKeyData(h, &sbuf.st_ino, sizeof sbuf.st_ino);
+      M_CacheKeyData(h, &sbuf.st_size, sizeof sbuf.st_size);
+      M_CacheKeyData(h, &sbuf.st_mtime, sizeof sbuf.st_mtime);
+      M_CacheKeyData(h, &sbuf.st_ctime, sizeof sbuf.st_ctime);
+#if _POSIX_VERSION >= 200809L
+      M_CacheKeyData(h, &sbuf.st_mtim.tv_nsec, sizeof sbuf.st_mtim.tv_nsec);
+      M_CacheKeyData(h, &sbuf.st_ctim.tv_nsec, sizeof sbuf.st_ctim.tv_nsec);
+#endif
+      M_CacheKeyData(h, &l->position, sizeof l->position);
+    } else {
+      M_CacheKeyData(h, W_CacheLumpNum(lump), l->size);
+      W_UnlockLumpNum(lump);
+    }
+    lumphashed[lump] = 1;
+  }
+  M_CacheKeyData(key, &lumphash[lump], sizeof lumphash[lump]);
+}
+
+const void* M_CacheLoad(cachekey_t key, size_t* len)
+{
+  char fname[PATH_MAX+1];
+  struct stat sbuf;
+  const cacheheader_t *header;
+  int fd;
+
+  if (!M_CacheEnabled())
+    return NULL;
+
+  if (!M_CacheFileName(fname, sizeof fname, key) ||
+      (fd = open(fname, O_RDONLY)) == -1)
+    return NULL;
+
+  if (fstat(fd, &sbuf) || sbuf.st_size < sizeof *header ||
+      (header = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0))
+      == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  if (memcmp(header->magic, "LXDC", 4) || header->version != CACHE_VERSION ||
+      header->key != key ||
+      header->length != sbuf.st_size - sizeof *header) {
+    lprintf(LO_WARN, "M_CacheLoad: ignoring bad cache file %s\n", fname);
+    munmap((void*)header, sbuf.st_size);
+    return NULL;
+  }
+
+  utime(fname, NULL); // Just used, so last to be pruned
+
+  if (numcachemaps == maxcachemaps)
+    cachemaps = realloc(cachemaps, (maxcachemaps = maxcachemaps ?
+				    maxcachemaps*2 : 64) * sizeof *cachemaps);
+  cachemaps[numcachemaps].header = header;
+  cachemaps[numcachemaps++].size = sbuf.st_size;
+
+  *len = header->length;
+  return header + 1;
+}
+
+boolean M_CacheRelease(const void* data)
+{
+  int i;
+
+  for (i=0; i<numcachemaps; i++)
+    if (cachemaps[i].header + 1 == data) {
+      munmap((void*)cachemaps[i].header, cachemaps[i].size);
+      cachemaps[i] = cachemaps[--numcachemaps];
+      return true;
+    }
+  return false;
+}
+
+void M_CacheStore(cachekey_t key, const void* data, size_t len)
+{
+  char fname[PATH_MAX+1], tmpname[PATH_MAX+16];
+  cacheheader_t header;
+  FILE *f;
+  boolean ok;
+
+  if (!M_CacheEnabled())
+    return;
+
+  memcpy(header.magic, "LXDC", 4);
+  header.version = CACHE_VERSION;
+  header.key = key;
+  header.length = len;
+
+  // Write to a temporary and rename, so other games reading the cache
+  // never see a partly written entry
+  if (!M_CacheFileName(fname, sizeof fname, key) ||
+      snprintf(tmpname, sizeof tmpname, "%s.%d", fname, (int)getpid())
+      >= sizeof tmpname || !(f = fopen(tmpname, "wb")))
+    return;
+
+  ok = fwrite(&header, sizeof header, 1, f) == 1 &&
+    (!len || fwrite(data, len, 1, f) == 1);
+  if (fclose(f) || !ok || rename(tmpname, fname)) {
+    lprintf(LO_WARN, "M_CacheStore: failed to write %s\n", fname);
+    remove(tmpname);
+  } else if (cache_size &&
+	     (cache_bytes += sizeof header + len) > (uint_64_t)cache_size << 20)
+    M_CachePrune();
+}
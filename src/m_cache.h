@@ -0,0 +1,64 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *    On-disk cache of data derived from wad lumps.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef __M_CACHE__
+#define __M_CACHE__
+
+#include <stddef.h>
+#include "doomtype.h"
+
+/* An entry is named by a hash of everything it was built from */
+typedef uint_64_t cachekey_t;
+
+/* Start a key for the given kind of data */
+void M_CacheKeyInit(cachekey_t* key, const char* kind);
+
+/* Add to a key, either some data or a lump's contents */
+void M_CacheKeyData(cachekey_t* key, const void* data, size_t len);
+void M_CacheKeyLump(cachekey_t* key, int lump);
+
+/* Megabytes the cache directory may hold before the least recently used
+ * entries are deleted, 0 for no limit */
+extern int cache_size;
+
+/* Returns the entry for the key, memory mapped and valid until exit or
+ * M_CacheRelease, and sets *len to its length. Returns NULL if there is
+ * no such entry */
+const void* M_CacheLoad(cachekey_t key, size_t* len);
+
+/* Unmaps an entry returned by M_CacheLoad that is no longer needed.
+ * Returns false, doing nothing, if data isn't such an entry */
+boolean M_CacheRelease(const void* data);
+
+/* Saves an entry, if the cache is enabled */
+void M_CacheStore(cachekey_t key, const void* data, size_t len);
+
+#endif
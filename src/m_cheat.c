@@ -42,6 +42,8 @@ rcsid[] = "$Id: m_cheat.c,v 1.12 1999/10/17 09:35:58 cphipps Exp $";
 #include "sounds.h"
 #include "dstrings.h"
 #include "r_main.h"
+#include "p_map.h"
+#include "p_tick.h"
 #include "d_deh.h"  // Ty 03/27/98 - externalized strings
 
 #define plyr (players+consoleplayer)     /* the console player */
@@ -64,6 +66,9 @@ static void cheat_behold();
 static void cheat_clev();
 static void cheat_mypos();
 static void cheat_rate();
+static void cheat_prof();
+static void cheat_profdump();
+static void cheat_sight();
 static void cheat_comp();
 static void cheat_friction();
 static void cheat_pushers();
@@ -168,6 +173,15 @@ struct cheat_s cheat[] = {
   {"idrate",     "Frame rate",        0,
    cheat_rate     },
 
+  {"tntprof",    NULL,                always,
+   cheat_prof     },     // toggle frame profiler
+
+  {"tntcsv",     NULL,                always,
+   cheat_profdump },     // write frame profile to rprofNN.csv
+
+  {"tntsight",   NULL,                always,
+   cheat_sight    },     // show sight check cache hit rate
+
   {"tntcomp",    NULL,                not_net | not_demo,
    cheat_comp     },     // phares
 
@@ -465,6 +479,26 @@ static void cheat_rate()
   rendering_stats ^= 1;
 }
 
+// Toggle the per-stage frame profiler and its graph
+static void cheat_prof()
+{
+  rendering_profile ^= 1;
+  doom_printf("Frame profiler %s", rendering_profile ? "ON" : "OFF");
+}
+
+static void cheat_profdump()
+{
+  R_DumpProfile();
+}
+
+// Show how many sight checks the sight cache has saved
+static void cheat_sight()
+{
+  doom_printf("Sight checks %u, cache hits %u (%u%%)", sight_checks,
+	      sight_cachehits, sight_checks ? 
+	      (unsigned)((sight_cachehits * 100.0) / sight_checks) : 0);
+}
+
 // compatibility cheat
 
 static const char * comp_lev_str[MAX_COMPATIBILITY_LEVEL] = 
@@ -516,10 +550,10 @@ static void cheat_massacre()    // jff 2/01/98 kill all monsters
   // fixed lost soul bug (LSs left behind when PEs are killed)
 
   int killcount=0;
-  thinker_t *currentthinker=&thinkercap;
+  thinker_t *currentthinker=&thinkerclasscap[th_mobj];
   extern void A_PainDie(mobj_t *);
 
-  while ((currentthinker=currentthinker->next)!=&thinkercap)
+  while ((currentthinker=currentthinker->cnext)!=&thinkerclasscap[th_mobj])
     if (currentthinker->function.acp1 == (actionf_p1) P_MobjThinker &&
         (((mobj_t *) currentthinker)->flags & MF_COUNTKILL ||
          ((mobj_t *) currentthinker)->type == MT_SKULL))
@@ -0,0 +1,249 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *  Batch demo sync checking. -syncdemos <demo> ... plays each demo to
+ *  its end with no drawing and no sound, each in its own process, as many
+ *  at once as there are processors (or -jobs <n>). For each one the state
+ *  of the game when it ended is printed on stdout, one line per demo and
+ *  in the order given, as key=value pairs: the tic, map, the kills, items
+ *  and secrets of all players against the level's totals, the RNG
+ *  indices, a checksum over the players' positions, health and stats
+ *  and the random number seeds, and the whole playsim's P_StateHash.
+ *  Comparing the output from two builds shows which demos no longer play
+ *  the same.
+ *
+ *  The WAD and all other setup is done once, before forking. Demos are
+ *  found as lumps by name, like -playdemo, so their names must differ.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef lint
+static const char
+rcsid[] = "$Id$";
+#endif /* lint */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "doomstat.h"
+#include "doomdef.h"
+#include "d_main.h"
+#include "m_argv.h"
+#include "m_random.h"
+#include "p_hash.h"
+#include "w_wad.h"
+#include "m_demosync.h"
+#include "lprintf.h"
+
+typedef struct {
+  const char *name;
+  pid_t       pid;
+  int         fd;      // Read end of the pipe the result comes back on
+  int         status;
+  char        result[256];
+} syncdemo_t;
+
+static int resultfd = -1;  // In a child, where to write the result
+
+void M_DemoSyncAddFiles(void)
+{
+  int p;
+
+  if (!(p = M_CheckParm("-syncdemos")))
+    return;
+
+  while (++p < myargc && *myargv[p] != '-') {
+    char file[PATH_MAX+1];
+    strcpy(file, myargv[p]);
+    AddDefaultExtension(file, ".lmp");
+    D_AddFile(file, source_lmp);
+  }
+}
+
+static void M_DemoSyncHash(unsigned long* h, const void* data, size_t len)
+{
+  const byte *p = data;
+
+  while (len--) // 32 bit FNV-1a
+    *h = ((*h ^ *p++) * 16777619) & 0xffffffff;
+}
+
+void M_DemoSyncDone(void)
+{
+  unsigned long h = 2166136261ul;
+  int  kills = 0, items = 0, secrets = 0, i;
+  char buf[256];
+  size_t len;
+
+  if (resultfd < 0)
+    return;
+
+  for (i=0; i<MAXPLAYERS; i++)
+    if (playeringame[i]) {
+      const player_t *player = &players[i];
+
+      if (gamestate == GS_LEVEL && player->mo) {
+	const mobj_t *mo = player->mo;
+	M_DemoSyncHash(&h, &mo->x, sizeof mo->x);
+	M_DemoSyncHash(&h, &mo->y, sizeof mo->y);
+	M_DemoSyncHash(&h, &mo->z, sizeof mo->z);
+	M_DemoSyncHash(&h, &mo->angle, sizeof mo->angle);
+	M_DemoSyncHash(&h, &mo->momx, sizeof mo->momx);
+	M_DemoSyncHash(&h, &mo->momy, sizeof mo->momy);
+      }
+      M_DemoSyncHash(&h, &player->health, sizeof player->health);
+      M_DemoSyncHash(&h, &player->armorpoints, sizeof player->armorpoints);
+      M_DemoSyncHash(&h, &player->killcount, sizeof player->killcount);
+      M_DemoSyncHash(&h, &player->itemcount, sizeof player->itemcount);
+      M_DemoSyncHash(&h, &player->secretcount, sizeof player->secretcount);
+      kills += player->killcount;
+      items += player->itemcount;
+      secrets += player->secretcount;
+    }
+  M_DemoSyncHash(&h, &rng, sizeof rng);
+
+  len = snprintf(buf, sizeof buf,
+		 "tic=%d map=%d.%d kills=%d/%d items=%d/%d secrets=%d/%d "
+		 "rndindex=%d prndindex=%d checksum=%08lx statehash=%08lx\n",
+		 gametic, gameepisode, gamemap, kills, totalkills,
+		 items, totalitems, secrets, totalsecret,
+		 rng.rndindex, rng.prndindex, h,
+		 gamestate == GS_LEVEL ? P_StateHash() : 0);
+  write(resultfd, buf, len < sizeof buf ? len : sizeof buf - 1);
+
+  // Leave without any of the exit handlers: nothing to save or shut down
+  _exit(0);
+}
+
+// Forks a child to play a demo; returns true in the child
+static boolean M_DemoSyncFork(syncdemo_t* demo)
+{
+  int fds[2];
+
+  if (pipe(fds))
+    I_Error("M_DemoSyncFork: pipe: %s", strerror(errno));
+
+  fflush(stdout);
+  fflush(stderr);
+  if ((demo->pid = fork()) < 0)
+    I_Error("M_DemoSyncFork: fork: %s", strerror(errno));
+
+  if (!demo->pid) {
+    int null = open("/dev/null", O_WRONLY);
+
+    // Only the result goes to stdout; errors still go to stderr
+    if (null >= 0) {
+      dup2(null, 1);
+      close(null);
+    }
+    close(fds[0]);
+    resultfd = fds[1];
+    return true;
+  }
+
+  close(fds[1]);
+  demo->fd = fds[0];
+  return false;
+}
+
+static void M_DemoSyncCollect(syncdemo_t* demo, int status)
+{
+  int len = read(demo->fd, demo->result, sizeof demo->result - 1);
+
+  demo->result[len > 0 ? len : 0] = 0;
+  demo->status = status;
+  close(demo->fd);
+  demo->pid = 0;
+}
+
+const char* M_DemoSyncStart(void)
+{
+  syncdemo_t *demos;
+  int p, numdemos = 0, jobs = 0, running = 0, next = 0, failed = 0, i;
+
+  if (!(p = M_CheckParm("-syncdemos")))
+    return NULL;
+
+  demos = calloc(myargc, sizeof *demos);
+  while (++p < myargc && *myargv[p] != '-')
+    demos[numdemos++].name = myargv[p];
+
+  if ((p = M_CheckParm("-jobs")) && ++p < myargc)
+    jobs = atoi(myargv[p]);
+  if (jobs <= 0 && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+    jobs = 1;
+
+  lprintf(LO_INFO, "M_DemoSyncStart: %d demos, %d at a time\n",
+	  numdemos, jobs);
+
+  while (next < numdemos || running) {
+    pid_t pid;
+    int   status;
+
+    while (running < jobs && next < numdemos) {
+      if (M_DemoSyncFork(&demos[next]))
+	return demos[next].name;
+      next++, running++;
+    }
+
+    if ((pid = wait(&status)) < 0) {
+      if (errno == EINTR)
+	continue;
+      I_Error("M_DemoSyncStart: wait: %s", strerror(errno));
+    }
+    for (i=0; i<next; i++)
+      if (demos[i].pid == pid) {
+	M_DemoSyncCollect(&demos[i], status);
+	running--;
+	break;
+      }
+  }
+
+  for (i=0; i<numdemos; i++) {
+    const syncdemo_t *demo = &demos[i];
+
+    if (WIFEXITED(demo->status) && !WEXITSTATUS(demo->status)
+	&& *demo->result)
+      printf("demo=%s status=ok %s", demo->name, demo->result);
+    else {
+      printf("demo=%s status=failed\n", demo->name);
+      failed++;
+    }
+  }
+  printf("demos=%d failed=%d\n", numdemos, failed);
+  fflush(stdout);
+
+  // Nothing was started that needs shutting down, and the config
+  // file is left alone
+  _exit(failed ? 1 : 0);
+}
@@ -0,0 +1,50 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *    Checking that a batch of demos still play through, in parallel.
+ *
+ *-----------------------------------------------------------------------------*/
+
+
+#ifndef __M_DEMOSYNC__
+#define __M_DEMOSYNC__
+
+#include "doomtype.h"
+
+/* Adds the demos named by -syncdemos as lumps; call before W_Init */
+void M_DemoSyncAddFiles(void);
+
+/* If -syncdemos was given, plays every demo in a child process and
+ * reports on them, then exits. In each child it returns the name of the
+ * demo to play, otherwise NULL */
+const char* M_DemoSyncStart(void);
+
+/* Called when a demo ends. In a -syncdemos child this reports the state
+ * of the game and exits */
+void M_DemoSyncDone(void);
+
+#endif
@@ -50,6 +50,7 @@ rcsid[] = "$Id: m_misc.c,v 1.43 2000/03/17 20:50:30 cph Exp $";
 #include "s_sound.h"
 #include "sounds.h"
 #include "i_joy.h"
+#include "m_cache.h"
 #include "lprintf.h"
 
 #include <unistd.h>
@@ -166,6 +167,7 @@ extern int mouseSensitivity_horiz,mouseSensitivity_vert;  // killough
 extern int realtic_clock_rate;         // killough 4/13/98: adjustable timer
 extern int leds_always_off;            // killough 3/6/98
 extern int tran_filter_pct;            // killough 2/21/98
+extern int render_threads;
 
 extern int screenblocks;
 extern int showMessages;
@@ -212,6 +214,8 @@ const default_t defaults[] =
    def_int,ss_none}, //1 to take a screenshot in PCX format, 0 for BMP"}, 
   {"auto_load",{NULL,&auto_load_wads},{0,"boomlump.wad"},UL,UL, 
    def_str,ss_none}, // files to load automatically, separated by ;'s
+  {"cache_size",{&cache_size},{64},0,UL,
+   def_int,ss_none}, // megabytes of data built from wads to keep, 0 = no limit
   
   {"Game settings",{NULL},{0},UL,UL,def_none,ss_none},
   {"default_skill",{&defaultskill},{3},1,5, // jff 3/24/98 allow default skill setting
@@ -259,9 +263,9 @@ const default_t defaults[] =
 
   {"Video settings",{NULL},{0},UL,UL,def_none,ss_none},
   // CPhipps - default screensize for targets that support high-res
-  {"screen_width",{&desired_screenwidth},{320}, 320, 1600, 
+  {"screen_width",{&desired_screenwidth},{320}, 320, MAX_SCREENWIDTH, 
    def_int,ss_none},
-  {"screen_height",{&desired_screenheight},{200},200,1200,
+  {"screen_height",{&desired_screenheight},{200},200,MAX_SCREENHEIGHT,
    def_int,ss_none},  
   {"use_vsync",{&use_vsync},{1},0,1,             // killough 2/8/98
    def_bool,ss_none}, // enable wait for vsync to avoid display tearing (fullscreen)
@@ -271,6 +275,8 @@ const default_t defaults[] =
    def_int,ss_none}, // set percentage of foreground/background translucency mix  
   {"screenblocks",{&screenblocks},{10},3,11,  // killough 2/21/98: default to 10
    def_int,ss_none},
+  {"render_threads",{&render_threads},{1},1,16,
+   def_int,ss_none}, // number of threads drawing the view, -rthreads overrides
   {"usegamma",{&usegamma},{3},0,4, //jff 3/6/98 fix erroneous upper limit in range
    def_int,ss_none}, // gamma correction level // killough 1/18/98
   {"X_options",{&X_opt},{0},0,3, // CPhipps - misc X options
@@ -435,6 +441,10 @@ const default_t defaults[] =
   // killough 2/22/98: screenshot key
   {"key_screenshot",  {&key_screenshot},      {'*'}            ,
    0,MAX_KEY,def_key,ss_keys}, // key to take a screenshot
+  {"key_demo_back",   {&key_demo_back},       {'['}            ,
+   0,MAX_KEY,def_key,ss_keys}, // key to skip back 10 seconds in a demo
+  {"key_demo_forward",{&key_demo_forward},    {']'}            ,
+   0,MAX_KEY,def_key,ss_keys}, // key to skip forward 10 seconds in a demo
   
   {"Joystick settings",{NULL},{0},UL,UL,def_none,ss_none},
   {"use_joystick",{&usejoystick},{0},0,2,
@@ -0,0 +1,261 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *  Renders a demo to video. With -viddump <file> every frame drawn is
+ *  converted through the current palette and written to <file> as
+ *  YUV4MPEG2 (4:2:0, 35 frames a second); with -wavdump <file> the sound
+ *  effects are mixed in process, 1/35s per frame, and written to <file>
+ *  as a 16 bit stereo WAV. A file name starting with | is instead a
+ *  command to pipe the data to, e.g. an encoder.
+ *
+ *  The game runs one tic per frame without waiting, so this goes as fast
+ *  as the machine can render, and the two files stay in step.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef lint
+static const char
+rcsid[] = "$Id$";
+#endif /* lint */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomstat.h"
+#include "doomdef.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "m_swap.h"
+#include "v_video.h"
+#include "w_wad.h"
+#include "l_soundgen.h"
+#include "m_viddump.h"
+#include "lprintf.h"
+
+// Samples of sound per frame; 11025 is a multiple of 35
+#define TICSAMPLES (SAMPLERATE/TICRATE)
+
+#define WAVHEADERSIZE 44
+
+boolean viddump_active, viddump_sound;
+
+static FILE *vidfile, *wavfile;
+static boolean vidpipe, wavpipe;
+
+// The frame being written, Y plane then U and V
+static byte   *frame;
+static size_t framesize;
+
+// Y, U and V of each colour in the palette, and which palette that is
+static byte pal_y[256], pal_u[256], pal_v[256];
+static int  cachedpal = -1, cachedgamma = -1;
+
+static unsigned long wavbytes;
+
+static FILE* M_VidDumpOpen(const char* name, boolean* ispipe)
+{
+  FILE* f;
+
+  if ((*ispipe = (*name == '|')))
+    f = popen(name+1, "w");
+  else
+    f = fopen(name, "wb");
+  if (!f)
+    I_Error("M_VidDumpOpen: failed to open %s", name);
+  return f;
+}
+
+static void M_VidDumpClose(FILE* f, boolean ispipe)
+{
+  if (ispipe)
+    pclose(f);
+  else
+    fclose(f);
+}
+
+//
+// WAV output
+//
+
+static void M_WavPut(byte* p, unsigned long v, int bytes)
+{
+  while (bytes--) {
+    *p++ = v & 0xff;
+    v >>= 8;
+  }
+}
+
+static void M_WavHeader(unsigned long datalen)
+{
+  byte h[WAVHEADERSIZE];
+
+  memcpy(h, "RIFF", 4);
+  M_WavPut(h+4, datalen > 0xffffffffUL-36 ? 0xffffffffUL : datalen+36, 4);
+  memcpy(h+8, "WAVEfmt ", 8);
+  M_WavPut(h+16, 16, 4);           // format chunk length
+  M_WavPut(h+20, 1, 2);            // PCM
+  M_WavPut(h+22, 2, 2);            // stereo
+  M_WavPut(h+24, SAMPLERATE, 4);
+  M_WavPut(h+28, SAMPLERATE*4, 4); // bytes per second
+  M_WavPut(h+32, 4, 2);            // bytes per sample, all channels
+  M_WavPut(h+34, 16, 2);           // bits per sample
+  memcpy(h+36, "data", 4);
+  M_WavPut(h+40, datalen, 4);
+  fwrite(h, sizeof h, 1, wavfile);
+}
+
+static void M_VidDumpSound(void)
+{
+  static signed short buf[TICSAMPLES*2];
+  const signed short *mix = I_MixSound(TICSAMPLES);
+  int i;
+
+  // Silence if sound effects are off
+  if (!mix)
+    memset(buf, 0, sizeof buf);
+  else
+    for (i=0; i<TICSAMPLES*2; i++)
+      buf[i] = SHORT(mix[i]);  // WAV is little endian
+
+  if (fwrite(buf, sizeof buf, 1, wavfile) != 1)
+    I_Error("M_VidDumpFrame: error writing sound");
+  wavbytes += sizeof buf;
+}
+
+//
+// Y4M output
+//
+
+static void M_VidDumpPalette(void)
+{
+  int lump = W_GetNumForName("PLAYPAL");
+  const byte *pal = (const byte *)W_CacheLumpNum(lump) + current_palette*768;
+  const byte *const gtable = gammatable[cachedgamma = usegamma];
+  int i;
+
+  // ITU-R BT.601, in the 16-235 range players expect
+  for (i=0; i<256; i++, pal += 3) {
+    int r = gtable[pal[0]], g = gtable[pal[1]], b = gtable[pal[2]];
+
+    pal_y[i] = 16 + ((66*r + 129*g + 25*b + 128) >> 8);
+    pal_u[i] = 128 + ((-38*r - 74*g + 112*b + 128) >> 8);
+    pal_v[i] = 128 + ((112*r - 94*g - 18*b + 128) >> 8);
+  }
+  W_UnlockLumpNum(lump);
+  cachedpal = current_palette;
+}
+
+static void M_VidDumpVideo(void)
+{
+  const int w = SCREENWIDTH, h = SCREENHEIGHT;
+  const byte *src = screens[0];
+  byte *y = frame, *u = frame + w*h, *v = u + ((w+1)/2)*((h+1)/2);
+  int x, row;
+
+  if (cachedpal != current_palette || cachedgamma != usegamma)
+    M_VidDumpPalette();
+
+  for (x=0; x<w*h; x++)
+    y[x] = pal_y[src[x]];
+
+  // Each chroma sample is the average of a 2x2 block
+  for (row=0; row<h; row+=2) {
+    const byte *s0 = src + row*w, *s1 = row+1 < h ? s0 + w : s0;
+
+    for (x=0; x<w; x+=2) {
+      int x1 = x+1 < w ? x+1 : x;
+
+      *u++ = (pal_u[s0[x]] + pal_u[s0[x1]] +
+	      pal_u[s1[x]] + pal_u[s1[x1]] + 2) >> 2;
+      *v++ = (pal_v[s0[x]] + pal_v[s0[x1]] +
+	      pal_v[s1[x]] + pal_v[s1[x1]] + 2) >> 2;
+    }
+  }
+
+  fputs("FRAME\n", vidfile);
+  if (fwrite(frame, framesize, 1, vidfile) != 1)
+    I_Error("M_VidDumpFrame: error writing video");
+}
+
+static void M_VidDumpEnd(void)
+{
+  if (vidfile) {
+    M_VidDumpClose(vidfile, vidpipe);
+    vidfile = NULL;
+  }
+  if (wavfile) {
+    // Now the length is known, if the file can be rewritten
+    if (!wavpipe && !fseek(wavfile, 0, SEEK_SET))
+      M_WavHeader(wavbytes);
+    M_VidDumpClose(wavfile, wavpipe);
+    wavfile = NULL;
+  }
+}
+
+void M_VidDumpFrame(void)
+{
+  if (vidfile)
+    M_VidDumpVideo();
+  if (wavfile)
+    M_VidDumpSound();
+}
+
+void M_VidDumpInit(void)
+{
+  int p;
+
+  if ((p = M_CheckParm("-viddump")) && ++p < myargc) {
+    // Display aspect is 4:3 whatever the resolution
+    int an = 4*SCREENHEIGHT, ad = 3*SCREENWIDTH, a = an, b = ad;
+
+    while (b) {
+      int t = a % b;
+      a = b; b = t;
+    }
+
+    vidfile = M_VidDumpOpen(myargv[p], &vidpipe);
+    framesize = SCREENWIDTH*SCREENHEIGHT +
+      2*((SCREENWIDTH+1)/2)*((SCREENHEIGHT+1)/2);
+    frame = malloc(framesize);
+    fprintf(vidfile, "YUV4MPEG2 W%d H%d F%d:1 Ip A%d:%d C420jpeg\n",
+	    SCREENWIDTH, SCREENHEIGHT, TICRATE, an/a, ad/a);
+    lprintf(LO_INFO, "M_VidDumpInit: writing video to %s\n", myargv[p]);
+  }
+
+  if ((p = M_CheckParm("-wavdump")) && ++p < myargc) {
+    wavfile = M_VidDumpOpen(myargv[p], &wavpipe);
+    M_WavHeader(0xffffffffUL); // Streamed, so the length is not known yet
+    viddump_sound = true;
+    lprintf(LO_INFO, "M_VidDumpInit: writing sound to %s\n", myargv[p]);
+  }
+
+  if (vidfile || wavfile) {
+    viddump_active = true;
+    atexit(M_VidDumpEnd);
+  }
+}
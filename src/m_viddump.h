@@ -0,0 +1,50 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *    Writing every frame to a Y4M video and the sound to a WAV file.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef __M_VIDDUMP__
+#define __M_VIDDUMP__
+
+#include "doomtype.h"
+
+/* True if -viddump or -wavdump was given; the game then runs one tic
+ * per frame with no waiting */
+extern boolean viddump_active;
+
+/* True if sound is being mixed for -wavdump, rather than played */
+extern boolean viddump_sound;
+
+/* Opens the files named by -viddump and -wavdump, if any */
+void M_VidDumpInit(void);
+
+/* Writes out screens[0], and the next 1/35s of sound */
+void M_VidDumpFrame(void);
+
+#endif
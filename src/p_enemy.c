@@ -498,7 +498,7 @@ void A_KeenDie(mobj_t* mo)
 
   // scan the remaining thinkers to see if all Keens are dead
 
-  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+  for (th = thinkerclasscap[th_mobj].cnext ; th != &thinkerclasscap[th_mobj] ; th=th->cnext)
     if (th->function.acp1 == (actionf_p1)P_MobjThinker)
       {
         mobj_t *mo2 = (mobj_t *) th;
@@ -1309,9 +1309,9 @@ void A_PainShootSkull(mobj_t *actor, angle_t angle)
       // count total number of skulls currently on the level
       int count = 0;
       thinker_t *currentthinker;
-      for (currentthinker = thinkercap.next;
-           currentthinker != &thinkercap;
-           currentthinker = currentthinker->next)
+      for (currentthinker = thinkerclasscap[th_mobj].cnext;
+           currentthinker != &thinkerclasscap[th_mobj];
+           currentthinker = currentthinker->cnext)
         if ((currentthinker->function.acp1 == (actionf_p1) P_MobjThinker)
             && ((mobj_t *)currentthinker)->type == MT_SKULL)
           count++;
@@ -1536,7 +1536,7 @@ void A_BossDeath(mobj_t *mo)
 
     // scan the remaining thinkers to see
     // if all bosses are dead
-  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+  for (th = thinkerclasscap[th_mobj].cnext ; th != &thinkerclasscap[th_mobj] ; th=th->cnext)
     if (th->function.acp1 == (actionf_p1)P_MobjThinker)
       {
         mobj_t *mo2 = (mobj_t *) th;
@@ -1650,9 +1650,9 @@ void P_SpawnBrainTargets(void)  // killough 3/26/98: renamed old function
   brain.targeton = 0;
   brain.easy = 0;           // killough 3/26/98: always init easy to 0
 
-  for (thinker = thinkercap.next ;
-       thinker != &thinkercap ;
-       thinker = thinker->next)
+  for (thinker = thinkerclasscap[th_mobj].cnext ;
+       thinker != &thinkerclasscap[th_mobj] ;
+       thinker = thinker->cnext)
     if (thinker->function.acp1 == (actionf_p1)P_MobjThinker)
       {
         mobj_t *m = (mobj_t *) thinker;
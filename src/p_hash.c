@@ -0,0 +1,149 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *  Hashing and dumping the play simulation state, to find desyncs.
+ *
+ *  The hash is over whole words, not bytes, and only over what the
+ *  playsim acts on: each thing's type, position, momentum, angle,
+ *  health, flags and state, each sector's heights and light level, the
+ *  players' stats, and the random number generator. It is cheap enough
+ *  to work out every tic; see d_client.c for its use in netgames.
+ *
+ *  It is worked out afresh each time rather than kept up as the state
+ *  changes. Keeping it up would mean hooking every place that moves a
+ *  thing, plane or light, and any one missed would itself look like a
+ *  desync. A fresh hash is 12 words a thing and 3 a sector, about 60us
+ *  a tic with 2000 of each, against 28ms for the tic.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef lint
+static const char
+rcsid[] = "$Id$";
+#endif /* lint */
+
+#include "doomstat.h"
+#include "m_random.h"
+#include "p_mobj.h"
+#include "p_tick.h"
+#include "r_state.h"
+#include "p_hash.h"
+
+#define HashWord(h,v) ((h) = (((h) ^ (unsigned long)(v)) * 16777619) & 0xffffffff)
+
+unsigned long P_StateHash(void)
+{
+  unsigned long h = 2166136261ul;
+  const thinker_t *th;
+  int i;
+
+  HashWord(h, leveltime);
+  HashWord(h, rng.rndindex);
+  HashWord(h, rng.prndindex);
+  for (i=0; i<NUMPRCLASS; i++)
+    HashWord(h, rng.seed[i]);
+
+  for (i=0; i<MAXPLAYERS; i++)
+    if (playeringame[i]) {
+      const player_t *player = &players[i];
+
+      HashWord(h, player->health);
+      HashWord(h, player->armorpoints);
+      HashWord(h, player->readyweapon);
+      HashWord(h, player->killcount);
+      HashWord(h, player->itemcount);
+      HashWord(h, player->secretcount);
+    }
+
+  for (th = thinkerclasscap[th_mobj].cnext; th != &thinkerclasscap[th_mobj];
+       th = th->cnext)
+    if (th->function.acp1 == (actionf_p1)P_MobjThinker) {
+      const mobj_t *mo = (const mobj_t*)th;
+
+      HashWord(h, mo->type);
+      HashWord(h, mo->x);
+      HashWord(h, mo->y);
+      HashWord(h, mo->z);
+      HashWord(h, mo->momx);
+      HashWord(h, mo->momy);
+      HashWord(h, mo->momz);
+      HashWord(h, mo->angle);
+      HashWord(h, mo->health);
+      HashWord(h, mo->flags);
+      HashWord(h, mo->tics);
+      HashWord(h, mo->state ? mo->state - states : -1);
+    }
+
+  for (i=0; i<numsectors; i++) {
+    const sector_t *sec = &sectors[i];
+
+    HashWord(h, sec->floorheight);
+    HashWord(h, sec->ceilingheight);
+    HashWord(h, sec->lightlevel);
+  }
+  return h;
+}
+
+void P_DumpState(FILE* f)
+{
+  const thinker_t *th;
+  int i, n;
+
+  fprintf(f, "gametic %d leveltime %d map %d.%d hash %08lx\n",
+	  gametic, leveltime, gameepisode, gamemap, P_StateHash());
+  fprintf(f, "rng rndindex %d prndindex %d\n", rng.rndindex, rng.prndindex);
+  for (i=0; i<NUMPRCLASS; i++)
+    fprintf(f, "rng seed %d %lu\n", i, rng.seed[i]);
+
+  for (i=0; i<MAXPLAYERS; i++)
+    if (playeringame[i]) {
+      const player_t *player = &players[i];
+
+      fprintf(f, "player %d health %d armor %d weapon %d "
+	      "kills %d items %d secrets %d\n", i, player->health,
+	      player->armorpoints, player->readyweapon, player->killcount,
+	      player->itemcount, player->secretcount);
+    }
+
+  // Things are numbered in thinker order, which is part of the state
+  for (n = 0, th = thinkerclasscap[th_mobj].cnext;
+       th != &thinkerclasscap[th_mobj]; th = th->cnext)
+    if (th->function.acp1 == (actionf_p1)P_MobjThinker) {
+      const mobj_t *mo = (const mobj_t*)th;
+
+      fprintf(f, "mobj %d type %d x %d y %d z %d mom %d %d %d angle %lu "
+	      "health %d flags %08x tics %d state %d\n", n++, mo->type,
+	      mo->x, mo->y, mo->z, mo->momx, mo->momy, mo->momz,
+	      (unsigned long)mo->angle, mo->health, mo->flags, mo->tics,
+	      mo->state ? (int)(mo->state - states) : -1);
+    }
+
+  for (i=0; i<numsectors; i++)
+    fprintf(f, "sector %d floor %d ceiling %d light %d\n", i,
+	    sectors[i].floorheight, sectors[i].ceilingheight,
+	    sectors[i].lightlevel);
+}
@@ -0,0 +1,46 @@
+/* Emacs style mode select   -*- C++ -*-
+ *-----------------------------------------------------------------------------
+ *
+ * $Id$
+ *
+ *  LxDoom, a Doom port for Linux/Unix
+ *  based on BOOM, a modified and improved DOOM engine
+ *  Copyright (C) 1999 by
+ *  id Software, Chi Hoang, Lee Killough, Jim Flynn, Rand Phares, Ty Halderman
+ *   and Colin Phipps
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ *  02111-1307, USA.
+ *
+ * DESCRIPTION:
+ *    Hashing and dumping the play simulation state, to find desyncs.
+ *
+ *-----------------------------------------------------------------------------*/
+
+#ifndef __P_HASH__
+#define __P_HASH__
+
+#include <stdio.h>
+
+/* Returns a hash of the things, sectors, players and random number
+ * state. Equal in every node of a netgame, or every run of a demo,
+ * as long as they stay in sync */
+unsigned long P_StateHash(void);
+
+/* Writes everything P_StateHash covers to f as text, one line per item,
+ * so two dumps can be compared with diff(1) */
+void P_DumpState(FILE* f);
+
+#endif
@@ -1619,6 +1619,7 @@ boolean P_ChangeSector(sector_t* sector,boolean crunch)
 
   nofit = false;
   crushchange = crunch;
+  P_ClearSightCache();
 
   // ARRGGHHH!!!!
   // This is horrendously slow!!!
@@ -1649,6 +1650,7 @@ boolean P_CheckSector(sector_t* sector,boolean crunch)
 
   nofit = false;
   crushchange = crunch;
+  P_ClearSightCache();
 
   // killough 4/4/98: scan list front-to-back until empty or exhausted,
   // restarting from beginning after each thing is processed. Avoids
@@ -1798,6 +1800,19 @@ void P_DelSeclist(msecnode_t* node)
     node = P_DelSecnode(node);
   }
 
+// P_NewSecnode() makes a node linked into neither list, for
+// P_UnArchiveThingLinks to put in its saved place in both.
+
+msecnode_t* P_NewSecnode(sector_t* s, mobj_t* thing)
+  {
+  msecnode_t* node = P_GetSecnode();
+
+  node->visited = 0;
+  node->m_sector = s;
+  node->m_thing = thing;
+  return(node);
+  }
+
 
 // phares 3/14/98
 //
@@ -49,6 +49,8 @@ boolean P_TryMove(mobj_t *thing, fixed_t x, fixed_t y, boolean dropoff);
 boolean P_TeleportMove(mobj_t *thing, fixed_t x, fixed_t y);
 void    P_SlideMove(mobj_t *mo);
 boolean P_CheckSight(mobj_t *t1, mobj_t *t2);
+void    P_ClearSightCache(void);   // after any change to sector heights
+extern unsigned sight_checks, sight_cachehits;
 void    P_UseLines(player_t *player);
 boolean P_ChangeSector(sector_t *sector, boolean crunch);
 fixed_t P_AimLineAttack(mobj_t *t1, angle_t angle, fixed_t distance);
@@ -60,6 +62,7 @@ boolean P_CheckPosition(mobj_t *thing, fixed_t x, fixed_t y);
 //jff 3/19/98 P_CheckSector(): new routine to replace P_ChangeSector()
 boolean P_CheckSector(sector_t *sector, boolean crunch);
 void    P_DelSeclist(msecnode_t *);                         // phares 3/16/98
+msecnode_t *P_NewSecnode(sector_t *, mobj_t *);             // unlinked node
 void    P_CreateSecNodeList(mobj_t*,fixed_t,fixed_t);       // phares 3/14/98
 int     P_GetMoveFactor(mobj_t* mo);                        // phares  3/6/98
 boolean Check_Sides(mobj_t *, int, int);                    // phares
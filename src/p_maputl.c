@@ -424,6 +424,9 @@ boolean P_BlockThingsIterator(int x, int y, boolean func(mobj_t*))
 // 1/11/98 killough: Intercept limit removed
 static intercept_t *intercepts, *intercept_p;
 
+// Sort keys for the intercepts, see P_TraverseIntercepts
+static uint_64_t *interceptkeys;
+
 // Check for limit and double size if necessary -- killough
 static void check_intercept(void)
 {
@@ -433,12 +436,17 @@ static void check_intercept(void)
     {
       num_intercepts = num_intercepts ? num_intercepts*2 : 128;
       intercepts = realloc(intercepts, sizeof(*intercepts)*num_intercepts);
+      interceptkeys = realloc(interceptkeys,
+			      sizeof(*interceptkeys)*num_intercepts);
       intercept_p = intercepts + offset;
     }
 }
 
 divline_t trace;
 
+// Which side test PIT_AddLineIntercepts uses, decided once per trace
+static boolean trace_long;
+
 // PIT_AddLineIntercepts.
 // Looks for lines in the given block
 // that intercept the given trace
@@ -457,8 +465,7 @@ boolean PIT_AddLineIntercepts(line_t *ld)
   divline_t dl;
 
   // avoid precision problems with two routines
-  if (trace.dx >  FRACUNIT*16 || trace.dy >  FRACUNIT*16 ||
-      trace.dx < -FRACUNIT*16 || trace.dy < -FRACUNIT*16)
+  if (trace_long)
     {
       s1 = P_PointOnDivlineSide (ld->v1->x, ld->v1->y, &trace);
       s2 = P_PointOnDivlineSide (ld->v2->x, ld->v2->y, &trace);
@@ -544,29 +551,63 @@ boolean PIT_AddThingIntercepts(mobj_t *thing)
   return true;          // keep going
 }
 
+//
+// P_SiftDown
+// Restores the min-heap below heap[i]
+//
+
+static void P_SiftDown(uint_64_t *heap, size_t n, size_t i)
+{
+  uint_64_t key = heap[i];
+  size_t    child;
+
+  while ((child = 2*i+1) < n)
+    {
+      if (child+1 < n && heap[child+1] < heap[child])
+        child++;
+      if (key <= heap[child])
+        break;
+      heap[i] = heap[child];
+      i = child;
+    }
+  heap[i] = key;
+}
+
 //
 // P_TraverseIntercepts
 // Returns true if the traverser function returns true
 // for all lines.
 //
 // killough 5/3/98: reformatted, cleaned up
+//
+// The intercepts used to be searched for the nearest every time round,
+// which is quadratic in long traces. They are now taken from a heap of
+// keys holding frac above the intercept's index, so those with equal fracs
+// still come out in the order they were added, as the search found them.
+// Hitscans mostly stop at the first wall, so the heap, costing only
+// a linear build and a pop per intercept used, beats a full sort.
+//
 
 boolean P_TraverseIntercepts(traverser_t func, fixed_t maxfrac)
 {
-  intercept_t *in = NULL;
-  int count = intercept_p - intercepts;
-  while (count--)
+  size_t count = intercept_p - intercepts;
+  size_t i;
+
+  // fracs are never negative, intercepts behind the source being skipped
+  for (i=0; i<count; i++)
+    interceptkeys[i] = ((uint_64_t)(unsigned)intercepts[i].frac << 32) | i;
+  for (i=count/2; i-- > 0; )
+    P_SiftDown(interceptkeys, count, i);
+
+  while (count)
     {
-      fixed_t dist = INT_MAX;
-      intercept_t *scan;
-      for (scan = intercepts; scan < intercept_p; scan++)
-        if (scan->frac < dist)
-          dist = (in=scan)->frac;
-      if (dist > maxfrac)
+      intercept_t *in = &intercepts[(size_t)(interceptkeys[0] & 0xffffffff)];
+      if (in->frac > maxfrac)
         return true;    // checked everything in range
       if (!func(in))
         return false;           // don't bother going farther
-      in->frac = INT_MAX;
+      interceptkeys[0] = interceptkeys[--count];
+      P_SiftDown(interceptkeys, count, 0);
     }
   return true;                  // everything was traversed
 }
@@ -605,6 +646,8 @@ boolean P_PathTraverse(fixed_t x1, fixed_t y1, fixed_t x2, fixed_t y2,
   trace.y = y1;
   trace.dx = x2 - x1;
   trace.dy = y2 - y1;
+  trace_long = trace.dx >  FRACUNIT*16 || trace.dy >  FRACUNIT*16 ||
+    trace.dx < -FRACUNIT*16 || trace.dy < -FRACUNIT*16;
 
   x1 -= bmaporgx;
   y1 -= bmaporgy;
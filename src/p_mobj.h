@@ -230,10 +230,21 @@ typedef struct mobj_s
     thinker_t           thinker;
 
     // Info for drawing: position.
+    // What P_MobjThinker looks at every tic is kept together here,
+    // next to the thinker links, to keep it to a cache line or two.
     fixed_t             x;
     fixed_t             y;
     fixed_t             z;
 
+    // Momentums, used to update position.
+    fixed_t             momx;
+    fixed_t             momy;
+    fixed_t             momz;
+
+    int                 tics;   // state tic counter
+    state_t*            state;
+    int                 flags;
+
     // More list: links in sector (if needed)
     struct mobj_s*      snext;
     struct mobj_s*      sprev;
@@ -258,20 +269,12 @@ typedef struct mobj_s
     fixed_t             radius;
     fixed_t             height; 
 
-    // Momentums, used to update position.
-    fixed_t             momx;
-    fixed_t             momy;
-    fixed_t             momz;
-
     // If == validcount, already checked.
     int                 validcount;
 
     mobjtype_t          type;
     mobjinfo_t*         info;   // &mobjinfo[mobj->type]
     
-    int                 tics;   // state tic counter
-    state_t*            state;
-    int                 flags;
     int                 health;
 
     // Movement direction, movement generation (zig-zagging).
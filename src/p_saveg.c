@@ -35,12 +35,14 @@ rcsid[] = "$Id: p_saveg.c,v 1.11 1999/10/31 11:52:23 cphipps Exp $";
 #include "doomstat.h"
 #include "r_main.h"
 #include "p_maputl.h"
+#include "p_setup.h"
 #include "p_spec.h"
 #include "p_tick.h"
 #include "p_saveg.h"
 #include "m_random.h"
 #include "am_map.h"
 #include "p_enemy.h"
+#include "p_map.h"
 #include "lprintf.h"
 
 byte *save_p;
@@ -228,6 +230,8 @@ void P_UnArchiveWorld (void)
 
   get = (short *) save_p;
 
+  P_ClearSightCache();       // sector heights are about to change
+
   // do sectors
   for (i=0, sec = sectors ; i<numsectors ; i++,sec++)
     {
@@ -314,7 +318,7 @@ void P_ThinkerToIndex(void)
   // the prev field as a placeholder, since it can be restored later.
 
   number_of_thinkers = 0;
-  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+  for (th = thinkerclasscap[th_mobj].cnext ; th != &thinkerclasscap[th_mobj] ; th=th->cnext)
     if (th->function.acp1 == (actionf_p1) P_MobjThinker)
       th->prev = (thinker_t *) ++number_of_thinkers;
   }
@@ -352,7 +356,7 @@ void P_ArchiveThinkers (void)
   CheckSaveGame(number_of_thinkers*(mobjsize+4));       // killough 2/14/98
 
   // save off the current thinkers
-  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+  for (th = thinkerclasscap[th_mobj].cnext ; th != &thinkerclasscap[th_mobj] ; th=th->cnext)
     if (th->function.acp1 == (actionf_p1) P_MobjThinker)
       {
         mobj_t *mobj;
@@ -578,34 +582,23 @@ enum {
 // T_Pusher                                                 // phares 3/22/98
 //
 
-void P_ArchiveSpecials (void)
-{
-  thinker_t *th;
-  size_t    size = 0;          // killough
-
-  // save off the current thinkers (memory size calculation -- killough)
+// Space a special thinker takes in the savegame, 0 if it isn't saved
 
-  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
-    if (th->function.acv == (actionf_v)NULL)
-      {
-        platlist_t *pl;
-        ceilinglist_t *cl;     //jff 2/22/98 need this for ceilings too now
-        for (pl=activeplats; pl; pl=pl->next)
-          if (pl->plat == (plat_t *) th)   // killough 2/14/98
-            {
-              size += 4+sizeof(plat_t);
-              goto end;
-            }
-        for (cl=activeceilings; cl; cl=cl->next) // search for activeceiling
-          if (cl->ceiling == (ceiling_t *) th)   //jff 2/22/98
-            {
-              size += 4+sizeof(ceiling_t);
-              goto end;
-            }
-      end:;
-      }
-    else
-      size +=
+static size_t P_SpecialSize(thinker_t *th)
+{
+  if (th->function.acv == (actionf_v)NULL)
+    {
+      platlist_t *pl;
+      ceilinglist_t *cl;     //jff 2/22/98 need this for ceilings too now
+      for (pl=activeplats; pl; pl=pl->next)
+        if (pl->plat == (plat_t *) th)   // killough 2/14/98
+          return 4+sizeof(plat_t);
+      for (cl=activeceilings; cl; cl=cl->next) // search for activeceiling
+        if (cl->ceiling == (ceiling_t *) th)   //jff 2/22/98
+          return 4+sizeof(ceiling_t);
+      return 0;
+    }
+  return
         th->function.acp1==(actionf_p1)T_MoveCeiling  ? 4+sizeof(ceiling_t) :
         th->function.acp1==(actionf_p1)T_VerticalDoor ? 4+sizeof(vldoor_t)  :
         th->function.acp1==(actionf_p1)T_MoveFloor    ? 4+sizeof(floormove_t):
@@ -620,6 +613,17 @@ void P_ArchiveSpecials (void)
         th->function.acp1==(actionf_p1)T_Friction     ? 4+sizeof(friction_t):
         th->function.acp1==(actionf_p1)T_Pusher       ? 4+sizeof(pusher_t)  :
       0;
+}
+
+void P_ArchiveSpecials (void)
+{
+  thinker_t *th;
+  size_t    size = 0;          // killough
+
+  // save off the current thinkers (memory size calculation -- killough)
+
+  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    size += P_SpecialSize(th);
 
   CheckSaveGame(size);          // killough
 
@@ -972,6 +976,330 @@ void P_UnArchiveSpecials (void)
       }
 }
 
+//
+// P_ArchiveThingLinks
+//
+// The order of things in each sector and blockmap cell, which decides
+// the order they are found in, and so the order of P_Random calls, by
+// the playsim. A loaded game relinks them backwards, which is fine for
+// a savegame but not for a demo snapshot (see G_DemoSeek). Also saves
+// who last hurt each player, and the sector nodes of P_CreateSecNodeList,
+// which loading makes again but in spawning order. The order of each
+// sector's touching_thinglist decides the order P_CheckSector crushes
+// and moves things in. Must be called while P_ThinkerToIndex's indices
+// are in place.
+//
+
+void P_ArchiveThingLinks(void)
+{
+  int        *p, i, numsecnodes = 0;
+  mobj_t     *mo;
+  thinker_t  *th;
+  msecnode_t *n;
+
+  for (i=0; i<numsectors; i++)
+    for (n = sectors[i].touching_thinglist; n; n = n->m_snext)
+      numsecnodes++;
+
+  // Each thing is linked at most once each way, with a terminator for
+  // every sector and blockmap cell used; each sector node is saved once
+  // for its sector and once for its thing
+  CheckSaveGame((2*numsectors + 6*number_of_thinkers + MAXPLAYERS + 3 +
+		 2*numsecnodes) * sizeof(int));
+  PADSAVEP();
+  p = (int *) save_p;
+
+  for (i=0; i<numsectors; i++)
+    {
+      for (mo = sectors[i].thinglist; mo; mo = mo->snext)
+        *p++ = (size_t) mo->thinker.prev;
+      *p++ = 0;
+    }
+
+  for (i=0; i<bmapwidth*bmapheight; i++)
+    if ((mo = blocklinks[i]))
+      {
+        *p++ = i+1;
+        for (; mo; mo = mo->bnext)
+          *p++ = (size_t) mo->thinker.prev;
+        *p++ = 0;
+      }
+  *p++ = 0;
+
+  for (i=0; i<MAXPLAYERS; i++)
+    if (playeringame[i])
+      *p++ = (mo = players[i].attacker) &&
+        mo->thinker.function.acp1 == (actionf_p1) P_MobjThinker ?
+        (size_t) mo->thinker.prev : 0;
+
+  // Sector nodes, as each sector's list of things, then each thing's
+  // list of sectors
+  for (i=0; i<numsectors; i++)
+    {
+      for (n = sectors[i].touching_thinglist; n; n = n->m_snext)
+        *p++ = (size_t) n->m_thing->thinker.prev;
+      *p++ = 0;
+    }
+
+  for (th = thinkerclasscap[th_mobj].cnext; th != &thinkerclasscap[th_mobj];
+       th = th->cnext)
+    if ((n = ((mobj_t *) th)->touching_sectorlist))
+      {
+        *p++ = (size_t) th->prev;
+        for (; n; n = n->m_tnext)
+          *p++ = n->m_sector - sectors + 1;
+        *p++ = 0;
+      }
+  *p++ = 0;
+
+  save_p = (byte *) p;
+}
+
+// Table of the loaded things by their saved index, with NULL for 0. Only
+// valid while the th_mobj class list holds just the loaded things, in the
+// order they were numbered.
+static mobj_t **P_LoadedMobjs(void)
+{
+  mobj_t    **mobj_p;
+  thinker_t *th;
+  size_t    n = 1;
+
+  for (th = thinkerclasscap[th_mobj].cnext; th != &thinkerclasscap[th_mobj];
+       th = th->cnext)
+    n++;
+  *(mobj_p = malloc(n * sizeof *mobj_p)) = NULL;
+  for (n = 1, th = thinkerclasscap[th_mobj].cnext;
+       th != &thinkerclasscap[th_mobj]; th = th->cnext)
+    mobj_p[n++] = (mobj_t *) th;
+  return mobj_p;
+}
+
+//
+// P_UnArchiveThingLinks
+//
+// Called straight after P_UnArchiveThinkers, while the th_mobj class list
+// holds just the loaded things, in the order they were numbered.
+//
+
+void P_UnArchiveThingLinks(void)
+{
+  mobj_t    **mobj_p = P_LoadedMobjs(), *mo, **link;
+  thinker_t *th;
+  msecnode_t *node, *prev;
+  int       *p, i;
+
+  PADSAVEP();
+  p = (int *) save_p;
+
+  for (i=0; i<numsectors; i++)
+    {
+      for (link = &sectors[i].thinglist, mo = NULL; *p; p++)
+        {
+          mobj_p[*p]->sprev = mo;
+          *link = mo = mobj_p[*p];
+          link = &mo->snext;
+        }
+      *link = NULL;
+      p++;
+    }
+
+  memset(blocklinks, 0, bmapwidth*bmapheight*sizeof(*blocklinks));
+  while ((i = *p++))
+    {
+      for (link = &blocklinks[i-1], mo = NULL; *p; p++)
+        {
+          mobj_p[*p]->bprev = mo;
+          *link = mo = mobj_p[*p];
+          link = &mo->bnext;
+        }
+      *link = NULL;
+      p++;
+    }
+
+  for (i=0; i<MAXPLAYERS; i++)
+    if (playeringame[i])
+      players[i].attacker = mobj_p[*p++];
+
+  // Drop any sector nodes made while loading, then make the saved ones,
+  // linked in their saved order in both lists
+  for (th = thinkerclasscap[th_mobj].cnext; th != &thinkerclasscap[th_mobj];
+       th = th->cnext)
+    {
+      P_DelSeclist(((mobj_t *) th)->touching_sectorlist);
+      ((mobj_t *) th)->touching_sectorlist = NULL;
+    }
+
+  for (i=0; i<numsectors; i++)
+    {
+      for (prev = NULL; *p; p++)
+        {
+          node = P_NewSecnode(&sectors[i], mobj_p[*p]);
+          if ((node->m_sprev = prev))
+            prev->m_snext = node;
+          else
+            sectors[i].touching_thinglist = node;
+          prev = node;
+        }
+      if (prev)
+        prev->m_snext = NULL;
+      else
+        sectors[i].touching_thinglist = NULL;
+      p++;
+    }
+
+  while ((i = *p++))
+    {
+      for (mo = mobj_p[i], prev = NULL; *p; p++)
+        {
+          for (node = sectors[*p-1].touching_thinglist; node->m_thing != mo;
+               node = node->m_snext)
+            ;
+          if ((node->m_tprev = prev))
+            prev->m_tnext = node;
+          else
+            mo->touching_sectorlist = node;
+          prev = node;
+        }
+      prev->m_tnext = NULL;
+      p++;
+    }
+
+  save_p = (byte *) p;
+  free(mobj_p);
+}
+
+//
+// P_ArchiveRespawnQueues
+//
+// Saves the items waiting to respawn in deathmatch and the player corpses
+// waiting to be recycled. A loaded level starts with both empty, except
+// that removing the spawned items while loading queues every one of them,
+// so a demo snapshot has to keep the real queues. Must be called while
+// P_ThinkerToIndex's indices are in place.
+//
+
+void P_ArchiveRespawnQueues(void)
+{
+  int    *p, i, n = bodyque && bodyquesize > 0 ? bodyquesize : 0;
+  mobj_t *mo;
+
+  CheckSaveGame((ITEMQUESIZE + 4 + n) * sizeof(int) +
+		ITEMQUESIZE * sizeof *itemrespawnque + 3);
+  PADSAVEP();
+  p = (int *) save_p;
+
+  *p++ = iquehead;
+  *p++ = iquetail;
+  memcpy(p, itemrespawntime, ITEMQUESIZE * sizeof *itemrespawntime);
+  p += ITEMQUESIZE;
+
+  *p++ = bodyqueslot;
+  *p++ = n;
+  for (i=0; i<n; i++)
+    *p++ = (mo = bodyque[i]) &&
+      mo->thinker.function.acp1 == (actionf_p1) P_MobjThinker ?
+      (size_t) mo->thinker.prev : 0;
+
+  save_p = (byte *) p;
+  memcpy(save_p, itemrespawnque, ITEMQUESIZE * sizeof *itemrespawnque);
+  save_p += ITEMQUESIZE * sizeof *itemrespawnque;
+}
+
+//
+// P_UnArchiveRespawnQueues
+//
+// Called after P_UnArchiveThingLinks, while the th_mobj class list still
+// holds just the loaded things.
+//
+
+void P_UnArchiveRespawnQueues(void)
+{
+  mobj_t **mobj_p = P_LoadedMobjs();
+  int    *p, i, n;
+
+  PADSAVEP();
+  p = (int *) save_p;
+
+  iquehead = *p++;
+  iquetail = *p++;
+  memcpy(itemrespawntime, p, ITEMQUESIZE * sizeof *itemrespawntime);
+  p += ITEMQUESIZE;
+
+  bodyqueslot = *p++;
+  n = *p++;
+  if (n && bodyquesize > 0 && !bodyque)
+    bodyque = calloc(bodyquesize, sizeof *bodyque);
+  for (i=0; i<n; i++, p++)
+    if (i < bodyquesize)
+      bodyque[i] = mobj_p[*p];
+  if (bodyqueslot >= bodyquesize)
+    bodyqueslot = 0;
+
+  save_p = (byte *) p;
+  memcpy(itemrespawnque, save_p, ITEMQUESIZE * sizeof *itemrespawnque);
+  save_p += ITEMQUESIZE * sizeof *itemrespawnque;
+  free(mobj_p);
+}
+
+//
+// P_ArchiveThinkerOrder
+//
+// Loading puts the specials after all the things in the thinker list, but
+// some of both call P_Random when they run, so for a demo snapshot the
+// order they run in has to be kept too. Saves the class of each saved
+// thinker, in the order they are in the thinker list.
+//
+
+void P_ArchiveThinkerOrder(void)
+{
+  thinker_t *th;
+  size_t    n = 1;
+
+  for (th = thinkercap.next; th != &thinkercap; th = th->next)
+    n++;
+  CheckSaveGame(n);
+
+  for (th = thinkercap.next; th != &thinkercap; th = th->next)
+    if (th->function.acp1 == (actionf_p1) P_MobjThinker)
+      *save_p++ = th_mobj;
+    else
+      if (P_SpecialSize(th))
+        *save_p++ = th_misc;
+  *save_p++ = NUMTHCLASS;
+}
+
+//
+// P_UnArchiveThinkerOrder
+//
+// Relinks the loaded thinkers in their saved order. Each class list is
+// already in order, so this just merges the two.
+//
+
+void P_UnArchiveThinkerOrder(void)
+{
+  thinker_t *th, *prev = &thinkercap, *next[NUMTHCLASS];
+  int       c;
+
+  for (c=0; c<NUMTHCLASS; c++)
+    next[c] = thinkerclasscap[c].cnext;
+
+  while ((c = *save_p++) != NUMTHCLASS)
+    {
+      if (c > NUMTHCLASS || next[c] == &thinkerclasscap[c])
+        I_Error("P_UnArchiveThinkerOrder: Bad thinker order");
+      th = next[c];
+      next[c] = th->cnext;
+      (th->prev = prev)->next = th;
+      prev = th;
+    }
+
+  for (c=0; c<NUMTHCLASS; c++)
+    if (next[c] != &thinkerclasscap[c])
+      I_Error("P_UnArchiveThinkerOrder: Bad thinker order");
+
+  (thinkercap.prev = prev)->next = &thinkercap;
+}
+
 // killough 2/16/98: save/restore random number generator state information
 // CPhipps - fixed compatibility with Boom v2.02
 
@@ -57,6 +57,15 @@ void P_UnArchiveRNG(void);
 void P_ArchiveMap(void);
 void P_UnArchiveMap(void);
 
+/* The order of things in their sector and blockmap links, and of all
+ * thinkers, which a savegame doesn't keep but demo snapshots need */
+void P_ArchiveThingLinks(void);
+void P_UnArchiveThingLinks(void);
+void P_ArchiveRespawnQueues(void);
+void P_UnArchiveRespawnQueues(void);
+void P_ArchiveThinkerOrder(void);
+void P_UnArchiveThinkerOrder(void);
+
 extern byte *save_p;
 void CheckSaveGame(size_t);              /* killough */
 
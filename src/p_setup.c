@@ -49,6 +49,7 @@ rcsid[] = "$Id: p_setup.c,v 1.14 1999/11/04 12:33:38 cphipps Exp $";
 #include "p_tick.h"
 #include "p_enemy.h"
 #include "s_sound.h"
+#include "m_cache.h"
 #include "lprintf.h" //jff 10/6/98 for debug outputs
 
 //
@@ -611,6 +612,40 @@ void P_CreateBlockMap()
   int map_miny=INT_MAX;
   int map_maxx=INT_MIN;
   int map_maxy=INT_MIN;
+  cachekey_t key;
+  size_t len;
+  const long *cached;
+
+  // Check the cache first, for a blockmap built from the same lines
+  M_CacheKeyInit(&key, "BLOCKMAP");
+  i = sizeof *blockmaplump;
+  M_CacheKeyData(&key, &i, sizeof i);
+  i = blkshift;
+  M_CacheKeyData(&key, &i, sizeof i);
+  for (i=0;i<numlines;i++)
+  {
+    M_CacheKeyData(&key, &lines[i].v1->x, sizeof lines[i].v1->x);
+    M_CacheKeyData(&key, &lines[i].v1->y, sizeof lines[i].v1->y);
+    M_CacheKeyData(&key, &lines[i].v2->x, sizeof lines[i].v2->x);
+    M_CacheKeyData(&key, &lines[i].v2->y, sizeof lines[i].v2->y);
+  }
+  for (i=0;i<numvertexes;i++) // the map limits come from all the vertexes
+  {
+    M_CacheKeyData(&key, &vertexes[i].x, sizeof vertexes[i].x);
+    M_CacheKeyData(&key, &vertexes[i].y, sizeof vertexes[i].y);
+  }
+
+  if ((cached = M_CacheLoad(key, &len)) && len >= 4*sizeof *cached)
+  {
+    blockmaplump = Z_Malloc(len, PU_LEVEL, 0);
+    memcpy(blockmaplump, cached, len);
+    M_CacheRelease(cached);
+    bmaporgx = blockmaplump[0];
+    bmaporgy = blockmaplump[1];
+    bmapwidth = blockmaplump[2];
+    bmapheight = blockmaplump[3];
+    return;
+  }
 
   // scan for map limits, which the blockmap must enclose
 
@@ -854,6 +889,9 @@ void P_CreateBlockMap()
   free (blocklists);
   free (blockcount);
   free (blockdone);
+
+  M_CacheStore(key, blockmaplump,
+               sizeof(*blockmaplump) * (4+NBlocks+linetotal));
 }
 
 // jff 10/6/98
@@ -1103,6 +1141,7 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
   }
 
   P_InitThinkers();
+  P_ClearSightCache();
 
   // if working with a devlopment map, reload it
   //    W_Reload ();     killough 1/31/98: W_Reload obsolete
@@ -1128,6 +1167,9 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
   P_LoadSideDefs  (lumpnum+ML_SIDEDEFS);             // killough 4/4/98
   P_LoadLineDefs  (lumpnum+ML_LINEDEFS);             //       |
   P_LoadSideDefs2 (lumpnum+ML_SIDEDEFS);             //       |
+  R_ReleaseCachedTextures();                         // ones not used here
+  if (precache)
+    R_StartComposites();                             // textures are known now
   P_LoadLineDefs2 (lumpnum+ML_LINEDEFS);             // killough 4/4/98
   P_LoadBlockMap  (lumpnum+ML_BLOCKMAP);             // killough 3/1/98
   P_LoadSubsectors(lumpnum+ML_SSECTORS);
@@ -1174,6 +1216,7 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
   P_SpawnSpecials();
 
   // preload graphics
+  R_FinishComposites();
   if (precache)
     R_PrecacheLevel();
 }
@@ -54,6 +54,41 @@ typedef struct {
 
 static los_t los; // cph - made static
 
+//
+// Sight check cache
+//
+// Slaughter maps have thousands of monsters checking sight every tic, and
+// most of them, and often the player, haven't moved since the last check.
+// So results of the BSP traversal are remembered, in slots picked by the
+// pair of subsectors and the height bands of the two things. A result is
+// only reused if the positions and heights match exactly, so it's always
+// what P_CrossBSPNode would have returned and demos stay in sync. Moving
+// a floor or ceiling can change any result, so that empties the cache.
+//
+
+#define SIGHTCACHE_SIZE 4096     // power of 2
+#define SIGHT_ZBANDSHIFT (FRACBITS+6)
+
+typedef struct {
+  fixed_t x1, y1, z1, h1;        // looker
+  fixed_t x2, y2, z2, h2;        // target
+  unsigned generation;           // entry valid if equal to sightgeneration
+  boolean visible;
+} sightcache_t;
+
+static sightcache_t sightcache[SIGHTCACHE_SIZE];
+static unsigned sightgeneration = 1;
+
+unsigned sight_checks, sight_cachehits; // BSP checks asked for, and avoided
+
+void P_ClearSightCache(void)
+{
+  if (!++sightgeneration) { // wrapped, so old entries could look valid
+    memset(sightcache, 0, sizeof sightcache);
+    sightgeneration = 1;
+  }
+}
+
 //
 // P_DivlineSide
 // Returns side 0 (front), 1 (back), or 2 (on).
@@ -290,8 +325,31 @@ boolean P_CheckSight(mobj_t *t1, mobj_t *t2)
     los.maxz = t2->z + t2->height; los.minz = t2->z;
   }
 
-  // the head node is the last node output
-  return P_CrossBSPNode(numnodes-1);
+  {
+    sightcache_t *sc = &sightcache[((t1->subsector - subsectors) * 977 +
+                                    (t2->subsector - subsectors) * 31 +
+                                    (t1->z >> SIGHT_ZBANDSHIFT) * 7 +
+                                    (t2->z >> SIGHT_ZBANDSHIFT) +
+                                    ((t1->x ^ t1->y ^ t2->x ^ t2->y) >> 
+                                     FRACBITS)) & (SIGHTCACHE_SIZE-1)];
+
+    sight_checks++;
+    if (sc->generation == sightgeneration &&
+        sc->x1 == t1->x && sc->y1 == t1->y && sc->z1 == t1->z &&
+        sc->h1 == t1->height &&
+        sc->x2 == t2->x && sc->y2 == t2->y && sc->z2 == t2->z &&
+        sc->h2 == t2->height) {
+      sight_cachehits++;
+      return sc->visible;
+    }
+
+    sc->x1 = t1->x; sc->y1 = t1->y; sc->z1 = t1->z; sc->h1 = t1->height;
+    sc->x2 = t2->x; sc->y2 = t2->y; sc->z2 = t2->z; sc->h2 = t2->height;
+    sc->generation = sightgeneration;
+
+    // the head node is the last node output
+    return sc->visible = P_CrossBSPNode(numnodes-1);
+  }
 }
 
 //----------------------------------------------------------------------------
@@ -63,7 +63,8 @@ int EV_Teleport(line_t *line, int side, mobj_t *thing)
   // P_FindSectorFromLineTag instead of simple linear search.
 
   for (i = -1; (i = P_FindSectorFromLineTag(line, i)) >= 0;)
-    for (thinker=thinkercap.next; thinker!=&thinkercap; thinker=thinker->next)
+    for (thinker=thinkerclasscap[th_mobj].cnext; thinker!=&thinkerclasscap[th_mobj];
+	 thinker=thinker->cnext)
       if (thinker->function.acp1 == (actionf_p1) P_MobjThinker &&
           (m = (mobj_t *) thinker)->type == MT_TELEPORTMAN  &&
             m->subsector->sector-sectors == i)
@@ -125,7 +126,7 @@ int EV_SilentTeleport(line_t *line, int side, mobj_t *thing)
     return 0;
 
   for (i = -1; (i = P_FindSectorFromLineTag(line, i)) >= 0;)
-    for (th = thinkercap.next; th != &thinkercap; th = th->next)
+    for (th = thinkerclasscap[th_mobj].cnext; th != &thinkerclasscap[th_mobj]; th = th->cnext)
       if (th->function.acp1 == (actionf_p1) P_MobjThinker &&
           (m = (mobj_t *) th)->type == MT_TELEPORTMAN  &&
           m->subsector->sector-sectors == i)
@@ -50,6 +50,9 @@ int leveltime;
 // Both the head and tail of the thinker list.
 thinker_t thinkercap;
 
+// Heads and tails of the per class lists
+thinker_t thinkerclasscap[NUMTHCLASS];
+
 // Make currentthinker external, so that P_RemoveThinkerDelayed
 // can adjust currentthinker when thinkers self-remove.
 
@@ -61,20 +64,33 @@ static thinker_t *currentthinker;
 
 void P_InitThinkers(void)
 {
+  int i;
+
   thinkercap.prev = thinkercap.next  = &thinkercap;
+  for (i=0; i<NUMTHCLASS; i++)
+    thinkerclasscap[i].cprev = thinkerclasscap[i].cnext = &thinkerclasscap[i];
 }
 
 //
 // P_AddThinker
-// Adds a new thinker at the end of the list.
+// Adds a new thinker at the end of the list, and of its class list.
+// Mobjs must have their function set before they are added.
 //
 
 void P_AddThinker(thinker_t* thinker)
 {
+  thinker_t *cap = &thinkerclasscap[
+    thinker->function.acp1 == (actionf_p1) P_MobjThinker ? th_mobj : th_misc];
+
   thinkercap.prev->next = thinker;
   thinker->next = &thinkercap;
   thinker->prev = thinkercap.prev;
   thinkercap.prev = thinker;
+
+  cap->cprev->cnext = thinker;
+  thinker->cnext = cap;
+  thinker->cprev = cap->cprev;
+  cap->cprev = thinker;
 }
 
 //
@@ -112,6 +128,7 @@ static void P_RemoveThinkerDelayed(thinker_t *thinker)
 {
   thinker_t *next = thinker->next;
   (next->prev = currentthinker = thinker->prev)->next = next;
+  (thinker->cnext->cprev = thinker->cprev)->cnext = thinker->cnext;
   Z_Free(thinker);
 }
 
@@ -165,14 +182,25 @@ void P_RemoveThinker(thinker_t *thinker)
 // Rewritten to delete nodes implicitly, by making currentthinker
 // external and using P_RemoveThinkerDelayed() implicitly.
 //
+// The main list is still the one run, as the order thinkers run in
+// decides the order of P_Random calls and has to be kept for demo sync.
+// Mobjs, nearly all of the list on big maps, are called directly, and
+// the thinker after next is fetched while this one runs.
+//
 
 static void P_RunThinkers (void)
 {
   for (currentthinker = thinkercap.next;
        currentthinker != &thinkercap;
-       currentthinker = currentthinker->next)
-    if (currentthinker->function.acp1)
+       currentthinker = currentthinker->next) {
+#ifdef __GNUC__
+    __builtin_prefetch(currentthinker->next->next);
+#endif
+    if (currentthinker->function.acp1 == (actionf_p1) P_MobjThinker)
+      P_MobjThinker((mobj_t *) currentthinker);
+    else if (currentthinker->function.acp1)
       currentthinker->function.acp1(currentthinker);
+  }
 }
 
 //
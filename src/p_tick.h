@@ -44,6 +44,18 @@ void P_Ticker(void);
 
 extern thinker_t thinkercap;  /* Both the head and tail of the thinker list */
 
+/* Thinkers are also kept in a list per class, linked through cnext/cprev,
+ * in the same relative order as in the main list. A thinker's class is
+ * decided when it is added; mobjs stay in th_mobj after being removed
+ * until they are freed, so users should still check function.acp1 */
+typedef enum {
+  th_mobj,
+  th_misc,
+  NUMTHCLASS
+} thclass_t;
+
+extern thinker_t thinkerclasscap[NUMTHCLASS];
+
 void P_InitThinkers(void);
 void P_AddThinker(thinker_t *thinker);
 void P_RemoveThinker(thinker_t *thinker);
@@ -26,10 +26,18 @@
  *  Doom Network protocol packet definitions.
  *-----------------------------------------------------------------------------*/
 
+#include <string.h>
+
 #include "doomtype.h"
 #include "d_ticcmd.h"
 #include "m_swap.h"
 
+/* Bumped whenever the layout of any packet changes. Clients send it in
+ * PKT_INIT and servers after the wad names in PKT_SETUP, and each side
+ * refuses a peer with a different one. Version 1 was the original
+ * protocol, which sent no version at all. */
+#define PROTOCOL_VERSION 2
+
 enum packet_type_e { 
   PKT_INIT,    // initial packet to server
   PKT_SETUP,   // game information packet
@@ -41,12 +49,14 @@ enum packet_type_e {
   PKT_QUIT,    // Player quit game
   PKT_DOWN,    // Server downed
   PKT_WAD,     // Wad file request
+  PKT_HASH,    // Playsim state hashes from a client
 };
 
 typedef struct {
   byte checksum;       // Simple checksum of the entire packet
   enum packet_type_e type; // Type of packet
   unsigned tic;        // Timestamp
+  unsigned short session; // Game on the server, network byte order
 } packet_header_t;
 
 #ifndef GAME_OPTIONS_SIZE
@@ -54,11 +64,56 @@ typedef struct {
 #define GAME_OPTIONS_SIZE 64
 #endif
 
+/* How ticcmds are packed into PKT_TICC and PKT_TICS packets. The client
+ * says which it understands in PKT_INIT, and the server picks one for it
+ * in PKT_SETUP.
+ *
+ * TICENC_RAW: each tic is a player count, then for each player the player
+ *  number and the whole ticcmd_t.
+ * TICENC_DELTA: each ticcmd is a byte holding the player number and a
+ *  mask of the fields that differ from that player's ticcmd in the previous
+ *  tic of the same packet (all zero for the first), then just those fields.
+ *  In PKT_TICS a tic's player count byte can instead be TICS_REPEAT|(n-1),
+ *  meaning the previous tic happened again n times. PKT_TICC carries only
+ *  the sender's ticcmds, so has no player counts.
+ */
+enum { TICENC_RAW, TICENC_DELTA };
+
+#define TICS_REPEAT 0x80
+#define TICS_MAXREPEAT 0x80
+
+#define TICD_PLAYER      0x03  /* Player number, MAXPLAYERS is 4 */
+#define TICD_FORWARDMOVE 0x04
+#define TICD_SIDEMOVE    0x08
+#define TICD_ANGLETURN   0x10
+#define TICD_CONSISTANCY 0x20
+#define TICD_CHATCHAR    0x40
+#define TICD_BUTTONS     0x80
+
+// Worst case space for one player's ticcmd, either encoding
+#define MAXTICBYTES (1 + sizeof(ticcmd_t))
+
+// Keep tic packets small enough not to be fragmented
+#define MAXTICPACKET 1400
+
+/* PKT_HASH: the sending player's number, a count, then that many 32 bit
+ * P_StateHash values in network byte order, for consecutive tics from the
+ * header's tic on. The server passes them on to every player. */
+#define HASHBATCH 8  // Tics of hashes in each PKT_HASH
+
+struct init_packet_s {
+  short port;
+  char myaddr[200];
+  byte ticencodings;   // 1<<TICENC_* for each one the client understands
+  byte version;        // PROTOCOL_VERSION
+};
+
 struct setup_packet_s {
   byte players, yourplayer, skill, episode, level, deathmatch, complevel, ticdup, extratic;
   byte game_options[GAME_OPTIONS_SIZE];
   byte numwads;
-  byte wadnames[1]; // Actually longer
+  byte wadnames[1]; // Actually longer, then a byte of PROTOCOL_VERSION
+                    // and the TICENC_* to use for this client
 };
 
 static inline void GetTicSwap(ticcmd_t* dst, const ticcmd_t* src)
@@ -68,6 +123,72 @@ static inline void GetTicSwap(ticcmd_t* dst, const ticcmd_t* src)
   dst->consistancy = doom_ntohs(dst->consistancy);
 }
 
+/* Writes cmd for player n as a TICENC_DELTA entry against last. The
+ * shorts are copied as they are, so byte order is up to the caller, as
+ * with TICENC_RAW */
+static inline byte* WriteTicDelta(byte* p, int n, const ticcmd_t* cmd, const ticcmd_t* last)
+{
+  byte *mask = p++;
+
+  *mask = n & TICD_PLAYER;
+  if (cmd->forwardmove != last->forwardmove) {
+    *mask |= TICD_FORWARDMOVE; *p++ = cmd->forwardmove;
+  }
+  if (cmd->sidemove != last->sidemove) {
+    *mask |= TICD_SIDEMOVE; *p++ = cmd->sidemove;
+  }
+  if (cmd->angleturn != last->angleturn) {
+    *mask |= TICD_ANGLETURN; memcpy(p, &cmd->angleturn, 2); p += 2;
+  }
+  if (cmd->consistancy != last->consistancy) {
+    *mask |= TICD_CONSISTANCY; memcpy(p, &cmd->consistancy, 2); p += 2;
+  }
+  if (cmd->chatchar != last->chatchar) {
+    *mask |= TICD_CHATCHAR; *p++ = cmd->chatchar;
+  }
+  if (cmd->buttons != last->buttons) {
+    *mask |= TICD_BUTTONS; *p++ = cmd->buttons;
+  }
+  return p;
+}
+
+/* Reads a TICENC_DELTA entry. cmds holds each player's previous ticcmd,
+ * and the one read is updated. Returns NULL if the entry runs past end */
+static inline const byte* ReadTicDelta(const byte* p, const byte* end, int* n, ticcmd_t cmds[])
+{
+  byte mask;
+  ticcmd_t *cmd;
+
+  if (p >= end) return NULL;
+  mask = *p++;
+  cmd = &cmds[*n = mask & TICD_PLAYER];
+  if (mask & TICD_FORWARDMOVE) {
+    if (p+1 > end) return NULL;
+    cmd->forwardmove = *p++;
+  }
+  if (mask & TICD_SIDEMOVE) {
+    if (p+1 > end) return NULL;
+    cmd->sidemove = *p++;
+  }
+  if (mask & TICD_ANGLETURN) {
+    if (p+2 > end) return NULL;
+    memcpy(&cmd->angleturn, p, 2); p += 2;
+  }
+  if (mask & TICD_CONSISTANCY) {
+    if (p+2 > end) return NULL;
+    memcpy(&cmd->consistancy, p, 2); p += 2;
+  }
+  if (mask & TICD_CHATCHAR) {
+    if (p+1 > end) return NULL;
+    cmd->chatchar = *p++;
+  }
+  if (mask & TICD_BUTTONS) {
+    if (p+1 > end) return NULL;
+    cmd->buttons = *p++;
+  }
+  return p;
+}
+
 /*
  * $Log: protocol.h,v $
  * Revision 1.3  1999/10/12 13:01:15  cphipps
@@ -69,7 +69,13 @@ void R_ClearDrawSegs(void)
 // Instead of clipsegs, let's try using an array with one entry for each column, 
 // indicating whether it's blocked by a solid wall yet or not.
 
-byte solidcol[MAX_SCREENWIDTH];
+byte *solidcol;  // SCREENWIDTH entries
+
+// The drawseg of the solid wall which closed each column, so that
+// R_ProjectSprite can cull things hidden behind it. -1 if the column is
+// open, or was closed by R_RenderSegLoop instead.
+
+int *solidseg;   // SCREENWIDTH entries
 
 // CPhipps - 
 // R_ClipWallSegment
@@ -90,7 +96,10 @@ void R_ClipWallSegment(int first, int last, boolean solid)
       else to = p - solidcol;
       R_StoreWallRange(first, to-1);
       if (solid) {
+	int ds = ds_p - drawsegs - 1, x;
 	memset(solidcol+first,1,to-first);
+	for (x=first; x<to; x++)
+	  solidseg[x] = ds;
       } /*else do {
 	if (floorclip[first] <= ceilingclip[first] + 1)
 	  solidcol[first] = 1;
@@ -106,7 +115,15 @@ void R_ClipWallSegment(int first, int last, boolean solid)
 
 void R_ClearClipSegs (void)
 {
+  int i;
+
+  if (!solidcol) {
+    solidcol = Z_Malloc(SCREENWIDTH, PU_STATIC, 0);
+    solidseg = Z_Malloc(SCREENWIDTH * sizeof *solidseg, PU_STATIC, 0);
+  }
   memset(solidcol, 0, SCREENWIDTH);
+  for (i=0; i<SCREENWIDTH; i++)
+    solidseg[i] = -1;
 }
 
 // killough 1/18/98 -- This function is used to fix the automap bug which
@@ -55,6 +55,9 @@ extern unsigned maxdrawsegs;
 
 extern drawseg_t *ds_p;
 
+extern byte *solidcol;   /* Columns closed by walls drawn so far */
+extern int *solidseg;    /* The drawseg which closed each, or -1 */
+
 void R_ClearClipSegs(void);
 void R_ClearDrawSegs(void);
 void R_RenderBSPNode(int bspnum);
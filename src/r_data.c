@@ -33,10 +33,15 @@
 static const char
 rcsid[] = "$Id: r_data.c,v 1.13 2000/01/25 22:40:45 cphipps Exp $";
 
+#include <pthread.h>
+
 #include "doomstat.h"
 #include "w_wad.h"
 #include "r_main.h"
 #include "r_sky.h"
+#include "r_draw.h"
+#include "m_cache.h"
+#include "p_tick.h"
 #include "lprintf.h"  // jff 08/03/98 - declaration of lprintf
 
 //
@@ -138,6 +143,28 @@ fixed_t   *spritewidth, *spriteoffset, *spritetopoffset;
 //  will have new column_ts generated.
 //
 
+//
+// R_TextureKey
+// Names a texture's lookup or composite in the on-disk cache
+//
+
+static cachekey_t R_TextureKey(const texture_t *texture, const char *kind)
+{
+  cachekey_t key;
+  int i;
+
+  M_CacheKeyInit(&key, kind);
+  M_CacheKeyData(&key, &texture->width, sizeof texture->width);
+  M_CacheKeyData(&key, &texture->height, sizeof texture->height);
+  for (i=0; i<texture->patchcount; i++)
+    {
+      // The lump numbers are part of the lookup, so the key too
+      M_CacheKeyData(&key, &texture->patches[i], sizeof texture->patches[i]);
+      M_CacheKeyLump(&key, texture->patches[i].patch);
+    }
+  return key;
+}
+
 //
 // R_DrawColumnInCache
 // Clip and draw a column
@@ -179,29 +206,30 @@ void R_DrawColumnInCache(const column_t *patch, byte *cache,
 }
 
 //
-// R_GenerateComposite
+// R_CompositeTexture
 // Using the texture definition,
 //  the composite texture is created from the patches,
 //  and each column is cached.
 //
 // Rewritten by Lee Killough for performance and to fix Medusa bug
+//
+// The patches are passed in already cached, and the zone is not used, so
+// this can run on a worker thread while the main thread loads the level.
 
-void R_GenerateComposite(int texnum)
+static void R_CompositeTexture(const texture_t *texture, byte *block,
+                               const patch_t *const *realpatches)
 {
-  texture_t *texture = textures[texnum];
-  byte *block = Z_Malloc(texture->compositesize, PU_STATIC,
-                         (void **)&texture->composite);
   // Composite the columns together.
-  texpatch_t *patch = texture->patches;
-  short *collump = texture->columnlump;
-  unsigned *colofs = texture->columnofs; // killough 4/9/98: make 32-bit
+  const texpatch_t *patch = texture->patches;
+  const short *collump = texture->columnlump;
+  const unsigned *colofs = texture->columnofs; // killough 4/9/98: make 32-bit
   int i = texture->patchcount;
   // killough 4/9/98: marks to identify transparent regions in merged textures
-  byte *marks = calloc(texture->width, texture->height), *source;
+  byte *marks = (calloc)(texture->width, texture->height), *source;
 
   for (; --i >=0; patch++)
     {
-      const patch_t *realpatch = W_CacheLumpNum(patch->patch); // cph
+      const patch_t *realpatch = *realpatches++;
       int x1 = patch->originx, x2 = x1 + SHORT(realpatch->width);
       const int *cofs = realpatch->columnofs-x1;
       if (x1<0)
@@ -214,14 +242,12 @@ void R_GenerateComposite(int texnum)
           R_DrawColumnInCache((column_t*)((byte*)realpatch+LONG(cofs[x1])),
                               block+colofs[x1],patch->originy,texture->height,
                               marks + x1 * texture->height);
-
-      W_UnlockLumpNum(patch->patch); // cph - unlock the patch lump
     }
 
   // killough 4/9/98: Next, convert multipatched columns into true columns,
   // to fix Medusa bug while still allowing for transparent regions.
 
-  source = malloc(texture->height);       // temporary column
+  source = (malloc)(texture->height);     // temporary column
   for (i=0; i < texture->width; i++)
     if (collump[i] == -1)                 // process only multipatched columns
       {
@@ -249,8 +275,43 @@ void R_GenerateComposite(int texnum)
             col = (column_t *)((byte *) col + col->length + 4); // next post
           }
       }
-  free(source);         // free temporary column
-  free(marks);          // free transparency marks
+  (free)(source);       // free temporary column
+  (free)(marks);        // free transparency marks
+}
+
+//
+// R_GenerateComposite
+// Builds a composite texture when it is first needed
+//
+
+void R_GenerateComposite(int texnum)
+{
+  texture_t *texture = textures[texnum];
+  cachekey_t key = R_TextureKey(texture, "COMPOSITE");
+  byte *block;
+  const patch_t **realpatches;
+  size_t len;
+  int i;
+
+  if ((block = (byte *)M_CacheLoad(key, &len)) &&
+      len == texture->compositesize)
+    {
+      texture->composite = block;   // never purged, it's not in the zone
+      return;
+    }
+
+  block = Z_Malloc(texture->compositesize, PU_STATIC,
+                   (void **)&texture->composite);
+  realpatches = malloc(texture->patchcount * sizeof *realpatches);
+  for (i=0; i<texture->patchcount; i++)
+    realpatches[i] = W_CacheLumpNum(texture->patches[i].patch); // cph
+
+  R_CompositeTexture(texture, block, realpatches);
+
+  for (i=0; i<texture->patchcount; i++)
+    W_UnlockLumpNum(texture->patches[i].patch); // cph - unlock the patch lump
+  free(realpatches);
+  M_CacheStore(key, block, texture->compositesize);
 
   // Now that the texture has been built in column cache,
   // it is purgable from zone memory.
@@ -258,6 +319,188 @@ void R_GenerateComposite(int texnum)
   Z_ChangeTag(block, PU_CACHE);
 }
 
+//
+// Composite precaching
+//
+// Building composites the first time a texture is drawn causes stalls in
+// the first frames of a level. So R_StartComposites builds every one the
+// level needs on worker threads, as soon as the sidedefs are loaded, and
+// P_SetupLevel waits for them in R_FinishComposites before play begins.
+// The main thread does all the zone and lump handling, the workers only
+// fill in the blocks.
+//
+
+#define MAXCOMPOSITETHREADS 16
+
+static void R_GenerateLookup(int texnum, int *const errors);
+
+static int *compositejobs;                 // texture numbers to build
+static int numcompositejobs, nextcompositejob;
+static const patch_t **compositepatches;   // cached patches for each job
+static int *compositefirstpatch;           // job's first entry in the above
+static pthread_mutex_t compositelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t compositethreads[MAXCOMPOSITETHREADS];
+static int numcompositethreads;
+
+static void *R_CompositeThread(void *unused)
+{
+  for (;;) {
+    int job;
+
+    pthread_mutex_lock(&compositelock);
+    job = nextcompositejob++;
+    pthread_mutex_unlock(&compositelock);
+
+    if (job >= numcompositejobs)
+      return NULL;
+    R_CompositeTexture(textures[compositejobs[job]],
+                       textures[compositejobs[job]]->composite,
+                       compositepatches + compositefirstpatch[job]);
+  }
+}
+
+void R_StartComposites(void)
+{
+  byte *hitlist;
+  int i, numpatches = 0;
+
+  if (demoplayback || compositejobs)
+    return;
+
+  hitlist = calloc(numtextures, 1);
+  for (i = numsides; --i >= 0;)
+    hitlist[sides[i].bottomtexture] =
+      hitlist[sides[i].toptexture] =
+      hitlist[sides[i].midtexture] = 1;
+  hitlist[skytexture] = 1;
+
+  compositejobs = malloc(numtextures * sizeof *compositejobs);
+  compositefirstpatch = malloc(numtextures * sizeof *compositefirstpatch);
+  numcompositejobs = nextcompositejob = 0;
+
+  for (i = 0; i < numtextures; i++)
+    if (hitlist[i] && !textures[i]->composite)
+      {
+        texture_t *texture = textures[i];
+        int x;
+
+        if (!texture->columnlump)
+          R_GenerateLookup(i, NULL);
+
+        // Only textures with multipatched columns need a composite
+        for (x = 0; x < texture->width && texture->columnlump[x] != -1; x++)
+          ;
+        if (x == texture->width)
+          continue;
+
+        {
+          size_t len;
+          const byte *cached =
+            M_CacheLoad(R_TextureKey(texture, "COMPOSITE"), &len);
+
+          if (cached && len == texture->compositesize)
+            {
+              texture->composite = (byte *)cached;
+              continue;
+            }
+        }
+
+        // Owned by the precache until it is finished, so not purgable
+        Z_Malloc(texture->compositesize, PU_STATIC,
+                 (void **)&texture->composite);
+        compositefirstpatch[numcompositejobs] = numpatches;
+        compositejobs[numcompositejobs++] = i;
+        numpatches += texture->patchcount;
+      }
+  free(hitlist);
+
+  compositepatches = malloc((numpatches ? numpatches : 1) *
+                            sizeof *compositepatches);
+  for (i = 0; i < numcompositejobs; i++)
+    {
+      const texture_t *texture = textures[compositejobs[i]];
+      int j;
+
+      for (j = 0; j < texture->patchcount; j++)
+        compositepatches[compositefirstpatch[i] + j] =
+          W_CacheLumpNum(texture->patches[j].patch);
+    }
+
+  // The main thread does its share in R_FinishComposites
+  numcompositethreads = 0;
+  while (numcompositethreads < render_threads - 1 &&
+         numcompositethreads < MAXCOMPOSITETHREADS &&
+         numcompositethreads < numcompositejobs &&
+         !pthread_create(&compositethreads[numcompositethreads], NULL,
+                         R_CompositeThread, NULL))
+    numcompositethreads++;
+}
+
+void R_FinishComposites(void)
+{
+  int i;
+
+  if (!compositejobs)
+    return;
+
+  R_CompositeThread(NULL);
+  while (numcompositethreads)
+    pthread_join(compositethreads[--numcompositethreads], NULL);
+
+  for (i = 0; i < numcompositejobs; i++)
+    {
+      texture_t *texture = textures[compositejobs[i]];
+      int j;
+
+      for (j = 0; j < texture->patchcount; j++)
+        W_UnlockLumpNum(texture->patches[j].patch);
+      M_CacheStore(R_TextureKey(texture, "COMPOSITE"), texture->composite,
+                   texture->compositesize);
+      Z_ChangeTag(texture->composite, PU_CACHE);
+    }
+
+  free(compositepatches);
+  free(compositefirstpatch);
+  free(compositejobs);
+  compositejobs = NULL;
+}
+
+//
+// R_ReleaseCachedTextures
+//
+// Composites and lookups loaded from the disk cache aren't in the zone,
+// so they aren't purged like built ones, and each holds a mapping. At the
+// start of a level, once the sidedefs are loaded, this unmaps those of
+// textures the level doesn't show, to be loaded again if they are drawn.
+// A lookup is only dropped once its texture has no composite, since
+// R_GenerateLookup forgets the composite.
+//
+
+void R_ReleaseCachedTextures(void)
+{
+  byte *hitlist = calloc(numtextures, 1);
+  int i;
+
+  for (i = numsides; --i >= 0;)
+    hitlist[sides[i].bottomtexture] =
+      hitlist[sides[i].toptexture] =
+      hitlist[sides[i].midtexture] = 1;
+  hitlist[skytexture] = 1;
+
+  for (i = 0; i < numtextures; i++)
+    if (!hitlist[i])
+      {
+        texture_t *texture = textures[i];
+
+        if (texture->composite && M_CacheRelease(texture->composite))
+          texture->composite = NULL;
+        if (texture->columnofs && !texture->composite &&
+            M_CacheRelease(texture->columnofs - 1))
+          texture->columnofs = NULL, texture->columnlump = NULL;
+      }
+  free(hitlist);
+}
+
 //
 // R_GenerateLookup
 //
@@ -267,21 +510,42 @@ void R_GenerateComposite(int texnum)
 static void R_GenerateLookup(int texnum, int *const errors)
 {
   texture_t *texture = textures[texnum];
-
-  // killough 4/9/98: make column offsets 32-bit;
-  // clean up malloc-ing to use sizeof
-  // CPhipps - moved allocing here
-  short *collump = texture->columnlump = 
-    Z_Malloc(texture->width*sizeof(*texture->columnlump), PU_STATIC,0);
-  unsigned *colofs = texture->columnofs = 
-    Z_Malloc(texture->width*sizeof(*texture->columnofs), PU_STATIC,0); 
+  short *collump;
+  unsigned *colofs;
+  int bad = 0;
 
   // killough 4/9/98: keep count of posts in addition to patches.
   // Part of fix for medusa bug for multipatched 2s normals.
 
   struct {
     unsigned short patches, posts;
-  } *count = calloc(sizeof *count, texture->width);
+  } *count;
+
+  // Cached as the composite size, column offsets, then column lumps
+  cachekey_t key = R_TextureKey(texture, "LOOKUP");
+  size_t len, cachesize = sizeof(unsigned) + 
+    texture->width * (sizeof *colofs + sizeof *collump);
+  const unsigned *cached = M_CacheLoad(key, &len);
+
+  // Composited texture not created yet.
+  texture->composite = NULL;
+
+  if (cached && len == cachesize)
+    {
+      texture->compositesize = cached[0];
+      texture->columnofs = (unsigned *)cached + 1;
+      texture->columnlump = (short *)(cached + 1 + texture->width);
+      return;
+    }
+
+  // killough 4/9/98: make column offsets 32-bit;
+  // clean up malloc-ing to use sizeof
+  // CPhipps - moved allocing here
+  collump = texture->columnlump = 
+    Z_Malloc(texture->width*sizeof(*texture->columnlump), PU_STATIC,0);
+  colofs = texture->columnofs = 
+    Z_Malloc(texture->width*sizeof(*texture->columnofs), PU_STATIC,0); 
+  count = calloc(sizeof *count, texture->width);
 
   {
     int i = texture->patchcount;
@@ -315,9 +579,6 @@ static void R_GenerateLookup(int texnum, int *const errors)
       }
   }
 
-  // Composited texture not created yet.
-  texture->composite = NULL;
-
   // Now count the number of columns
   //  that are covered by more than one patch.
   // Fill in the lump / offset, so columns
@@ -336,6 +597,7 @@ static void R_GenerateLookup(int texnum, int *const errors)
             lprintf(LO_WARN,
                     "\nR_GenerateLookup: Column %d is without a patch in texture %.8s",
                     x, texture->name);
+            bad = 1;
             if (errors) ++*errors;
 	    else I_Error("R_GenerateLookup failed");
           }
@@ -359,6 +621,24 @@ static void R_GenerateLookup(int texnum, int *const errors)
     texture->compositesize = csize;
   }
   free(count);                    // killough 4/9/98
+
+  if (!bad)
+    {
+      unsigned *entry = malloc(cachesize);
+
+      entry[0] = texture->compositesize;
+      memcpy(entry + 1, colofs, texture->width * sizeof *colofs);
+      memcpy(entry + 1 + texture->width, collump,
+             texture->width * sizeof *collump);
+      M_CacheStore(key, entry, cachesize);
+      free(entry);
+    }
+}
+
+// Columns in a texture less one; it repeats after that many
+unsigned R_TextureWidthMask(int tex)
+{
+  return textures[tex]->widthmask;
 }
 
 //
@@ -734,29 +1014,24 @@ void R_InitTranMap(int progress)
     {   // Compose a default transparent filter map based on PLAYPAL.
       const byte *playpal = W_CacheLumpName("PLAYPAL");
       byte       *my_tranmap;
-
-      char fname[PATH_MAX+1], *D_DoomExeDir(void);
-      struct {
-        unsigned char pct;
-        unsigned char playpal[256];
-      } cache;
-      FILE *cachefp = fopen(strcat(strcpy(fname, D_DoomExeDir()),
-                                   "/tranmap.dat"),"r+b");
-
-      main_tranmap = my_tranmap = Z_Malloc(256*256, PU_STATIC, 0);  // killough 4/11/98
+      cachekey_t key;
+      size_t     len;
 
       // Use cached translucency filter if it's available
+      // (it used to be kept in tranmap.dat, for this PLAYPAL only)
+
+      M_CacheKeyInit(&key, "TRANMAP");
+      M_CacheKeyData(&key, &tran_filter_pct, sizeof tran_filter_pct);
+      M_CacheKeyLump(&key, W_GetNumForName("PLAYPAL"));
 
-      if (!cachefp ? cachefp = fopen(fname,"wb") , 1 :
-          fread(&cache, 1, sizeof cache, cachefp) != sizeof cache ||
-          cache.pct != tran_filter_pct ||
-          memcmp(cache.playpal, playpal, sizeof cache.playpal) ||
-          fread(my_tranmap, 256, 256, cachefp) != 256 ) // killough 4/11/98
+      if (!(main_tranmap = M_CacheLoad(key, &len)) || len != 256*256)
         {
           long pal[3][256], tot[256], pal_w1[3][256];
           long w1 = ((unsigned long) tran_filter_pct<<TSC)/100;
           long w2 = (1l<<TSC)-w1;
 
+          main_tranmap = my_tranmap = Z_Malloc(256*256, PU_STATIC, 0);  // killough 4/11/98
+
 	  if (progress)
 	    lprintf(LO_INFO, "Tranmap build [        ]\x08\x08\x08\x08\x08\x08\x08\x08\x08");
 
@@ -810,20 +1085,9 @@ void R_InitTranMap(int progress)
                   }
               }
           }
-          if (cachefp)        // write out the cached translucency map
-            {
-              cache.pct = tran_filter_pct;
-              memcpy(cache.playpal, playpal, 256);
-              fseek(cachefp, 0, SEEK_SET);
-              fwrite(&cache, 1, sizeof cache, cachefp);
-              fwrite(main_tranmap, 256, 256, cachefp);
-	      // CPhipps - leave close for a few lines...
-            }
+          M_CacheStore(key, main_tranmap, 256*256);
         }
 
-      if (cachefp)              // killough 11/98: fix filehandle leak
-        fclose(cachefp);
- 
       W_UnlockLumpName("PLAYPAL");
     }
 }
@@ -965,7 +1229,7 @@ void R_PrecacheLevel(void)
 
   {
     thinker_t *th;
-    for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    for (th = thinkerclasscap[th_mobj].cnext ; th != &thinkerclasscap[th_mobj] ; th=th->cnext)
       if (th->function.acp1 == (actionf_p1)P_MobjThinker)
         hitlist[((mobj_t *)th)->sprite] = 1;
   }
@@ -48,9 +48,14 @@ R_GetColumn
   int           col );
 
 
+unsigned R_TextureWidthMask(int tex);
+
 // I/O, setting up the stuff.
 void R_InitData (void);
 void R_PrecacheLevel (void);
+void R_StartComposites (void);   // build wall texture composites in the
+void R_FinishComposites (void);  // background during level setup
+void R_ReleaseCachedTextures (void); // unmap cached data the level won't use
 
 
 // Retrieval.
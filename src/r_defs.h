@@ -404,15 +404,14 @@ typedef struct
 
 typedef struct visplane
 {
-  struct visplane *next;        // Next visplane in hash chain -- killough
   int picnum, lightlevel, minx, maxx;
   fixed_t height;
   fixed_t xoffs, yoffs;         // killough 2/28/98: Support scrolling flats
+  unsigned short *bottom;       // after top[] in the same block
   unsigned short pad1;          // leave pads for [minx-1]/[maxx+1]
-  unsigned short top[MAX_SCREENWIDTH];
-  unsigned short pad2, pad3;    // killough 2/8/98, 4/25/98
-  unsigned short bottom[MAX_SCREENWIDTH];
-  unsigned short pad4;
+  // Allocated with SCREENWIDTH columns and a pad for top, then a pad,
+  // SCREENWIDTH columns and a pad for bottom, see new_visplane
+  unsigned short top[1];
 } visplane_t;
 
 #endif
@@ -34,6 +34,8 @@
 static const char
 rcsid[] = "$Id: r_draw.c,v 1.15 1999/11/01 17:09:15 cphipps Exp $";
 
+#include <pthread.h>
+
 #include "doomstat.h"
 #include "w_wad.h"
 #include "r_main.h"
@@ -42,9 +44,8 @@ rcsid[] = "$Id: r_draw.c,v 1.15 1999/11/01 17:09:15 cphipps Exp $";
 #include "g_game.h"
 #include "am_map.h"
 #include "lprintf.h"
+#include "m_argv.h"
 
-#define MAXWIDTH  MAX_SCREENWIDTH          /* kilough 2/8/98 */
-#define MAXHEIGHT MAX_SCREENHEIGHT
 
 // CPhipps - height of status bar on the screen
 #define SBARHEIGHT st_height
@@ -97,7 +98,7 @@ int  viewwindowy;
 //
 // CPhipps - also to use it in the i386 asm I need it global
 
-byte *ylookup[MAXHEIGHT]; 
+byte **ylookup;  // SCREENHEIGHT entries
 //int  columnofs[MAXWIDTH]; 
 byte *topleft;
 
@@ -124,6 +125,194 @@ fixed_t dc_texturemid;
 int     dc_texheight;    // killough
 byte    *dc_source;      // first pixel in a column (possibly virtual) 
 
+//
+// Threaded drawing
+//
+// With more than one render thread the drawers below don't touch the
+//  screen when called. Instead what they were asked to draw is recorded
+//  in the draw queue, and when the queue is flushed the view window is
+//  split into vertical strips, one per thread, and each thread replays
+//  the whole queue clipped to its own strip. Every pixel is still
+//  written in the order the single threaded renderer would write it,
+//  so the picture is identical.
+//
+// Only the C drawers can be queued, so the i386 asm build always draws
+//  directly.
+//
+
+typedef struct drawcmd_s {
+  void (*draw)(const struct drawcmd_s *cmd, int x1, int x2);
+  int x1, x2;                     // screen columns covered
+  int yl, yh;                     // rows; spans use yl only
+  const lighttable_t *colormap;
+  const byte *source;
+  const byte *translation;
+  const byte *tranmap;
+  fixed_t iscale, texturemid;     // columns
+  int     texheight;
+  fixed_t xfrac, yfrac, xstep, ystep; // spans
+} drawcmd_t;
+
+#define MAXDRAWTHREADS 16
+
+int render_threads = 1;           // from the config file or -rthreads
+
+static int numdrawthreads = 1;
+static boolean drawqueueing;
+
+static drawcmd_t *drawqueue;
+static int numdrawcmds, maxdrawcmds;
+
+static pthread_mutex_t drawlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  drawstart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  drawdone = PTHREAD_COND_INITIALIZER;
+static unsigned drawgeneration;   // bumped to start the workers
+static int      drawbusy;         // workers still drawing
+
+// First screen column of a thread's strip
+#define R_StripStart(n) ((n) * viewwidth / numdrawthreads)
+
+static void R_RunDrawQueue(int x1, int x2)
+{
+  const drawcmd_t *cmd = drawqueue, *end = drawqueue + numdrawcmds;
+
+  for (; cmd < end; cmd++)
+    if (cmd->x1 <= x2 && cmd->x2 >= x1)
+      cmd->draw(cmd, x1, x2);
+}
+
+static void *R_DrawThread(void *arg)
+{
+  int n = (int)(long)arg;
+  unsigned generation = 0;
+
+  pthread_mutex_lock(&drawlock);
+  for (;;) {
+    while (drawgeneration == generation)
+      pthread_cond_wait(&drawstart, &drawlock);
+    generation = drawgeneration;
+    pthread_mutex_unlock(&drawlock);
+
+    R_RunDrawQueue(R_StripStart(n), R_StripStart(n+1) - 1);
+
+    pthread_mutex_lock(&drawlock);
+    if (!--drawbusy)
+      pthread_cond_signal(&drawdone);
+  }
+  return NULL;
+}
+
+//
+// R_FlushDrawQueue
+// Draws everything queued so far and waits for it to finish. Must be
+//  called before anything reads back the screen or frees memory a
+//  queued command points at.
+//
+
+void R_FlushDrawQueue(void)
+{
+  if (!numdrawcmds)
+    return;
+
+  pthread_mutex_lock(&drawlock);
+  drawbusy = numdrawthreads - 1;
+  drawgeneration++;
+  pthread_cond_broadcast(&drawstart);
+  pthread_mutex_unlock(&drawlock);
+
+  R_RunDrawQueue(0, R_StripStart(1) - 1); // this thread takes the first strip
+
+  pthread_mutex_lock(&drawlock);
+  while (drawbusy)
+    pthread_cond_wait(&drawdone, &drawlock);
+  pthread_mutex_unlock(&drawlock);
+
+  numdrawcmds = 0;
+}
+
+//
+// R_StartDrawQueue/R_FinishDrawQueue
+// Bracket the rendering of the player view; drawing is only queued
+//  in between.
+//
+
+void R_StartDrawQueue(void)
+{
+  drawqueueing = numdrawthreads > 1;
+}
+
+void R_FinishDrawQueue(void)
+{
+  R_FlushDrawQueue();
+  drawqueueing = false;
+}
+
+static void R_QueueDraw(const drawcmd_t *cmd)
+{
+  if (!drawqueueing) {
+    cmd->draw(cmd, cmd->x1, cmd->x2);
+    return;
+  }
+  if (numdrawcmds == maxdrawcmds)
+    drawqueue = realloc(drawqueue,
+			(maxdrawcmds = maxdrawcmds ? maxdrawcmds*2 : 4096) *
+			sizeof(*drawqueue));
+  drawqueue[numdrawcmds++] = *cmd;
+}
+
+// Fills in a column draw command from the dc_* variables
+static void R_ColumnCmd(drawcmd_t *cmd,
+			void (*draw)(const drawcmd_t *, int, int))
+{
+  cmd->draw = draw;
+  cmd->x1 = cmd->x2 = dc_x;
+  cmd->yl = dc_yl;
+  cmd->yh = dc_yh;
+  cmd->colormap = dc_colormap;
+  cmd->source = dc_source;
+  cmd->tranmap = tranmap;
+  cmd->iscale = dc_iscale;
+  cmd->texturemid = dc_texturemid;
+  cmd->texheight = dc_texheight;
+}
+
+//
+// R_InitDrawThreads
+// Starts the worker threads, if more than one render thread is wanted
+//
+
+void R_InitDrawThreads(void)
+{
+  int p, n;
+
+  if ((p = M_CheckParm("-rthreads")) && ++p < myargc)
+    render_threads = atoi(myargv[p]);
+
+#ifdef I386
+  if (render_threads > 1)
+    lprintf(LO_WARN, "R_InitDrawThreads: not supported with asm drawers\n");
+  render_threads = 1;
+#endif
+
+  if (render_threads > MAXDRAWTHREADS)
+    render_threads = MAXDRAWTHREADS;
+
+  for (n = numdrawthreads; n < render_threads; n++) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, R_DrawThread, (void*)(long)n)) {
+      lprintf(LO_WARN, "R_InitDrawThreads: failed to start thread %d\n", n);
+      break;
+    }
+    pthread_detach(thread);
+    numdrawthreads = n+1;
+  }
+  if (numdrawthreads > 1) {
+    lprintf(LO_INFO, "R_InitDrawThreads: %d render threads\n", numdrawthreads);
+    zone_purge_hook = R_FlushDrawQueue; // queued draws may use cached lumps
+  }
+}
+
 //
 // A column is a vertical slice/span from a wall texture that,
 //  given the DOOM style restrictions on the view orientation,
@@ -134,7 +323,7 @@ byte    *dc_source;      // first pixel in a column (possibly virtual)
 
 #ifndef I386     // killough 2/15/98
 
-void R_DrawColumn (void) 
+static void R_DrawColumnCmd(const drawcmd_t *cmd, int x1, int x2)
 {
   int              count; 
   register byte    *dest;            // killough
@@ -152,7 +341,7 @@ void R_DrawColumn (void)
   // later.  this helps a compiler pipeline a bit better.  the x86
   // assembler also does this.
 
-  count = dc_yh - dc_yl; 
+  count = cmd->yh - cmd->yl; 
 
   // leban 1/17/99:
   // this case isn't executed too often.  depending on how many instructions
@@ -171,15 +360,15 @@ void R_DrawColumn (void)
     // powerpc case, the values sit in registers instead of
     // being loaded thru the TOC.
     register int                   scrwid = SCREENWIDTH;
-    register const byte *source = dc_source;            
-    register const lighttable_t *colormap = dc_colormap; 
+    register const byte *source = cmd->source;            
+    register const lighttable_t *colormap = cmd->colormap; 
 
 
 #ifdef RANGECHECK 
-  if ((unsigned)dc_x >= SCREENWIDTH
-      || dc_yl < 0
-      || dc_yh >= SCREENHEIGHT) 
-    I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+  if ((unsigned)cmd->x1 >= SCREENWIDTH
+      || cmd->yl < 0
+      || cmd->yh >= SCREENHEIGHT) 
+    I_Error ("R_DrawColumn: %i to %i at %i", cmd->yl, cmd->yh, cmd->x1); 
 #endif 
 
   // Framebuffer destination address.
@@ -187,12 +376,12 @@ void R_DrawColumn (void)
   // Use columnofs LUT for subwindows? 
 
 //  dest = ylookup[dc_yl] + columnofs[dc_x];  
-  dest = topleft + dc_yl*scrwid + dc_x;  
+  dest = topleft + cmd->yl*scrwid + cmd->x1;  
 
   // Determine scaling, which is the only mapping to be done.
 
-  fracstep = dc_iscale; 
-  frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+  fracstep = cmd->iscale; 
+  frac = cmd->texturemid + (cmd->yl-centery)*fracstep; 
 
   // Inner loop that does the actual texture mapping,
   //  e.g. a DDA-lile scaling.
@@ -205,7 +394,7 @@ void R_DrawColumn (void)
     // be created...using too many registers at once, i think.
     // strange.
 
-    if(dc_texheight == 128)
+    if(cmd->texheight == 128)
     {
         // leban 1/5/99:
         // no tutti-frutti possible.  most textures are of this variety.
@@ -253,8 +442,8 @@ void R_DrawColumn (void)
     }
     else
     {
-     register unsigned heightmask = dc_texheight-1; // CPhipps - specify type
-     if (! (dc_texheight & heightmask) )   // power of 2 -- killough
+     register unsigned heightmask = cmd->texheight-1; // CPhipps - specify type
+     if (! (cmd->texheight & heightmask) )   // power of 2 -- killough
      {
          while (count>0)   // texture height is a power of 2 -- killough
            {
@@ -293,6 +482,15 @@ void R_DrawColumn (void)
  }
 }
 
+
+void R_DrawColumn (void)
+{
+  drawcmd_t cmd;
+
+  R_ColumnCmd(&cmd, R_DrawColumnCmd);
+  R_QueueDraw(&cmd);
+}
+
 #endif
 
 // Here is the version of R_DrawColumn that deals with translucent  // phares
@@ -309,37 +507,37 @@ void R_DrawColumn (void)
 
 #ifndef I386                       // killough 2/21/98: converted to x86 asm
 
-void R_DrawTLColumn (void)                                           
+static void R_DrawTLColumnCmd(const drawcmd_t *cmd, int x1, int x2)
 { 
   int              count; 
   register byte    *dest;           // killough
   register fixed_t frac;            // killough
   fixed_t          fracstep;
 
-  count = dc_yh - dc_yl + 1; 
+  count = cmd->yh - cmd->yl + 1; 
 
   // Zero length, column does not exceed a pixel.
   if (count <= 0)
     return; 
                                  
 #ifdef RANGECHECK 
-  if ((unsigned)dc_x >= SCREENWIDTH
-      || dc_yl < 0
-      || dc_yh >= SCREENHEIGHT) 
-    I_Error ("R_DrawColumn: %i to %i at %i", dc_yl, dc_yh, dc_x); 
+  if ((unsigned)cmd->x1 >= SCREENWIDTH
+      || cmd->yl < 0
+      || cmd->yh >= SCREENHEIGHT) 
+    I_Error ("R_DrawColumn: %i to %i at %i", cmd->yl, cmd->yh, cmd->x1); 
 #endif 
 
   // Framebuffer destination address.
   // Use ylookup LUT to avoid multiply with ScreenWidth.
   // Use columnofs LUT for subwindows? 
 
-  dest = topleft + dc_yl*SCREENWIDTH + dc_x;  
+  dest = topleft + cmd->yl*SCREENWIDTH + cmd->x1;  
   
   // Determine scaling,
   //  which is the only mapping to be done.
 
-  fracstep = dc_iscale; 
-  frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+  fracstep = cmd->iscale; 
+  frac = cmd->texturemid + (cmd->yl-centery)*fracstep; 
 
   // Inner loop that does the actual texture mapping,
   //  e.g. a DDA-lile scaling.
@@ -348,10 +546,11 @@ void R_DrawTLColumn (void)
   // killough 2/1/98, 2/21/98: more performance tuning
   
   {
-    register const byte *source = dc_source;            
-    register const lighttable_t *colormap = dc_colormap; 
-    register unsigned heightmask = dc_texheight-1; // CPhipps - specify type
-    if (dc_texheight & heightmask)   // not a power of 2 -- killough
+    register const byte *source = cmd->source;            
+    register const lighttable_t *colormap = cmd->colormap; 
+    register const byte *tranmap = cmd->tranmap;
+    register unsigned heightmask = cmd->texheight-1; // CPhipps - specify type
+    if (cmd->texheight & heightmask)   // not a power of 2 -- killough
       {
         heightmask++;
         heightmask <<= FRACBITS;
@@ -393,8 +592,52 @@ void R_DrawTLColumn (void)
   }
 } 
 
+
+void R_DrawTLColumn (void)
+{
+  drawcmd_t cmd;
+
+  R_ColumnCmd(&cmd, R_DrawTLColumnCmd);
+  R_QueueDraw(&cmd);
+}
+
 #endif  // killough 2/21/98: converted to x86 asm
 
+//
+// R_DrawSkyColumn
+// Copies rows dc_yl to dc_yh of a column that is already scaled to the
+//  view and mapped through the colormap, indexed by view row, as made
+//  by R_GetSkyColumn. Plain C, so used by the asm builds as well.
+//
+
+static void R_DrawSkyColumnCmd(const drawcmd_t *cmd, int x1, int x2)
+{
+  register int        count = cmd->yh - cmd->yl + 1;
+  register int        scrwid = SCREENWIDTH;
+  register const byte *source = cmd->source + cmd->yl;
+  register byte       *dest = topleft + cmd->yl*scrwid + cmd->x1;
+
+#ifdef RANGECHECK
+  if ((unsigned)cmd->x1 >= SCREENWIDTH
+      || cmd->yl < 0
+      || cmd->yh >= SCREENHEIGHT)
+    I_Error ("R_DrawSkyColumn: %i to %i at %i", cmd->yl, cmd->yh, cmd->x1);
+#endif
+
+  while (count-- > 0) {
+    *dest = *source++;
+    dest += scrwid;
+  }
+}
+
+void R_DrawSkyColumn(void)
+{
+  drawcmd_t cmd;
+
+  R_ColumnCmd(&cmd, R_DrawSkyColumnCmd);
+  R_QueueDraw(&cmd);
+}
+
 //
 // Spectre/Invisibility.
 //
@@ -432,6 +675,9 @@ void R_DrawFuzzColumn(void)
   fixed_t  frac;
   fixed_t  fracstep;     
 
+  // Reads the pixels either side, which may still be waiting to be drawn
+  R_FlushDrawQueue();
+
   // Adjust borders. Low... 
   if (!dc_yl) 
     dc_yl = 1;
@@ -504,31 +750,31 @@ void R_DrawFuzzColumn(void)
 
 byte *dc_translation, *translationtables;
 
-void R_DrawTranslatedColumn (void) 
+static void R_DrawTranslatedColumnCmd(const drawcmd_t *cmd, int x1, int x2)
 { 
   int      count; 
   byte     *dest; 
   fixed_t  frac;
   fixed_t  fracstep;     
  
-  count = dc_yh - dc_yl; 
+  count = cmd->yh - cmd->yl; 
   if (count < 0) 
     return; 
                                  
 #ifdef RANGECHECK 
-  if ((unsigned)dc_x >= SCREENWIDTH
-      || dc_yl < 0
-      || dc_yh >= SCREENHEIGHT)
+  if ((unsigned)cmd->x1 >= SCREENWIDTH
+      || cmd->yl < 0
+      || cmd->yh >= SCREENHEIGHT)
     I_Error ( "R_DrawColumn: %i to %i at %i",
-              dc_yl, dc_yh, dc_x);
+              cmd->yl, cmd->yh, cmd->x1);
 #endif 
 
   // FIXME. As above.
-  dest = topleft + dc_yl*SCREENWIDTH + dc_x; 
+  dest = topleft + cmd->yl*SCREENWIDTH + cmd->x1; 
 
   // Looks familiar.
-  fracstep = dc_iscale; 
-  frac = dc_texturemid + (dc_yl-centery)*fracstep; 
+  fracstep = cmd->iscale; 
+  frac = cmd->texturemid + (cmd->yl-centery)*fracstep; 
   
   // Here we do an additional index re-mapping.
   do 
@@ -539,7 +785,7 @@ void R_DrawTranslatedColumn (void)
       // Thus the "green" ramp of the player 0 sprite
       //  is mapped to gray, red, black/indigo. 
       
-      *dest = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
+      *dest = cmd->colormap[cmd->translation[cmd->source[frac>>FRACBITS]]];
       dest += SCREENWIDTH;
         
       frac += fracstep; 
@@ -547,6 +793,15 @@ void R_DrawTranslatedColumn (void)
   while (count--); 
 } 
 
+void R_DrawTranslatedColumn (void)
+{
+  drawcmd_t cmd;
+
+  R_ColumnCmd(&cmd, R_DrawTranslatedColumnCmd);
+  cmd.translation = dc_translation;
+  R_QueueDraw(&cmd);
+}
+
 //
 // R_InitTranslationTables
 // Creates the translation tables to map
@@ -624,13 +879,13 @@ byte *ds_source;
 
 #ifndef I386      // killough 2/15/98
 
-void R_DrawSpan (void) 
+static void R_DrawSpanCmd(const drawcmd_t *cmd, int x1, int x2)
 { 
   register unsigned position;
   unsigned step;
 
-  byte *source;
-  byte *colormap;
+  const byte *source;
+  const byte *colormap;
   byte *dest;
     
   unsigned count;
@@ -638,13 +893,19 @@ void R_DrawSpan (void)
   unsigned xtemp;
   unsigned ytemp;
                 
-  position = ((ds_xfrac<<10)&0xffff0000) | ((ds_yfrac>>6)&0xffff);
-  step = ((ds_xstep<<10)&0xffff0000) | ((ds_ystep>>6)&0xffff);
+  position = ((cmd->xfrac<<10)&0xffff0000) | ((cmd->yfrac>>6)&0xffff);
+  step = ((cmd->xstep<<10)&0xffff0000) | ((cmd->ystep>>6)&0xffff);
+
+  // Clip to the strip being drawn. Both texture coordinates are packed
+  //  into position, so skipping ahead is a single multiply, and exact
+  if (x1 < cmd->x1) x1 = cmd->x1;
+  if (x2 > cmd->x2) x2 = cmd->x2;
+  position += (x1 - cmd->x1) * step;
                 
-  source = ds_source;
-  colormap = ds_colormap;
-  dest = topleft + ds_y*SCREENWIDTH + ds_x1;       
-  count = ds_x2 - ds_x1 + 1; 
+  source = cmd->source;
+  colormap = cmd->colormap;
+  dest = topleft + cmd->yl*SCREENWIDTH + x1;       
+  count = x2 - x1 + 1; 
         
   while (count >= 4)
     { 
@@ -692,6 +953,24 @@ void R_DrawSpan (void)
     } 
 } 
 
+
+void R_DrawSpan (void)
+{
+  drawcmd_t cmd;
+
+  cmd.draw = R_DrawSpanCmd;
+  cmd.x1 = ds_x1;
+  cmd.x2 = ds_x2;
+  cmd.yl = ds_y;
+  cmd.colormap = ds_colormap;
+  cmd.source = ds_source;
+  cmd.xfrac = ds_xfrac;
+  cmd.yfrac = ds_yfrac;
+  cmd.xstep = ds_xstep;
+  cmd.ystep = ds_ystep;
+  R_QueueDraw(&cmd);
+}
+
 #endif
 
 //
@@ -720,6 +999,8 @@ void R_InitBuffer(int width, int height)
   // Preclaculate all row offsets.
   // CPhipps - merge viewwindowx into here
 
+  if (!ylookup)
+    ylookup = Z_Malloc(SCREENHEIGHT * sizeof *ylookup, PU_STATIC, 0);
   for (i=0 ; i<height ; i++) 
     ylookup[i] = screens[0] + (i+viewwindowy)*SCREENWIDTH + viewwindowx; 
 } 
@@ -804,10 +1085,17 @@ void R_FillBackScreen (void)
 //
 // Copy a screen buffer.
 //
+// The border is erased every frame but rarely changes, so only copy and
+// mark dirty what has been drawn over.
+//
 
 void R_VideoErase(unsigned ofs, int count)
 { 
-  memcpy(screens[0]+ofs, screens[1]+ofs, count);   // LFB copy.
+  if (memcmp(screens[0]+ofs, screens[1]+ofs, count)) {
+    V_MarkRect(0, ofs / SCREENWIDTH, SCREENWIDTH,
+	       (ofs + count - 1) / SCREENWIDTH - ofs / SCREENWIDTH + 1);
+    memcpy(screens[0]+ofs, screens[1]+ofs, count);   // LFB copy.
+  }
 } 
 
 //
@@ -871,8 +1159,6 @@ void R_DrawViewBorder(void)
       R_VideoErase (ofs, side); 
       ofs += SCREENWIDTH; 
     } 
-
-  V_MarkRect (0,0,SCREENWIDTH, SCREENHEIGHT-SBARHEIGHT); 
 } 
 
 //----------------------------------------------------------------------------
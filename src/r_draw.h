@@ -76,6 +76,7 @@ extern void (*R_DrawTLColumn)(void);
 #endif
 
 void R_DrawFuzzColumn(void);    // The Spectre/Invisibility effect.
+void R_DrawSkyColumn(void);     // Prescaled sky, see R_GetSkyColumn
 
 // Draw with color translation tables, for player sprite rendering,
 //  Green/Red/Blue/Indigo shirts.
@@ -108,6 +109,13 @@ void R_InitBuffer(int width, int height);
 // Initialize color translation tables, for player rendering etc.
 void R_InitTranslationTables(void);
 
+// Threaded drawing, see r_draw.c
+extern int render_threads;
+void R_InitDrawThreads(void);
+void R_StartDrawQueue(void);
+void R_FlushDrawQueue(void);
+void R_FinishDrawQueue(void);
+
 // Rendering function.
 void R_FillBackScreen(void);
 
@@ -46,6 +46,7 @@ static const char rcsid[] = "$Id: r_main.c,v 1.20 1999/10/31 15:51:45 cphipps Ex
 #include "lprintf.h"
 #include "st_stuff.h"
 #include "i_main.h"
+#include "i_system.h"
 
 void R_LoadTrigTables(void);
 
@@ -87,7 +88,7 @@ int viewangletox[FINEANGLES/2];
 // to the lowest viewangle that maps back to x ranges
 // from clipangle to -clipangle.
 
-angle_t xtoviewangle[MAX_SCREENWIDTH+1];   // killough 2/8/98
+angle_t *xtoviewangle;   // killough 2/8/98, SCREENWIDTH+1 entries
 
 // killough 3/20/98: Support dynamic colormaps, e.g. deep water
 // killough 4/4/98: support dynamic number of them as well
@@ -234,6 +235,8 @@ void R_CopyStatusBar(void)
     byte* dst = screens[0] + SCREENWIDTH*ST_TY + (SCREENWIDTH - ST_WIDTH*(st_scalex))/2;
     const byte* src = screens[5] + (SCREENWIDTH - ST_WIDTH)/2;
 
+    V_MarkRect(0, ST_TY, SCREENWIDTH, st_height);
+
     for (sr=0; sr<ST_HEIGHT; sr++, src+=SCREENWIDTH, dst+=SCREENWIDTH*st_scaley) {
       for (sc=0, dc=0; sc<ST_WIDTH; sc++, dc+=st_scalex)
 	memset(&dst[dc], src[sc], st_scalex);
@@ -400,7 +403,8 @@ void R_ExecuteSetViewSize (void)
   centeryfrac = centery<<FRACBITS;
   projection = centerxfrac;
 // proff 11/06/98: Added for high-res
-  projectiony = ((SCREENHEIGHT * centerx * 320) / 200) / SCREENWIDTH * FRACUNIT;
+  projectiony = (int)(((int_64_t)SCREENHEIGHT * centerx * 320 / 200)
+		      / SCREENWIDTH) * FRACUNIT;
 
   R_InitBuffer (scaledviewwidth, viewheight);
         
@@ -467,6 +471,7 @@ void R_Init (void)
   //  initialise in code
   colfunc = R_DrawColumn;     // current column draw function
   if (SCREENWIDTH<320) I_Error("Screenwidth(%d) < 320)",SCREENWIDTH);
+  xtoviewangle = Z_Malloc((SCREENWIDTH+1) * sizeof *xtoviewangle, PU_STATIC, 0);
 #if defined TABLES_AS_LUMPS && defined NO_PREDEFINED_LUMPS
   lprintf(LO_INFO, "\nR_LoadTrigTables: ");
   R_LoadTrigTables();
@@ -483,6 +488,7 @@ void R_Init (void)
   R_InitSkyMap();
   lprintf(LO_INFO, "R_InitTranslationsTables ");
   R_InitTranslationTables();
+  R_InitDrawThreads();
 }
 
 //
@@ -559,6 +565,7 @@ int autodetect_hom = 0;       // killough 2/7/98: HOM autodetection flag
 // R_ShowStats
 //
 int rendered_visplanes, rendered_segs, rendered_vissprites;
+int rendered_planesplits, rendered_planeprobes; // R_CheckPlane, hash misses
 boolean rendering_stats;
 
 static void R_ShowStats(void)
@@ -568,21 +575,179 @@ static void R_ShowStats(void)
   int now = I_GetTime();
 
   if (now - showtime > 35) {
-    doom_printf("Frame rate %d fps\nSegs %d, Visplanes %d, Sprites %d", 
+    doom_printf("Frame rate %d fps\nSegs %d, Visplanes %d, Sprites %d\n"
+		"Plane splits %d, hash probes %d", 
 		(35*KEEPTIMES)/(now - keeptime[0]), rendered_segs, 
-		rendered_visplanes, rendered_vissprites);
+		rendered_visplanes, rendered_vissprites,
+		rendered_planesplits, rendered_planeprobes);
     showtime = now;
   }
   memmove(keeptime, keeptime+1, sizeof(keeptime[0]) * (KEEPTIMES-1));
   keeptime[KEEPTIMES-1] = now;
 }
 
+//
+// R_Profile*
+//
+// Per-stage frame timings, kept in a ring buffer of the last RPROF_FRAMES
+// frames. The stages are timed by R_RenderPlayerView and D_Display, and a
+// frame is closed by R_ProfileEndFrame after it has been blitted.
+//
+
+typedef struct {
+  int      gametic;
+  unsigned usecs[NUMRPROFSTAGES];
+  int      segs, visplanes, sprites;
+  int      planesplits, planeprobes;
+} rprofframe_t;
+
+boolean rendering_profile;
+
+static rprofframe_t rprof_frames[RPROF_FRAMES];
+static int          rprof_current, rprof_count;
+static int_64_t     rprof_start[NUMRPROFSTAGES];
+
+static const char* const rprof_names[NUMRPROFSTAGES] = {
+  "bsp", "planes", "masked", "hud", "blit"
+};
+
+// Palette colours for each stage in the on-screen graph
+static const byte rprof_colours[NUMRPROFSTAGES] = {
+  176, 112, 200, 231, 4 // red, green, blue, yellow, white
+};
+
+void R_ProfileBegin(rprofstage_t stage)
+{
+  if (rendering_profile)
+    rprof_start[stage] = I_GetTime_uSecs();
+}
+
+void R_ProfileEnd(rprofstage_t stage)
+{
+  if (rendering_profile)
+    rprof_frames[rprof_current].usecs[stage] +=
+      (unsigned)(I_GetTime_uSecs() - rprof_start[stage]);
+}
+
+void R_ProfileEndFrame(void)
+{
+  rprofframe_t* f;
+
+  if (!rendering_profile) return;
+
+  f = &rprof_frames[rprof_current];
+  f->gametic   = gametic;
+  f->segs      = rendered_segs;
+  f->visplanes = rendered_visplanes;
+  f->sprites   = rendered_vissprites;
+  f->planesplits = rendered_planesplits;
+  f->planeprobes = rendered_planeprobes;
+
+  rprof_current = (rprof_current + 1) % RPROF_FRAMES;
+  if (rprof_count < RPROF_FRAMES) rprof_count++;
+  memset(&rprof_frames[rprof_current], 0, sizeof(rprof_frames[0]));
+}
+
+//
+// R_DrawProfile
+//
+// Draws the recorded frames as a graph along the bottom of the view window,
+// newest on the right, one column per frame with the stages stacked at
+// 4 pixels per millisecond. Also prints the averages once a second.
+//
+void R_DrawProfile(void)
+{
+  static int showtime;
+  int now = I_GetTime();
+  int n = rprof_count < viewwidth ? rprof_count : viewwidth;
+  int maxh = viewheight / 2;
+  int i;
+
+  for (i=0; i<n; i++) {
+    const rprofframe_t* f =
+      &rprof_frames[(rprof_current - n + i + RPROF_FRAMES) % RPROF_FRAMES];
+    byte* dest = screens[0] + (viewwindowy + viewheight - 1) * SCREENWIDTH
+      + viewwindowx + viewwidth - n + i;
+    int stage, h = 0;
+
+    for (stage=0; stage<NUMRPROFSTAGES; stage++) {
+      int top = h + f->usecs[stage] / 250;
+
+      if (top > maxh) top = maxh;
+      for (; h < top; h++, dest -= SCREENWIDTH)
+	*dest = rprof_colours[stage];
+    }
+  }
+
+  if (n && now - showtime > 35) {
+    unsigned total[NUMRPROFSTAGES];
+    int stage;
+
+    memset(total, 0, sizeof total);
+    for (i=1; i<=n; i++) {
+      const rprofframe_t* f =
+	&rprof_frames[(rprof_current - i + RPROF_FRAMES) % RPROF_FRAMES];
+      for (stage=0; stage<NUMRPROFSTAGES; stage++)
+	total[stage] += f->usecs[stage];
+    }
+    doom_printf("BSP %.2f Planes %.2f Masked %.2f\nHUD %.2f Blit %.2f (ms)",
+		total[rprof_bsp] / (n * 1000.0), 
+		total[rprof_planes] / (n * 1000.0),
+		total[rprof_masked] / (n * 1000.0),
+		total[rprof_hud] / (n * 1000.0),
+		total[rprof_blit] / (n * 1000.0));
+    showtime = now;
+  }
+}
+
+//
+// R_DumpProfile
+//
+// Writes the recorded frames, oldest first, to the next free rprofNN.csv
+//
+void R_DumpProfile(void)
+{
+  static int dump;
+  char       fname[32];
+  int        startdump = dump;
+  FILE*      f;
+  int        i, stage;
+
+  do
+    sprintf(fname, "rprof%02d.csv", dump++);
+  while (!access(fname,0) && (dump != startdump) && (dump < 10000));
+
+  if (!(f = fopen(fname, "w"))) {
+    doom_printf("R_DumpProfile: Error writing %s", fname);
+    return;
+  }
+
+  fprintf(f, "gametic");
+  for (stage=0; stage<NUMRPROFSTAGES; stage++)
+    fprintf(f, ",%s_usecs", rprof_names[stage]);
+  fprintf(f, ",segs,visplanes,sprites,plane_splits,plane_probes\n");
+
+  for (i=rprof_count; i>0; i--) {
+    const rprofframe_t* p =
+      &rprof_frames[(rprof_current - i + RPROF_FRAMES) % RPROF_FRAMES];
+
+    fprintf(f, "%d", p->gametic);
+    for (stage=0; stage<NUMRPROFSTAGES; stage++)
+      fprintf(f, ",%u", p->usecs[stage]);
+    fprintf(f, ",%d,%d,%d,%d,%d\n", p->segs, p->visplanes, p->sprites,
+	    p->planesplits, p->planeprobes);
+  }
+  fclose(f);
+  doom_printf("Profile of %d frames written to %s", rprof_count, fname);
+}
+
 //
 // R_RenderView
 //
 void R_RenderPlayerView (player_t* player)
 {       
   R_SetupFrame (player);
+  V_MarkRect(viewwindowx, viewwindowy, scaledviewwidth, viewheight);
 
   // Clear buffers.
   R_ClearClipSegs ();
@@ -591,6 +756,8 @@ void R_RenderPlayerView (player_t* player)
   R_ClearSprites ();
     
   rendered_segs = rendered_visplanes = 0;
+  rendered_planesplits = rendered_planeprobes = 0;
+  R_StartDrawQueue();
   if (autodetect_hom)
     { // killough 2/10/98: add flashing red HOM indicators
       char c[47*47];
@@ -666,17 +833,24 @@ void R_RenderPlayerView (player_t* player)
   NetUpdate ();
 
   // The head node is the last node output.
+  R_ProfileBegin(rprof_bsp);
   R_RenderBSPNode (numnodes-1);
+  R_ProfileEnd(rprof_bsp);
     
   // Check for new console commands.
   NetUpdate ();
     
+  R_ProfileBegin(rprof_planes);
   R_DrawPlanes ();
+  R_ProfileEnd(rprof_planes);
     
   // Check for new console commands.
   NetUpdate ();
     
+  R_ProfileBegin(rprof_masked);
   R_DrawMasked ();
+  R_FinishDrawQueue ();
+  R_ProfileEnd(rprof_masked);
 
   // Check for new console commands.
   NetUpdate ();
@@ -65,8 +65,34 @@ extern int      loopcount;
 //
 
 extern int rendered_visplanes, rendered_segs, rendered_vissprites;
+extern int rendered_planesplits, rendered_planeprobes;
 extern boolean rendering_stats;
 
+//
+// Frame profiler
+// Time spent in each stage of drawing a frame, for the last RPROF_FRAMES
+// frames. Only recorded while rendering_profile is set.
+//
+
+#define RPROF_FRAMES 256
+
+typedef enum {
+  rprof_bsp,     // R_RenderBSPNode
+  rprof_planes,  // R_DrawPlanes
+  rprof_masked,  // R_DrawMasked
+  rprof_hud,     // status bar, automap, HUD
+  rprof_blit,    // I_FinishUpdate
+  NUMRPROFSTAGES
+} rprofstage_t;
+
+extern boolean rendering_profile;
+
+void R_ProfileBegin(rprofstage_t stage);
+void R_ProfileEnd(rprofstage_t stage);
+void R_ProfileEndFrame(void);
+void R_DrawProfile(void);
+void R_DumpProfile(void);
+
 //
 // Lighting LUT.
 // Used for z-depth cuing per column/row,
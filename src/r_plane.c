@@ -29,10 +29,10 @@
  *       while maintaining a per column clipping list only.
  *      Moreover, the sky areas have to be determined.
  *
- * MAXVISPLANES is no longer a limit on the number of visplanes,
- * but a limit on the number of hash slots; larger numbers mean
- * better performance usually but after a point they are wasted,
- * and memory and time overheads creep in.
+ * Visplanes come from a pool which only ever grows, allocated in
+ * blocks sized for the screen. They are found through an open
+ * addressing hash table, which is doubled whenever a frame fills
+ * it past half full.
  *
  * For more information on visplanes, see:
  *
@@ -56,18 +56,23 @@ rcsid[] = "$Id: r_plane.c,v 1.9 1999/11/01 17:09:15 cphipps Exp $";
 #include "r_plane.h"
 #include "lprintf.h"
 
-#define MAXVISPLANES 128    /* must be a power of 2 */
+#define VISPLANEBLOCK 64    /* visplanes allocated at a time */
+#define MINPLANEHASHBITS 7  /* starting hash table size, as a power of 2 */
 
-static visplane_t *visplanes[MAXVISPLANES];   // killough
-static visplane_t *freetail;                  // killough
-static visplane_t **freehead = &freetail;     // killough
+static visplane_t **visplanes;                // The pool, in order of use
+static int        numvisplanes, maxvisplanes;
+static visplane_t **planehash;                // Newest visplane of each key
+static int        planehashbits, planehashused;
+static void       R_GrowPlaneHash(void);
 visplane_t *floorplane, *ceilingplane;
 
 // killough -- hash function for visplanes
-// Empirically verified to be fairly uniform:
+// The old sum is mixed by a multiplier, and the top bits taken, so that
+// linear probing does not pile up on runs of neighbouring slots
 
 #define visplane_hash(picnum,lightlevel,height) \
-  ((unsigned)((picnum)*3+(lightlevel)+(height)*7) & (MAXVISPLANES-1))
+  ((((unsigned)((picnum)*3+(lightlevel)+(height)*7) * 2654435761u) \
+    & 0xffffffffu) >> (32 - planehashbits))
 
 size_t maxopenings;
 short *openings,*lastopening;
@@ -76,99 +81,108 @@ short *openings,*lastopening;
 //  floorclip starts out SCREENHEIGHT
 //  ceilingclip starts out -1
 
-short floorclip[MAX_SCREENWIDTH], ceilingclip[MAX_SCREENWIDTH];
+short *floorclip, *ceilingclip;
 
 // spanstart holds the start of a plane span; initialized to 0 at start
 
-static int spanstart[MAX_SCREENHEIGHT];                // killough 2/8/98
+static int *spanstart;                // killough 2/8/98
 
 //
 // texture mapping
 //
+// Flats are drawn a run of visplanes at a time, all at the same height.
+// The spans of the whole run are collected, then sorted by row, so the
+// distance and steps for each row are worked out once for all of them.
+//
+
+typedef struct {
+  visplane_t       *pl;
+  const byte       *source;   // The flat, locked until the end of the frame
+  lighttable_t    **zlight;
+} drawplane_t;
+
+typedef struct {
+  int y, x1, x2;
+  const drawplane_t *plane;
+} planespan_t;
+
+static drawplane_t *drawplanes;       // The frame's flat visplanes
+static int         maxdrawplanes;
+static const drawplane_t *curplane;   // The plane R_MakeSpans is on
 
-static lighttable_t **planezlight;
-static fixed_t planeheight;
+static planespan_t *planespans, *sortedspans;
+static int         numplanespans, maxplanespans;
+static int         *rowspans;         // Per row, where its spans start
+
+// The frame's sky visplanes, and the sky being drawn
+static visplane_t **skyplanes;
+static int         numskyplanes, maxskyplanes;
+static int         skytex;
+static angle_t     skyangle, skyflip;
+
+// Per column, the rows of sky still to draw; empty if top > bottom
+static int         *skytop, *skybottom;
+
+// Flats locked this frame, by flat number
+static const byte **flatsource;
+static int         *lockedflats, numlockedflats;
 
 // killough 2/8/98: make variables static
 
 static fixed_t basexscale, baseyscale;
-static fixed_t cachedheight[MAX_SCREENHEIGHT];
-static fixed_t cacheddistance[MAX_SCREENHEIGHT];
-static fixed_t cachedxstep[MAX_SCREENHEIGHT];
-static fixed_t cachedystep[MAX_SCREENHEIGHT];
-static fixed_t xoffs,yoffs;    // killough 2/28/98: flat offsets
 
-fixed_t yslope[MAX_SCREENHEIGHT], distscale[MAX_SCREENWIDTH];
+fixed_t *yslope, *distscale;
 
 //
 // R_InitPlanes
 // Only at game startup.
+// Allocates the per column and per row arrays for the screen size
 //
 void R_InitPlanes (void)
 {
+  int i;
+
+  floorclip = Z_Malloc(SCREENWIDTH * sizeof *floorclip, PU_STATIC, 0);
+  ceilingclip = Z_Malloc(SCREENWIDTH * sizeof *ceilingclip, PU_STATIC, 0);
+  distscale = Z_Malloc(SCREENWIDTH * sizeof *distscale, PU_STATIC, 0);
+  spanstart = Z_Malloc(SCREENHEIGHT * sizeof *spanstart, PU_STATIC, 0);
+  yslope = Z_Malloc(SCREENHEIGHT * sizeof *yslope, PU_STATIC, 0);
+  rowspans = Z_Malloc((SCREENHEIGHT+1) * sizeof *rowspans, PU_STATIC, 0);
+  flatsource = Z_Calloc(numflats, sizeof *flatsource, PU_STATIC, 0);
+  lockedflats = Z_Malloc(numflats * sizeof *lockedflats, PU_STATIC, 0);
+  skytop = Z_Malloc(SCREENWIDTH * sizeof *skytop, PU_STATIC, 0);
+  skybottom = Z_Malloc(SCREENWIDTH * sizeof *skybottom, PU_STATIC, 0);
+  for (i=0; i<SCREENWIDTH; i++)
+    skytop[i] = SCREENHEIGHT, skybottom[i] = -1;
+  R_GrowPlaneHash();
 }
 
 //
 // R_MapPlane
 //
-// Uses global vars:
-//  planeheight
-//  ds_source
-//  basexscale
-//  baseyscale
-//  viewx
-//  viewy
-//  xoffs
-//  yoffs
-//
-// BASIC PRIMITIVE
+// Records a span of the current plane, to be drawn with the rest of
+// its run by R_DrawPlaneRun
 //
 
 static void R_MapPlane(int y, int x1, int x2)
 {
-  angle_t angle;
-  fixed_t distance, length;
-  unsigned index;
+  planespan_t *span;
 
 #ifdef RANGECHECK
   if (x2 < x1 || x1<0 || x2>=viewwidth || (unsigned)y>viewheight)
     I_Error ("R_MapPlane: %i, %i at %i",x1,x2,y);
 #endif
 
-  if (planeheight != cachedheight[y])
-    {
-      cachedheight[y] = planeheight;
-      distance = cacheddistance[y] = FixedMul (planeheight, yslope[y]);
-      ds_xstep = cachedxstep[y] = FixedMul (distance,basexscale);
-      ds_ystep = cachedystep[y] = FixedMul (distance,baseyscale);
-    }
-  else
-    {
-      distance = cacheddistance[y];
-      ds_xstep = cachedxstep[y];
-      ds_ystep = cachedystep[y];
-    }
-
-  length = FixedMul (distance,distscale[x1]);
-  angle = (viewangle + xtoviewangle[x1])>>ANGLETOFINESHIFT;
-
-  // killough 2/28/98: Add offsets
-  ds_xfrac =  viewx + FixedMul(finecosine[angle], length) + xoffs;
-  ds_yfrac = -viewy - FixedMul(finesine[angle],   length) + yoffs;
-
-  if (!(ds_colormap = fixedcolormap))
-    {
-      index = distance >> LIGHTZSHIFT;
-      if (index >= MAXLIGHTZ )
-        index = MAXLIGHTZ-1;
-      ds_colormap = planezlight[index];
-    }
-
-  ds_y = y;
-  ds_x1 = x1;
-  ds_x2 = x2;
-
-  R_DrawSpan();
+  if (numplanespans == maxplanespans) {
+    maxplanespans = maxplanespans ? maxplanespans*2 : 1024;
+    planespans = realloc(planespans, maxplanespans * sizeof *planespans);
+    sortedspans = realloc(sortedspans, maxplanespans * sizeof *sortedspans);
+  }
+  span = &planespans[numplanespans++];
+  span->y = y;
+  span->x1 = x1;
+  span->x2 = x2;
+  span->plane = curplane;
 }
 
 //
@@ -185,15 +199,11 @@ void R_ClearPlanes(void)
   for (i=0 ; i<viewwidth ; i++)
     floorclip[i] = viewheight, ceilingclip[i] = -1;
 
-  for (i=0;i<MAXVISPLANES;i++)    // new code -- killough
-    for (*freehead = visplanes[i], visplanes[i] = NULL; *freehead; )
-      freehead = &(*freehead)->next;
+  numvisplanes = planehashused = 0;
+  memset(planehash, 0, sizeof *planehash << planehashbits);
 
   lastopening = openings;
 
-  // texture calculation
-  memset (cachedheight, 0, sizeof(cachedheight));
-
   // left to right mapping
   angle = (viewangle-ANG90)>>ANGLETOFINESHIFT;
 
@@ -203,18 +213,83 @@ void R_ClearPlanes(void)
 }
 
 // New function, by Lee Killough
+// Takes the next visplane from the pool, adding a block when it runs out
 
-static visplane_t *new_visplane(unsigned hash)
+static visplane_t *new_visplane(void)
 {
-  visplane_t *check = freetail;
-  if (!check)
-    check = calloc(1, sizeof *check);
-  else
-    if (!(freetail = freetail->next))
-      freehead = &freetail;
-  check->next = visplanes[hash];
-  visplanes[hash] = check;
-  return check;
+  if (numvisplanes == maxvisplanes)
+    {
+      // top[] and bottom[] are sized for the screen, with their pads
+      size_t size = (sizeof(visplane_t) +
+		     (2*SCREENWIDTH + 3) * sizeof(unsigned short) +
+		     sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+      byte *block = malloc(VISPLANEBLOCK * size);
+      int i;
+
+      if (!block)
+	I_Error("new_visplane: out of memory for %d visplanes",
+		maxvisplanes + VISPLANEBLOCK);
+      visplanes = realloc(visplanes, (maxvisplanes + VISPLANEBLOCK) *
+			  sizeof *visplanes);
+      for (i=0; i<VISPLANEBLOCK; i++, block += size)
+	{
+	  visplane_t *pl = visplanes[maxvisplanes++] = (visplane_t *) block;
+	  pl->bottom = pl->top + SCREENWIDTH + 2;
+	}
+    }
+  return visplanes[numvisplanes++];
+}
+
+//
+// R_PlaneSlot
+//
+// Returns the hash slot holding the newest visplane with the given key,
+// or the empty slot where one would go
+//
+
+static visplane_t **R_PlaneSlot(fixed_t height, int picnum, int lightlevel,
+				fixed_t xoffs, fixed_t yoffs)
+{
+  unsigned mask = (1u << planehashbits) - 1;
+  unsigned i = visplane_hash(picnum,lightlevel,height);
+  visplane_t *check;
+
+  while ((check = planehash[i]) &&
+	 !(height == check->height &&
+	   picnum == check->picnum &&
+	   lightlevel == check->lightlevel &&
+	   xoffs == check->xoffs &&      // killough 2/28/98: Add offset checks
+	   yoffs == check->yoffs))
+    i = (i+1) & mask, rendered_planeprobes++;
+
+  return &planehash[i];
+}
+
+//
+// R_GrowPlaneHash
+//
+// Doubles the hash table, and puts back this frame's visplanes in the
+// order they were made, so the newest of each key is the one kept
+//
+
+static void R_GrowPlaneHash(void)
+{
+  int i;
+
+  planehashbits = planehash ? planehashbits + 1 : MINPLANEHASHBITS;
+  planehash = realloc(planehash, sizeof *planehash << planehashbits);
+  memset(planehash, 0, sizeof *planehash << planehashbits);
+  planehashused = 0;
+
+  for (i=0; i<numvisplanes; i++)
+    {
+      visplane_t *pl = visplanes[i];
+      visplane_t **slot = R_PlaneSlot(pl->height, pl->picnum, pl->lightlevel,
+				      pl->xoffs, pl->yoffs);
+      if (!*slot)
+	planehashused++;
+      *slot = pl;
+    }
 }
 
 //
@@ -225,24 +300,25 @@ static visplane_t *new_visplane(unsigned hash)
 visplane_t *R_FindPlane(fixed_t height, int picnum, int lightlevel,
                         fixed_t xoffs, fixed_t yoffs)
 {
-  visplane_t *check;
-  unsigned hash;                      // killough
+  visplane_t *check, **slot;
 
   if (picnum == skyflatnum || picnum & PL_SKYFLAT)
     height = lightlevel = 0;         // killough 7/19/98: most skies map together
 
   // New visplane algorithm uses hash table -- killough
-  hash = visplane_hash(picnum,lightlevel,height);
+  slot = R_PlaneSlot(height, picnum, lightlevel, xoffs, yoffs);
+  if (*slot)
+    return *slot;
 
-  for (check=visplanes[hash]; check; check=check->next)  // killough
-    if (height == check->height &&
-        picnum == check->picnum &&
-        lightlevel == check->lightlevel &&
-        xoffs == check->xoffs &&      // killough 2/28/98: Add offset checks
-        yoffs == check->yoffs)
-      return check;
+  // Keep the table at most half full
+  if (++planehashused * 2 > 1 << planehashbits)
+    {
+      R_GrowPlaneHash();
+      planehashused++;
+      slot = R_PlaneSlot(height, picnum, lightlevel, xoffs, yoffs);
+    }
 
-  check = new_visplane(hash);         // killough
+  *slot = check = new_visplane();     // killough
 
   check->height = height;
   check->picnum = picnum;
@@ -252,7 +328,7 @@ visplane_t *R_FindPlane(fixed_t height, int picnum, int lightlevel,
   check->xoffs = xoffs;               // killough 2/28/98: Save offsets
   check->yoffs = yoffs;
 
-  memset (check->top, 0xff, sizeof check->top);
+  memset (check->top, 0xff, SCREENWIDTH * sizeof *check->top);
 
   return check;
 }
@@ -281,8 +357,12 @@ visplane_t *R_CheckPlane(visplane_t *pl, int start, int stop)
     pl->minx = unionl, pl->maxx = unionh;
   else
     {
-      unsigned hash = visplane_hash(pl->picnum, pl->lightlevel, pl->height);
-      visplane_t *new_pl = new_visplane(hash);
+      // The new visplane takes over the key's slot in the hash table
+      visplane_t *new_pl = new_visplane();
+
+      *R_PlaneSlot(pl->height, pl->picnum, pl->lightlevel,
+		   pl->xoffs, pl->yoffs) = new_pl;
+      rendered_planesplits++;
 
       new_pl->height = pl->height;
       new_pl->picnum = pl->picnum;
@@ -292,7 +372,7 @@ visplane_t *R_CheckPlane(visplane_t *pl, int start, int stop)
       pl = new_pl;
       pl->minx = start;
       pl->maxx = stop;
-      memset(pl->top, 0xff, sizeof pl->top);
+      memset(pl->top, 0xff, SCREENWIDTH * sizeof *pl->top);
     }
 
   return pl;
@@ -315,100 +395,225 @@ static void R_MakeSpans(int x, int t1, int b1, int t2, int b2)
 }
 
 // New function, by Lee Killough
+// Split up to draw all sky visplanes together
 
-static void R_DoDrawPlane(visplane_t *pl)
+static void R_SetupSky(const visplane_t *pl)
 {
-  register int x;
-  if (pl->minx <= pl->maxx) {
-    if (pl->picnum == skyflatnum || pl->picnum & PL_SKYFLAT) { // sky flat
-      int texture;
-      angle_t an, flip;
-  
-      // killough 10/98: allow skies to come from sidedefs.
-      // Allows scrolling and/or animated skies, as well as
-      // arbitrary multiple skies per level without having
-      // to use info lumps.
-      
-      an = viewangle;
-      
-      if (pl->picnum & PL_SKYFLAT) { 
-	// Sky Linedef
-	const line_t *l = &lines[pl->picnum & ~PL_SKYFLAT];
-	
-	// Sky transferred from first sidedef
-	const side_t *s = *l->sidenum + sides;
-	
-	// Texture comes from upper texture of reference sidedef
-	texture = texturetranslation[s->toptexture];
-	
-	// Horizontal offset is turned into an angle offset,
-	// to allow sky rotation as well as careful positioning.
-	// However, the offset is scaled very small, so that it
-	// allows a long-period of sky rotation.
-	
-	an += s->textureoffset;
-	
-	// Vertical offset allows careful sky positioning.
-	
-	dc_texturemid = s->rowoffset - 28*FRACUNIT;
-	
-	// We sometimes flip the picture horizontally.
-	//
-	// Doom always flipped the picture, so we make it optional,
-	// to make it easier to use the new feature, while to still
-	// allow old sky textures to be used.
-	
-	flip = l->special==272 ? 0u : ~0u;
-      } else {    // Normal Doom sky, only one allowed per level
-	dc_texturemid = skytexturemid;    // Default y-offset
-	texture = skytexture;             // Default texture
-	flip = 0;                         // Doom flips it
+  // killough 10/98: allow skies to come from sidedefs.
+  // Allows scrolling and/or animated skies, as well as
+  // arbitrary multiple skies per level without having
+  // to use info lumps.
+
+  skyangle = viewangle;
+
+  if (pl->picnum & PL_SKYFLAT) { 
+    // Sky Linedef
+    const line_t *l = &lines[pl->picnum & ~PL_SKYFLAT];
+
+    // Sky transferred from first sidedef
+    const side_t *s = *l->sidenum + sides;
+
+    // Texture comes from upper texture of reference sidedef
+    skytex = texturetranslation[s->toptexture];
+
+    // Horizontal offset is turned into an angle offset,
+    // to allow sky rotation as well as careful positioning.
+    // However, the offset is scaled very small, so that it
+    // allows a long-period of sky rotation.
+
+    skyangle += s->textureoffset;
+
+    // Vertical offset allows careful sky positioning.
+
+    dc_texturemid = s->rowoffset - 28*FRACUNIT;
+
+    // We sometimes flip the picture horizontally.
+    //
+    // Doom always flipped the picture, so we make it optional,
+    // to make it easier to use the new feature, while to still
+    // allow old sky textures to be used.
+
+    skyflip = l->special==272 ? 0u : ~0u;
+  } else {    // Normal Doom sky, only one allowed per level
+    dc_texturemid = skytexturemid;    // Default y-offset
+    skytex = skytexture;              // Default texture
+    skyflip = 0;                      // Doom flips it
+  }
+  // Sky is always drawn full bright, i.e. colormaps[0] is used.
+  // Because of this hack, sky is not affected by INVUL inverse mapping.
+
+  if (!(dc_colormap = fixedcolormap)) 
+    dc_colormap = fullcolormap;          // killough 3/20/98
+  dc_texturemid = skytexturemid;
+  dc_texheight = textureheight[skytexture]>>FRACBITS; // killough
+  // proff 09/21/98: Changed for high-res
+  dc_iscale = FRACUNIT*200/viewheight;
+}
+
+// Draws rows skytop[x] to skybottom[x] of a column of the sky set up by
+// R_SetupSky, and empties it
+static void R_DrawSkyRange(int x)
+{
+  // killough 10/98: Use sky scrolling offset, and possibly flip picture
+  dc_x = x;
+  dc_yl = skytop[x];
+  dc_yh = skybottom[x];
+  dc_source = R_GetSkyColumn(skytex, ((skyangle + xtoviewangle[x])^skyflip)
+			     >> ANGLETOSKYSHIFT);
+  R_DrawSkyColumn();
+  skytop[x] = SCREENHEIGHT;
+  skybottom[x] = -1;
+}
+
+//
+// R_DrawSkyPlanes
+//
+// Draws n sky visplanes, all showing the same sky. Where the planes meet
+// in a column it is drawn as one, each column once per run of rows.
+//
+
+static void R_DrawSkyPlanes(visplane_t **planes, int n)
+{
+  int i, x, minx = viewwidth, maxx = -1;
+
+  R_SetupSky(planes[0]);
+  for (i=0; i<n; i++) {
+    const visplane_t *pl = planes[i];
+
+    if (pl->minx < minx) minx = pl->minx;
+    if (pl->maxx > maxx) maxx = pl->maxx;
+    for (x = pl->minx; x <= pl->maxx; x++) {
+      int top = pl->top[x], bottom = pl->bottom[x];
+
+      if (top > bottom)
+	continue;
+      if (skytop[x] > skybottom[x])      // Nothing yet
+	skytop[x] = top, skybottom[x] = bottom;
+      else if (top == skybottom[x] + 1)  // Carries on below
+	skybottom[x] = bottom;
+      else if (bottom + 1 == skytop[x])  // Carries on above
+	skytop[x] = top;
+      else {                             // Separate, draw the last part
+	R_DrawSkyRange(x);
+	skytop[x] = top, skybottom[x] = bottom;
       }
-      // Sky is always drawn full bright, i.e. colormaps[0] is used.
-      // Because of this hack, sky is not affected by INVUL inverse mapping.
-      
-      if (!(dc_colormap = fixedcolormap)) 
-	dc_colormap = fullcolormap;          // killough 3/20/98
-      dc_texturemid = skytexturemid;
-      dc_texheight = textureheight[skytexture]>>FRACBITS; // killough
-      // proff 09/21/98: Changed for high-res
-      dc_iscale = FRACUNIT*200/viewheight;
-      
-	// killough 10/98: Use sky scrolling offset, and possibly flip picture
-        for (x = pl->minx; (dc_x = x) <= pl->maxx; x++)
-          if ((dc_yl = pl->top[x]) <= (dc_yh = pl->bottom[x]))
-            {
-              dc_source = R_GetColumn(texture, ((an + xtoviewangle[x])^flip) >>
-				      ANGLETOSKYSHIFT);
-              colfunc();
-            }
-    } else {     // regular flat
-     
-      int stop, light;
-      
-      ds_source = W_CacheLumpNum(firstflat + flattranslation[pl->picnum]);
-      
-      xoffs = pl->xoffs;  // killough 2/28/98: Add offsets
-      yoffs = pl->yoffs;
-      planeheight = abs(pl->height-viewz);
-      light = (pl->lightlevel >> LIGHTSEGSHIFT) + extralight;
-      
-      if (light >= LIGHTLEVELS)
-	light = LIGHTLEVELS-1;
-      
-      if (light < 0)
-	light = 0;
-      
-      stop = pl->maxx + 1;
-      planezlight = zlight[light];
-      pl->top[pl->minx-1] = pl->top[stop] = 0xffff;
-      
-      for (x = pl->minx ; x <= stop ; x++)
-	R_MakeSpans(x,pl->top[x-1],pl->bottom[x-1],pl->top[x],pl->bottom[x]);
-      
-      W_UnlockLumpNum(firstflat + flattranslation[pl->picnum]);
     }
   }
+  for (x = minx; x <= maxx; x++)
+    if (skytop[x] <= skybottom[x])
+      R_DrawSkyRange(x);
+}
+
+//
+// R_LockFlat
+//
+// Returns a flat, locking it until R_UnlockFlats at the end of the frame
+//
+
+static const byte *R_LockFlat(int flat)
+{
+  if (!flatsource[flat]) {
+    flatsource[flat] = W_CacheLumpNum(firstflat + flat);
+    lockedflats[numlockedflats++] = flat;
+  }
+  return flatsource[flat];
+}
+
+static void R_UnlockFlats(void)
+{
+  while (numlockedflats) {
+    int flat = lockedflats[--numlockedflats];
+
+    W_UnlockLumpNum(firstflat + flat);
+    flatsource[flat] = NULL;
+  }
+}
+
+//
+// R_DrawPlaneRun
+//
+// Draws n visplanes, all at the same height. Their spans are sorted into
+// rows, then each row's distance, steps and light index are worked out
+// once and used for every span on it, whichever plane it belongs to.
+//
+
+static void R_DrawPlaneRun(const drawplane_t *planes, int n)
+{
+  fixed_t planeheight = abs(planes->pl->height-viewz);
+  int i, y;
+
+  numplanespans = 0;
+  for (i=0; i<n; i++) {
+    visplane_t *pl = planes[i].pl;
+    int x, stop = pl->maxx + 1;
+
+    curplane = &planes[i];
+    pl->top[pl->minx-1] = pl->top[stop] = 0xffff;
+    for (x = pl->minx ; x <= stop ; x++)
+      R_MakeSpans(x,pl->top[x-1],pl->bottom[x-1],pl->top[x],pl->bottom[x]);
+  }
+
+  // Counting sort by row
+  memset(rowspans, 0, (viewheight+1) * sizeof *rowspans);
+  for (i=0; i<numplanespans; i++)
+    rowspans[planespans[i].y+1]++;
+  for (y=0; y<viewheight; y++)
+    rowspans[y+1] += rowspans[y];
+  for (i=0; i<numplanespans; i++)
+    sortedspans[rowspans[planespans[i].y]++] = planespans[i];
+
+  // rowspans[y] is now the end of row y's spans, and the start of row y+1
+  for (i=0, y=0; i<numplanespans; y++) {
+    fixed_t distance;
+    unsigned index;
+
+    if (i == rowspans[y])
+      continue;
+
+    distance = FixedMul(planeheight, yslope[y]);
+    ds_xstep = FixedMul(distance, basexscale);
+    ds_ystep = FixedMul(distance, baseyscale);
+    if ((index = distance >> LIGHTZSHIFT) >= MAXLIGHTZ)
+      index = MAXLIGHTZ-1;
+    ds_y = y;
+
+    for (; i < rowspans[y]; i++) {
+      const planespan_t *span = &sortedspans[i];
+      const drawplane_t *plane = span->plane;
+      fixed_t length = FixedMul(distance, distscale[span->x1]);
+      angle_t angle = (viewangle + xtoviewangle[span->x1])>>ANGLETOFINESHIFT;
+
+      // killough 2/28/98: Add offsets
+      ds_xfrac =  viewx + FixedMul(finecosine[angle], length)
+	+ plane->pl->xoffs;
+      ds_yfrac = -viewy - FixedMul(finesine[angle],   length)
+	+ plane->pl->yoffs;
+      if (!(ds_colormap = fixedcolormap))
+	ds_colormap = plane->zlight[index];
+      ds_source = plane->source;
+      ds_x1 = span->x1;
+      ds_x2 = span->x2;
+
+      R_DrawSpan();
+    }
+  }
+}
+
+// Sky visplanes are drawn grouped by sky
+static int R_CompareSkyPlanes(const void *a, const void *b)
+{
+  return (*(visplane_t* const*)a)->picnum - (*(visplane_t* const*)b)->picnum;
+}
+
+// Flat visplanes are drawn in order of height, and of flat within that
+static int R_ComparePlanes(const void *a, const void *b)
+{
+  const visplane_t *pa = ((const drawplane_t*)a)->pl;
+  const visplane_t *pb = ((const drawplane_t*)b)->pl;
+
+  if (pa->height != pb->height)
+    return pa->height < pb->height ? -1 : 1;
+  return pa->picnum - pb->picnum;
 }
 
 //
@@ -419,10 +624,57 @@ static void R_DoDrawPlane(visplane_t *pl)
 void R_DrawPlanes (void)
 {
   visplane_t *pl;
-  int i;
-  for (i=0;i<MAXVISPLANES;i++)
-    for (pl=visplanes[i]; pl; pl=pl->next, rendered_visplanes++)
-      R_DoDrawPlane(pl);
+  int i, n, numdrawplanes = 0;
+
+  for (i=0; i<numvisplanes; i++, rendered_visplanes++) {
+    pl = visplanes[i];
+    if (pl->minx > pl->maxx)
+      continue;
+    if (pl->picnum == skyflatnum || pl->picnum & PL_SKYFLAT) {
+      if (numskyplanes == maxskyplanes) {
+	maxskyplanes = maxskyplanes ? maxskyplanes*2 : 32;
+	skyplanes = realloc(skyplanes, maxskyplanes * sizeof *skyplanes);
+      }
+      skyplanes[numskyplanes++] = pl;
+    } else {
+      drawplane_t *dp;
+      int light = (pl->lightlevel >> LIGHTSEGSHIFT) + extralight;
+
+      if (light >= LIGHTLEVELS)
+	light = LIGHTLEVELS-1;
+
+      if (light < 0)
+	light = 0;
+
+      if (numdrawplanes == maxdrawplanes) {
+	maxdrawplanes = maxdrawplanes ? maxdrawplanes*2 : 128;
+	drawplanes = realloc(drawplanes, maxdrawplanes * sizeof *drawplanes);
+      }
+      dp = &drawplanes[numdrawplanes++];
+      dp->pl = pl;
+      dp->source = R_LockFlat(flattranslation[pl->picnum]);
+      dp->zlight = zlight[light];
+    }
+  }
+
+  qsort(skyplanes, numskyplanes, sizeof *skyplanes, R_CompareSkyPlanes);
+  for (i=0; i<numskyplanes; i+=n) {
+    for (n=1; i+n < numskyplanes &&
+	   skyplanes[i+n]->picnum == skyplanes[i]->picnum; n++)
+      ;
+    R_DrawSkyPlanes(&skyplanes[i], n);
+  }
+  numskyplanes = 0;
+
+  qsort(drawplanes, numdrawplanes, sizeof *drawplanes, R_ComparePlanes);
+  for (i=0; i<numdrawplanes; i+=n) {
+    for (n=1; i+n < numdrawplanes &&
+	   drawplanes[i+n].pl->height == drawplanes[i].pl->height; n++)
+      ;
+    R_DrawPlaneRun(&drawplanes[i], n);
+  }
+
+  R_UnlockFlats();
 }
 
 //----------------------------------------------------------------------------
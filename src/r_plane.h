@@ -44,8 +44,8 @@
 /* Visplane related. */
 extern  short *lastopening;
 
-extern short floorclip[], ceilingclip[];
-extern fixed_t yslope[], distscale[];
+extern short *floorclip, *ceilingclip;
+extern fixed_t *yslope, *distscale;
 
 void R_InitPlanes(void);
 void R_ClearPlanes(void);
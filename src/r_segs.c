@@ -210,7 +210,7 @@ void R_RenderMaskedSegRange(drawseg_t *ds, int x1, int x2)
           int_64_t t = ((int_64_t) centeryfrac << FRACBITS) -
             (int_64_t) dc_texturemid * spryscale;
           if (t + (int_64_t) textureheight[texnum] * spryscale < 0 ||
-              t > (int_64_t) MAX_SCREENHEIGHT << FRACBITS*2)
+              t > (int_64_t) SCREENHEIGHT << FRACBITS*2)
             continue;        // skip if the texture is out of screen's range
           sprtopscreen = (long)(t >> FRACBITS);
         }
@@ -244,7 +244,7 @@ void R_RenderMaskedSegRange(drawseg_t *ds, int x1, int x2)
 // CALLED: CORE LOOPING ROUTINE.
 //
 
-extern byte solidcol[MAX_SCREENWIDTH];
+extern byte *solidcol;
 #define HEIGHTBITS 12
 #define HEIGHTUNIT (1<<HEIGHTBITS)
 static int didsolidcol; /* True if at least one column was marked solid */
@@ -38,6 +38,13 @@ rcsid[] = "$Id: r_sky.c,v 1.2 1999/10/12 13:01:14 cphipps Exp $";
 #ifdef __GNUG__
 #pragma implementation "r_sky.h"
 #endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomstat.h"
+#include "r_main.h"
+#include "r_draw.h"
+#include "r_data.h"
 #include "r_sky.h"
 
 //
@@ -56,6 +63,110 @@ void R_InitSkyMap (void)
   skytexturemid = 100*FRACUNIT;
 }
 
+//
+// Sky column cache
+//
+// The sky is drawn at the same scale and light every frame, so each of
+// its columns is expanded to the view height once, and then just copied
+// to the screen. Each sky texture has its own cache, so a level with
+// several skies doesn't rebuild them in turn every frame. A cache is
+// rebuilt when anything it depends on changes, usually only when the
+// view size does.
+//
+
+typedef struct {
+  int     texture;
+  byte    *columns;                // viewheight bytes per column
+  size_t  size;
+  int     numcolumns;
+  int     height, centery, texheight;
+  fixed_t mid, iscale;
+  const lighttable_t *colormap;
+  byte    ready[1024];
+} skycache_t;
+
+static skycache_t *skycaches;
+static int        numskycaches, maxskycaches;
+
+static skycache_t *R_FindSkyCache(int texture)
+{
+  skycache_t *sc;
+  int i;
+
+  for (i=0; i<numskycaches; i++)
+    if (skycaches[i].texture == texture)
+      return &skycaches[i];
+
+  if (numskycaches == maxskycaches) {
+    maxskycaches = maxskycaches ? maxskycaches*2 : 4;
+    skycaches = realloc(skycaches, maxskycaches * sizeof *skycaches);
+  }
+  sc = &skycaches[numskycaches++];
+  memset(sc, 0, sizeof *sc);
+  sc->texture = texture;
+  sc->height = -1;                 // Not built yet
+  return sc;
+}
+
+static void R_ResetSkyCache(skycache_t *sc)
+{
+  size_t size;
+
+  // Queued draws may still be reading the old columns
+  R_FlushDrawQueue();
+
+  sc->height = viewheight;
+  sc->centery = centery;
+  sc->texheight = dc_texheight;
+  sc->mid = dc_texturemid;
+  sc->iscale = dc_iscale;
+  sc->colormap = dc_colormap;
+  // Sky columns come from angles, so there are never more than 1024
+  sc->numcolumns = (R_TextureWidthMask(sc->texture) & 1023) + 1;
+
+  size = sc->numcolumns * viewheight;
+  if (size > sc->size)
+    sc->columns = realloc(sc->columns, sc->size = size);
+  memset(sc->ready, 0, sc->numcolumns);
+}
+
+const byte *R_GetSkyColumn(int texture, int col)
+{
+  static skycache_t *sc;           // Last used, usually the one wanted
+  byte *column;
+
+  if (!sc || sc->texture != texture)
+    sc = R_FindSkyCache(texture);
+
+  if (viewheight != sc->height || centery != sc->centery ||
+      dc_texheight != sc->texheight || dc_texturemid != sc->mid ||
+      dc_iscale != sc->iscale || dc_colormap != sc->colormap)
+    R_ResetSkyCache(sc);
+
+  col &= sc->numcolumns - 1;
+  column = sc->columns + col * sc->height;
+  if (!sc->ready[col]) {
+    // As R_DrawColumn would draw it, wrapping at the texture height
+    const byte *source = R_GetColumn(texture, col);
+    unsigned heightmask = dc_texheight - 1;
+    fixed_t  frac = dc_texturemid - centery*dc_iscale;
+    int y;
+
+    for (y = 0; y < sc->height; y++, frac += dc_iscale)
+      if (!(dc_texheight & heightmask)) // power of 2
+	column[y] = dc_colormap[source[(frac>>FRACBITS) & heightmask]];
+      else {
+	fixed_t f = frac % (dc_texheight << FRACBITS);
+
+	if (f < 0)
+	  f += dc_texheight << FRACBITS;
+	column[y] = dc_colormap[source[f>>FRACBITS]];
+      }
+    sc->ready[col] = true;
+  }
+  return column;
+}
+
 /*----------------------------------------------------------------------------
  *
  * $Log: r_sky.c,v $
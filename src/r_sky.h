@@ -50,6 +50,13 @@ extern int skytexturemid;
 /* Called whenever the view size changes. */
 void R_InitSkyMap(void);
 
+/* Returns a column of a sky texture already scaled and lit for drawing
+ * with R_DrawSkyColumn, one byte per row of the view. The scale, offset
+ * and colormap are taken from dc_iscale, dc_texturemid, dc_texheight and
+ * dc_colormap. Each texture is cached separately; a column is valid until
+ * it is next called for the same texture with any of those changed. */
+const byte *R_GetSkyColumn(int texture, int col);
+
 #endif
 
 /*----------------------------------------------------------------------------
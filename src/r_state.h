@@ -63,7 +63,7 @@ extern int viewwidth;
 extern int scaledviewwidth;
 extern int viewheight;
 
-extern int firstflat;
+extern int firstflat, numflats;
 
 // for global animation
 extern int *flattranslation;    
@@ -112,7 +112,7 @@ extern angle_t          viewangle;
 extern player_t         *viewplayer;
 extern angle_t          clipangle;
 extern int              viewangletox[FINEANGLES/2];
-extern angle_t          xtoviewangle[MAX_SCREENWIDTH+1];  // killough 2/8/98
+extern angle_t          *xtoviewangle;  // SCREENWIDTH+1 entries
 extern fixed_t          rw_distance;
 extern angle_t          rw_normalangle;
 
@@ -70,8 +70,22 @@ static lighttable_t **spritelights;        // killough 1/25/98 made static
 // constant arrays
 //  used for psprite clipping and initializing clipping
 
-short negonearray[MAX_SCREENWIDTH];        // killough 2/8/98:
-short screenheightarray[MAX_SCREENWIDTH];  // change to MAX_*
+short *negonearray;        // killough 2/8/98:
+short *screenheightarray;  // SCREENWIDTH entries, from R_InitSprites
+
+// Clipping for R_DrawSprite
+static short *clipbot, *cliptop;
+
+// Drawsegs which can clip sprites, binned by screen column so R_DrawSprite
+// only scans those near each sprite. Bin b holds the drawsegs touching
+// columns b<<DSBINSHIFT to ((b+1)<<DSBINSHIFT)-1, in order, at
+// dsbinsegs[dsbinstart[b]] up to dsbinsegs[dsbinstart[b+1]].
+
+#define DSBINSHIFT 5
+
+static int    *dsbinstart;    // SCREENWIDTH/32+3 entries, from R_InitSprites
+static int    *dsbinsegs;
+static size_t maxdsbinsegs;
 
 //
 // INITIALIZATION FUNCTIONS
@@ -274,7 +288,15 @@ static size_t num_vissprite, num_vissprite_alloc, num_vissprite_ptrs;
 void R_InitSprites(const char * const *namelist)
 {
   int i;
-  for (i=0; i<MAX_SCREENWIDTH; i++)    // killough 2/8/98
+
+  negonearray = Z_Malloc(SCREENWIDTH * sizeof *negonearray, PU_STATIC, 0);
+  screenheightarray = Z_Malloc(SCREENWIDTH * sizeof *screenheightarray,
+			       PU_STATIC, 0);
+  clipbot = Z_Malloc(SCREENWIDTH * sizeof *clipbot, PU_STATIC, 0);
+  cliptop = Z_Malloc(SCREENWIDTH * sizeof *cliptop, PU_STATIC, 0);
+  dsbinstart = Z_Malloc(((SCREENWIDTH >> DSBINSHIFT) + 3) * sizeof *dsbinstart,
+			PU_STATIC, 0);
+  for (i=0; i<SCREENWIDTH; i++)    // killough 2/8/98
     negonearray[i] = -1;
   R_InitSpriteDefs(namelist);
 }
@@ -411,6 +433,54 @@ void R_DrawVisSprite(vissprite_t *vis, int x1, int x2)
   W_UnlockLumpNum(vis->patch+firstspritelump); // cph - release lump
 }
 
+//
+// R_SegBehindSprite
+// True if a drawseg is behind a sprite of the given scale and position,
+// so does not clip it.
+//
+
+static boolean R_SegBehindSprite(const drawseg_t *ds, fixed_t scale,
+				 fixed_t gx, fixed_t gy)
+{
+  fixed_t lowscale, highscale;
+
+  if (ds->scale1 > ds->scale2)
+    lowscale = ds->scale2, highscale = ds->scale1;
+  else
+    lowscale = ds->scale1, highscale = ds->scale2;
+
+  return highscale < scale ||
+    (lowscale < scale && !R_PointOnSegSide(gx, gy, ds->curline));
+}
+
+//
+// R_SpriteHidden
+// True if columns x1 to x2 were all closed by solid walls which
+// R_DrawSprite would clip the sprite against. Only the walls drawn so far
+// are known, from subsectors in front of the thing's own, so this never
+// hides a sprite that would have shown.
+//
+
+static boolean R_SpriteHidden(int x1, int x2, fixed_t scale,
+			      const mobj_t *thing)
+{
+  while (x1 <= x2)
+    {
+      const drawseg_t *ds;
+
+      if (!solidcol[x1] || solidseg[x1] < 0)
+	return false;
+
+      ds = drawsegs + solidseg[x1];
+      if (ds->sprbottomclip != negonearray || thing->z >= ds->bsilheight ||
+	  R_SegBehindSprite(ds, scale, thing->x, thing->y))
+	return false;
+
+      x1 = ds->x2 + 1;
+    }
+  return true;
+}
+
 //
 // R_ProjectSprite
 // Generates a vissprite for a thing if it might be visible.
@@ -421,6 +491,7 @@ void R_ProjectSprite (mobj_t* thing)
   fixed_t   gzt;               // killough 3/27/98
   fixed_t   tx;
   fixed_t   xscale;
+  fixed_t   yscale;
   int       x1;
   int       x2;
   spritedef_t   *sprdef;
@@ -527,6 +598,14 @@ void R_ProjectSprite (mobj_t* thing)
         return;
     }
 
+// proff 11/06/98: Changed for high-res
+  yscale = FixedDiv(projectiony, tz);
+
+  // Things entirely behind the solid walls drawn so far are never seen
+  if (R_SpriteHidden(x1 < 0 ? 0 : x1, x2 >= viewwidth ? viewwidth-1 : x2,
+		     yscale, thing))
+    return;
+
   // store information in a vissprite
   vis = R_NewVisSprite ();
 
@@ -534,8 +613,7 @@ void R_ProjectSprite (mobj_t* thing)
   vis->heightsec = heightsec;
 
   vis->mobjflags = thing->flags;
-// proff 11/06/98: Changed for high-res
-  vis->scale = FixedDiv(projectiony, tz);
+  vis->scale = yscale;
   vis->gx = thing->x;
   vis->gy = thing->y;
   vis->gz = thing->z;
@@ -754,42 +832,45 @@ void R_DrawPlayerSprites(void)
 
 #endif
 
-// killough 9/2/98: merge sort
+// Radix sort by scale, largest (nearest) first. Each pass is a stable
+// counting sort on 8 bits of the inverted scale, lowest bits first, so
+// sprites of equal scale stay in the order the BSP found them. Passes
+// where every sprite has the same bits are skipped. t is scratch space
+// for another n pointers.
 
-static void msort(vissprite_t **s, vissprite_t **t, int n)
+#define RSORTKEY(vis, shift) ((~(unsigned)(vis)->scale >> (shift)) & 255)
+
+static void rsort(vissprite_t **s, vissprite_t **t, int n)
 {
-  if (n >= 16)
-    {
-      int n1 = n/2, n2 = n - n1;
-      vissprite_t **s1 = s, **s2 = s + n1, **d = t;
+  vissprite_t **src = s, **dst = t, **tmp;
+  int shift;
 
-      msort(s1, t, n1);
-      msort(s2, t, n2);
+  for (shift = 0; shift < 32; shift += 8)
+    {
+      int count[256], i, sum = 0;
 
-      while ((*s1)->scale > (*s2)->scale ?
-             (*d++ = *s1++, --n1) : (*d++ = *s2++, --n2));
+      memset(count, 0, sizeof count);
+      for (i = 0; i < n; i++)
+        count[RSORTKEY(src[i], shift)]++;
 
-      if (n2)
-        bcopyp(d, s2, n2);
-      else
-        bcopyp(d, s1, n1);
+      if (count[RSORTKEY(src[0], shift)] == n)
+        continue;
 
-      bcopyp(s, t, n);
-    }
-  else
-    {
-      int i;
-      for (i = 1; i < n; i++)
+      for (i = 0; i < 256; i++)
         {
-          vissprite_t *temp = s[i];
-          if (s[i-1]->scale < temp->scale)
-            {
-              int j = i;
-              while ((s[j] = s[j-1])->scale < temp->scale && --j);
-              s[j] = temp;
-            }
+          int c = count[i];
+          count[i] = sum;
+          sum += c;
         }
+
+      for (i = 0; i < n; i++)
+        dst[count[RSORTKEY(src[i], shift)]++] = src[i];
+
+      tmp = src, src = dst, dst = tmp;
     }
+
+  if (src != s)
+    bcopyp(s, src, n);
 }
 
 void R_SortVisSprites (void)
@@ -814,8 +895,10 @@ void R_SortVisSprites (void)
 
       // killough 9/22/98: replace qsort with merge sort, since the keys
       // are roughly in order to begin with, due to BSP rendering.
+      // Now a radix sort, linear in the number of sprites, using the
+      // second half of vissprite_ptrs as its scratch space.
 
-      msort(vissprite_ptrs, vissprite_ptrs + num_vissprite, num_vissprite);
+      rsort(vissprite_ptrs, vissprite_ptrs + num_vissprite, num_vissprite);
     }
 }
 
@@ -826,13 +909,10 @@ void R_SortVisSprites (void)
 void R_DrawSprite (vissprite_t* spr)
 {
   drawseg_t *ds;
-  short   clipbot[MAX_SCREENWIDTH];       // killough 2/8/98:
-  short   cliptop[MAX_SCREENWIDTH];       // change to MAX_*
   int     x;
   int     r1;
   int     r2;
-  fixed_t scale;
-  fixed_t lowscale;
+  int     bin;
 
   for (x = spr->x1 ; x<=spr->x2 ; x++)
     clipbot[x] = cliptop[x] = -2;
@@ -846,46 +926,48 @@ void R_DrawSprite (vissprite_t* spr)
 
   //    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)    old buggy code
 
-  for (ds=ds_p ; ds-- > drawsegs ; )  // new -- killough
-    {      // determine if the drawseg obscures the sprite
-      if (ds->x1 > spr->x2 || ds->x2 < spr->x1 ||
-          (!ds->silhouette && !ds->maskedtexturecol))
-        continue;      // does not cover sprite
-
-      r1 = ds->x1 < spr->x1 ? spr->x1 : ds->x1;
-      r2 = ds->x2 > spr->x2 ? spr->x2 : ds->x2;
-
-      if (ds->scale1 > ds->scale2)
-        {
-          lowscale = ds->scale2;
-          scale = ds->scale1;
-        }
-      else
-        {
-          lowscale = ds->scale1;
-          scale = ds->scale2;
-        }
-
-      if (scale < spr->scale || (lowscale < spr->scale &&
-                    !R_PointOnSegSide (spr->gx, spr->gy, ds->curline)))
-        {
-          if (ds->maskedtexturecol)       // masked mid texture?
-            R_RenderMaskedSegRange(ds, r1, r2);
-          continue;               // seg is behind sprite
-        }
+  // Each column is clipped on its own, so the scan is done a bin of
+  // columns at a time, over just the drawsegs binned there by R_BinDrawSegs
 
-      // clip this piece of the sprite
-      // killough 3/27/98: optimized and made much shorter
-
-      if (ds->silhouette&SIL_BOTTOM && spr->gz < ds->bsilheight) //bottom sil
-        for (x=r1 ; x<=r2 ; x++)
-          if (clipbot[x] == -2)
-            clipbot[x] = ds->sprbottomclip[x];
+  for (bin = spr->x1 >> DSBINSHIFT; bin <= spr->x2 >> DSBINSHIFT; bin++)
+    {
+      int bx1 = bin << DSBINSHIFT, bx2 = bx1 + (1 << DSBINSHIFT) - 1;
+      int i;
 
-      if (ds->silhouette&SIL_TOP && spr->gzt > ds->tsilheight)   // top sil
-        for (x=r1 ; x<=r2 ; x++)
-          if (cliptop[x] == -2)
-            cliptop[x] = ds->sprtopclip[x];
+      if (bx1 < spr->x1)
+	bx1 = spr->x1;
+      if (bx2 > spr->x2)
+	bx2 = spr->x2;
+
+      for (i = dsbinstart[bin+1]; i-- > dsbinstart[bin]; )
+	{      // determine if the drawseg obscures the sprite
+	  ds = drawsegs + dsbinsegs[i];
+	  if (ds->x1 > bx2 || ds->x2 < bx1)
+	    continue;      // does not cover sprite
+
+	  r1 = ds->x1 < bx1 ? bx1 : ds->x1;
+	  r2 = ds->x2 > bx2 ? bx2 : ds->x2;
+
+	  if (R_SegBehindSprite(ds, spr->scale, spr->gx, spr->gy))
+	    {
+	      if (ds->maskedtexturecol)       // masked mid texture?
+		R_RenderMaskedSegRange(ds, r1, r2);
+	      continue;               // seg is behind sprite
+	    }
+
+	  // clip this piece of the sprite
+	  // killough 3/27/98: optimized and made much shorter
+
+	  if (ds->silhouette&SIL_BOTTOM && spr->gz < ds->bsilheight) //bottom sil
+	    for (x=r1 ; x<=r2 ; x++)
+	      if (clipbot[x] == -2)
+		clipbot[x] = ds->sprbottomclip[x];
+
+	  if (ds->silhouette&SIL_TOP && spr->gzt > ds->tsilheight)   // top sil
+	    for (x=r1 ; x<=r2 ; x++)
+	      if (cliptop[x] == -2)
+		cliptop[x] = ds->sprtopclip[x];
+	}
     }
 
   // killough 3/27/98:
@@ -947,6 +1029,45 @@ void R_DrawSprite (vissprite_t* spr)
   R_DrawVisSprite (spr, spr->x1, spr->x2);
 }
 
+//
+// R_BinDrawSegs
+// Sorts the drawsegs which can clip sprites into the column bins
+// scanned by R_DrawSprite, keeping them in order within each bin.
+//
+
+static void R_BinDrawSegs(void)
+{
+  int numbins = ((viewwidth - 1) >> DSBINSHIFT) + 1;
+  size_t count = 0;
+  drawseg_t *ds;
+  int b;
+
+  // Count each bin's drawsegs two entries along, so that after the sums
+  // dsbinstart[b+1] is where bin b starts, and filling it moves that on
+  // to where bin b ends
+
+  memset(dsbinstart, 0, (numbins+2) * sizeof *dsbinstart);
+  for (ds = drawsegs; ds < ds_p; ds++)
+    if (ds->silhouette || ds->maskedtexturecol)
+      for (b = ds->x1 >> DSBINSHIFT; b <= ds->x2 >> DSBINSHIFT; b++)
+	dsbinstart[b+2]++, count++;
+
+  for (b = 2; b < numbins+2; b++)
+    dsbinstart[b] += dsbinstart[b-1];
+
+  if (count > maxdsbinsegs)
+    {
+      while (count > maxdsbinsegs)
+	maxdsbinsegs = maxdsbinsegs ? maxdsbinsegs*2 : 1024;
+      dsbinsegs = realloc(dsbinsegs, maxdsbinsegs * sizeof *dsbinsegs);
+    }
+
+  for (ds = drawsegs; ds < ds_p; ds++)
+    if (ds->silhouette || ds->maskedtexturecol)
+      for (b = ds->x1 >> DSBINSHIFT; b <= ds->x2 >> DSBINSHIFT; b++)
+	dsbinsegs[dsbinstart[b+1]++] = ds - drawsegs;
+}
+
 //
 // R_DrawMasked
 //
@@ -957,6 +1078,7 @@ void R_DrawMasked(void)
   drawseg_t *ds;
 
   R_SortVisSprites();
+  R_BinDrawSegs();
 
   // draw all vissprites back to front
 
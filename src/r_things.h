@@ -38,8 +38,8 @@
 
 /* Constant arrays used for psprite clipping and initializing clipping. */
 
-extern short negonearray[MAX_SCREENWIDTH];         /* killough 2/8/98: */
-extern short screenheightarray[MAX_SCREENWIDTH];   /* change to MAX_*  */
+extern short *negonearray;         /* SCREENWIDTH entries */
+extern short *screenheightarray;
 
 /* Vars for R_DrawMaskedColumn */
 
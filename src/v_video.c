@@ -47,6 +47,10 @@ rcsid[] = "$Id: v_video.c,v 1.18 1999/10/27 18:38:03 cphipps Exp $";
 byte *screens[6];
 int  dirtybox[4];
 
+// Rows of screens[0] marked by V_MarkRect, so the display code need only
+// convert or copy those
+byte *dirtyrows;
+
 /* jff 2/18/98 palette color ranges for translation
  * jff 4/24/98 now pointers set to predefined lumps to allow overloading
  * cphipps 10/99 - be consistent in using byte for pixel values
@@ -209,6 +213,14 @@ void V_MarkRect(int x, int y, int width, int height)
 {
   M_AddToBox(dirtybox, x, y);
   M_AddToBox(dirtybox, x+width-1, y+height-1);
+
+  if (y < 0) {
+    height += y; y = 0;
+  }
+  if (height > SCREENHEIGHT - y)
+    height = SCREENHEIGHT - y;
+  if (dirtyrows && height > 0)
+    memset(dirtyrows + y, 1, height);
 }
 
 //
@@ -398,6 +410,9 @@ void V_Init (void)
     screens[i] = Z_Calloc(SCREENWIDTH*SCREENHEIGHT, 1, PU_STATIC, NULL);
   for (; i<4; i++) // Clear the rest (paranoia)
     screens[i] = NULL;
+
+  dirtyrows = Z_Malloc(SCREENHEIGHT, PU_STATIC, NULL);
+  memset(dirtyrows, 1, SCREENHEIGHT);
 }
 
 //
@@ -638,9 +653,11 @@ byte *V_PatchToBlock(const char* name, const byte *trans,
 // CPhipps - New function to set the palette to palette number pal.
 // Handles loading of PLAYPAL and calls I_SetPalette
 
+unsigned short current_palette;
+
 void V_SetPalette(unsigned short pal)
 {
-  I_SetPalette(pal);
+  I_SetPalette(current_palette = pal);
 }
 
 // 
@@ -651,6 +668,9 @@ void V_SetPalette(unsigned short pal)
 void V_FillRect(int scrn, int x, int y, int width, int height, byte colour)
 {
   byte* dest = screens[scrn] + x + y*SCREENWIDTH;
+
+  if (!scrn)
+    V_MarkRect(x, y, width, height);
   while (height--) {
     memset(dest, colour, width);
     dest += SCREENWIDTH;
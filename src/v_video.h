@@ -91,6 +91,7 @@ typedef enum
 
 extern byte      *screens[6];
 extern int        dirtybox[4];
+extern byte      *dirtyrows; /* Rows of screens[0] changed since last update */
 extern const byte gammatable[5][256];
 extern int        usegamma;
 
@@ -146,6 +147,7 @@ byte *V_PatchToBlock(const char* name, const byte *trans,
 
 // CPhipps - function to set the palette to palette number pal.
 void V_SetPalette(unsigned short pal);
+extern unsigned short current_palette; /* last one passed to V_SetPalette */
 
 // CPhipps - function to plot a pixel
 inline static const void V_PlotPixel(int scrn, int x, int y, byte colour) {
@@ -41,6 +41,7 @@ rcsid[] = "$Id: w_wad.c,v 1.12 1999/10/27 18:35:50 cphipps Exp $";
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #ifdef __GNUG__
 #pragma implementation "w_wad.h"
@@ -146,6 +147,8 @@ static void W_AddFile(const char *filename, wad_source_t source)
   int         startlump;
   filelump_t  *fileinfo, *fileinfo2free=NULL; //killough
   filelump_t  singleinfo;
+  const char  *mapped;
+  int         maplength;
 
   // open the file and add to directory
 
@@ -166,6 +169,15 @@ static void W_AddFile(const char *filename, wad_source_t source)
   lprintf (LO_INFO," adding %s\n",filename);
   startlump = numlumps;
 
+  // Map the whole file read-only, so W_CacheLumpNum can hand out pointers 
+  // straight into it instead of reading and copying each lump. If the 
+  // mapping fails, lumps are read with W_ReadLump as before.
+  maplength = filelength(handle);
+  mapped = maplength ? 
+    mmap(NULL, maplength, PROT_READ, MAP_SHARED, handle, 0) : MAP_FAILED;
+  if (mapped == MAP_FAILED)
+    mapped = NULL;
+
   // killough:
   if (strlen(filename)<=4 || strcasecmp(filename+strlen(filename)-4, ".wad" ))
     {
@@ -209,6 +221,12 @@ static void W_AddFile(const char *filename, wad_source_t source)
         strncpy (lump_p->name, fileinfo->name, 8);
 	lump_p->source = source;                    // Ty 08/29/98
 	lump_p->locks = 0;                   // CPhipps - initialise locks
+	// Only use lumps in place if they are wholly inside the file, and
+	// aligned well enough to be used as the structs they contain
+	lump_p->mapped = (mapped && !(lump_p->position & 3) &&
+			  lump_p->position >= 0 && lump_p->size >= 0 &&
+			  lump_p->size <= maplength - lump_p->position) ?
+	  mapped + lump_p->position : NULL;
       }
 
     free(fileinfo2free);      // killough
@@ -245,6 +263,7 @@ static void W_CoalesceMarkedResource(const char *start_marker,
             strncpy(marked->name, start_marker, 8);
             marked->size = 0;  // killough 3/20/98: force size to be 0
             marked->namespace = ns_global;        // killough 4/17/98
+            marked->mapped = NULL;
             num_marked = 1;
           }
         is_marked = 1;                            // start marking lumps
@@ -275,6 +294,7 @@ static void W_CoalesceMarkedResource(const char *start_marker,
     {
       lumpinfo[numlumps].size = 0;  // killough 3/20/98: force size to be 0
       lumpinfo[numlumps].namespace = ns_global;   // killough 4/17/98
+      lumpinfo[numlumps].mapped = NULL;
       strncpy(lumpinfo[numlumps++].name, end_marker, 8);
     }
 }
@@ -488,6 +508,9 @@ void W_ReadLump(int lump, void *dest)
     memcpy(dest, l->data, l->size);
   else
 #endif
+  if (l->mapped)
+    memcpy(dest, l->mapped, l->size);
+  else
     {
       int c;
 
@@ -515,13 +538,18 @@ const void * (W_CacheLumpNum)(int lump, unsigned short locks)
     I_Error ("W_CacheLumpNum: %i >= numlumps",lump);
 #endif
 
-  if (!lumpcache[lump])      // read the lump in
-    W_ReadLump(lump, Z_Malloc(W_LumpLength(lump), PU_CACHE, &lumpcache[lump]));
+  if (!lumpcache[lump]) {    // read the lump in
+    if (lumpinfo[lump].mapped) // or just point at it, if the wad is mapped
+      lumpcache[lump] = (void*)lumpinfo[lump].mapped;
+    else
+      W_ReadLump(lump, Z_Malloc(W_LumpLength(lump), PU_CACHE, &lumpcache[lump]));
+  }
 
   // cph - if wasn't locked but now is, tell z_zone to hold it
   lumpinfo[lump].locks += locks;
   if (lumpinfo[lump].locks == locks) {
-    Z_ChangeTag(lumpcache[lump],PU_STATIC);
+    if (!lumpinfo[lump].mapped) // mapped lumps are never purged
+      Z_ChangeTag(lumpcache[lump],PU_STATIC);
 #ifdef TIMEDIAG
     locktic[lump] = gametic;
 #endif
@@ -552,7 +580,7 @@ void (W_UnlockLumpNum)(int lump, signed short unlocks)
   lumpinfo[lump].locks -= unlocks;
   // cph - Note: must only tell z_zone to make purgeable if currently locked, 
   // else it might already have been purged
-  if (unlocks && !lumpinfo[lump].locks)
+  if (unlocks && !lumpinfo[lump].locks && !lumpinfo[lump].mapped)
     Z_ChangeTag(lumpcache[lump], PU_CACHE);
 }
 
@@ -106,6 +106,7 @@ typedef struct
   int position;
   unsigned int locks; // CPhipps - wad lump locking
   wad_source_t source;
+  const void *mapped; // lump data in the mmap()ed wad file, or NULL
 } lumpinfo_t;
 
 // killough 1/31/98: predefined lumps
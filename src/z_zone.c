@@ -35,6 +35,11 @@
  * memory allocation functions, including malloc() and similar functions.
  * Added line and file numbers, in case of error. Added performance
  * statistics and tunables.
+ *
+ * Free blocks are kept in lists by size class, so finding one no longer
+ * means walking the whole zone, and each tag has its own list of blocks
+ * so Z_FreeTags only touches what it frees. The PU_CACHE list is kept in
+ * order of last use, and is purged from the oldest end when memory runs out.
  *-----------------------------------------------------------------------------
  */
 
@@ -62,14 +67,14 @@ static const char rcsid[] = "$Id: z_zone.c,v 1.10 1999/10/31 12:49:44 cphipps Ex
 // Alignment of zone memory (benefit may be negated by HEADER_SIZE, CHUNK_SIZE)
 #define CACHE_ALIGN 32
 
-// size of block header
-#define HEADER_SIZE 32
-
 // Minimum chunk size at which blocks are allocated
 #define CHUNK_SIZE 32
 
+// size of block header, whole chunks so user data stays aligned
+#define HEADER_SIZE ((sizeof(memblock_t)+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1))
+
 // Minimum size a block must be to become part of a split
-#define MIN_BLOCK_SPLIT (1024)
+#define MIN_BLOCK_SPLIT (HEADER_SIZE+CHUNK_SIZE)
 
 // How much RAM to leave aside for other libraries
 #define LEAVE_ASIDE (128*1024)
@@ -86,16 +91,28 @@ static const char rcsid[] = "$Id: z_zone.c,v 1.10 1999/10/31 12:49:44 cphipps Ex
 // Number of mallocs & frees kept in history buffer (must be a power of 2)
 #define ZONE_HISTORY 4
 
+// Free blocks are kept in lists by size: one list per size for blocks of
+// up to NUM_SMALL chunks, then one per power of two
+#define NUM_SMALL   32
+#define NUM_CLASSES (NUM_SMALL+32)
+
 // End Tunables
 
+// Every block, free or not, is on one list: free blocks on the list for
+// their size class, allocated ones on the list for their tag. The
+// PU_CACHE list is kept in least recently used order, so purging takes
+// from the front. Blocks malloc()ed outside the zone (vm) are on the tag
+// lists too.
+
 typedef struct memblock {
 
 #ifdef ZONEIDCHECK
   unsigned id;
 #endif
 
-  struct memblock *next,*prev;
-  size_t size;
+  struct memblock *next,*prev;  // size class or tag list
+  struct memblock *below;       // block before this in the zone, or NULL
+  size_t size;                  // not including the header
   void **user;
   unsigned char tag,vm;
 
@@ -107,11 +124,14 @@ typedef struct memblock {
 
 } memblock_t;
 
-static memblock_t *rover;                // roving pointer to memory blocks
 static memblock_t *zone;                 // pointer to first block
+static char *zoneend;                    // end of zone memory
 static memblock_t *zonebase;             // pointer to entire zone memory
 static size_t zonebase_size;             // zone memory allocated size
-static memblock_t *blockbytag[PU_MAX];
+static memblock_t freelist[NUM_CLASSES]; // list heads, by size class
+static memblock_t taglist[PU_MAX];       // list heads, by tag
+
+void (*zone_purge_hook)(void);
 
 #ifdef INSTRUMENTED
 
@@ -193,7 +213,71 @@ void Z_DumpHistory(char *buf)
 static void Z_Close(void)
 {
   (free)(zonebase);
-  zone = rover = zonebase = NULL;
+  zone = zonebase = NULL;
+}
+
+// List handling, all lists are circular with a dummy head
+
+static void Z_Unlink(memblock_t *block)
+{
+  block->prev->next = block->next;
+  block->next->prev = block->prev;
+}
+
+static void Z_LinkBefore(memblock_t *block, memblock_t *where)
+{
+  block->next = where;
+  block->prev = where->prev;
+  where->prev->next = block;
+  where->prev = block;
+}
+
+// Size class of a free block, size is in whole chunks
+static int Z_SizeClass(size_t size)
+{
+  size_t chunks = size / CHUNK_SIZE;
+  int class = NUM_SMALL;
+
+  if (chunks <= NUM_SMALL)
+    return chunks - 1;
+  for (chunks /= NUM_SMALL*2; chunks && class < NUM_CLASSES-1; chunks >>= 1)
+    class++;
+  return class;
+}
+
+// The block after this one in the zone, or NULL if it's the last
+static memblock_t *Z_Above(memblock_t *block)
+{
+  char *above = (char *) block + HEADER_SIZE + block->size;
+  return above < zoneend ? (memblock_t *) above : NULL;
+}
+
+static void Z_AddFree(memblock_t *block)
+{
+  memblock_t *head = &freelist[Z_SizeClass(block->size)];
+
+  block->tag = PU_FREE;
+  Z_LinkBefore(block, head->next); // at the front, reused first
+}
+
+// Finds a free block of at least size bytes, or NULL
+static memblock_t *Z_FindFree(size_t size)
+{
+  int class = Z_SizeClass(size);
+  memblock_t *block;
+
+  // Small classes hold one size only, the rest need a first fit search
+  for (block = freelist[class].next; block != &freelist[class];
+       block = block->next)
+    if (block->size >= size)
+      return block;
+
+  // Anything in a larger class is big enough
+  while (++class < NUM_CLASSES)
+    if (freelist[class].next != &freelist[class])
+      return freelist[class].next;
+
+  return NULL;
 }
 
 void Z_Init(void)
@@ -223,7 +307,7 @@ void Z_Init(void)
 
   size -= LEAVE_ASIDE;        // Leave aside some for other libraries
 
-  assert(HEADER_SIZE >= sizeof(memblock_t) && MIN_RAM > LEAVE_ASIDE);
+  assert(MIN_RAM > LEAVE_ASIDE);
 
   atexit(Z_Close);            // exit handler
 
@@ -244,13 +328,23 @@ void Z_Init(void)
   // Align on cache boundary
 
   zone = (memblock_t *) ((char *) zonebase + CACHE_ALIGN -
-                         ((unsigned) zonebase & (CACHE_ALIGN-1)));
+                         ((unsigned long) zonebase & (CACHE_ALIGN-1)));
+  zoneend = (char *) zone + HEADER_SIZE + size;
+
+  {
+    int i;
+
+    for (i=0; i<NUM_CLASSES; i++)
+      freelist[i].next = freelist[i].prev = &freelist[i];
+    for (i=0; i<PU_MAX; i++)
+      taglist[i].next = taglist[i].prev = &taglist[i];
+  }
 
-  rover = zone;                            // Rover points to base of zone mem
-  zone->next = zone->prev = zone;          // Single node
   zone->size = size;                       // All memory in one block
-  zone->tag = PU_FREE;                     // A free block
+  zone->below = NULL;
   zone->vm  = 0;
+  zone->user = NULL;
+  Z_AddFree(zone);
 
 #ifdef ZONEIDCHECK
   zone->id  = 0;
@@ -269,7 +363,6 @@ void Z_Init(void)
 void *(Z_Malloc)(size_t size, int tag, void **user, const char *file, int line)
 {
   register memblock_t *block;
-  memblock_t *start;
 
 #ifdef INSTRUMENTED
   size_t size_orig = size;
@@ -293,105 +386,86 @@ void *(Z_Malloc)(size_t size, int tag, void **user, const char *file, int line)
 
   size = (size+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);  // round to chunk size
 
-  block = rover;
-
-  if (block->prev->tag == PU_FREE)
-    block = block->prev;
+  // Purge the least recently used cache blocks until something fits
+  while (!(block = Z_FindFree(size)) &&
+         taglist[PU_CACHE].next != &taglist[PU_CACHE])
+    (Z_Free)((char *) taglist[PU_CACHE].next + HEADER_SIZE, file, line);
 
-  start = block;
-
-  do
+  if (block)
     {
-      if (block->tag >= PU_PURGELEVEL)      // Free purgable blocks
-        {                                   // replacement is roughly FIFO
-          start = block->prev;
-          Z_Free((char *) block + HEADER_SIZE);
-          block = start = start->next;      // Important: resets start
-        }
+      size_t extra = block->size - size;
 
-      if (block->tag == PU_FREE && block->size >= size)   // First-fit
+      Z_Unlink(block);
+      if (extra >= MIN_BLOCK_SPLIT)
         {
-          size_t extra = block->size - size;
-          if (extra >= MIN_BLOCK_SPLIT + HEADER_SIZE)
-            {
-              memblock_t *newb = (memblock_t *)((char *) block +
-                                                HEADER_SIZE + size);
-
-              (newb->next = block->next)->prev = newb;
-              (newb->prev = block)->next = newb;          // Split up block
-              block->size = size;
-              newb->size = extra - HEADER_SIZE;
-              newb->tag = PU_FREE;
-              newb->vm = 0;
+          memblock_t *newb = (memblock_t *)((char *) block +
+                                            HEADER_SIZE + size);
+          memblock_t *above = Z_Above(block);
+
+          block->size = size;                   // Split up block
+          newb->size = extra - HEADER_SIZE;
+          newb->below = block;
+          newb->vm = 0;
+          newb->user = NULL;
+          if (above)
+            above->below = newb;
+          Z_AddFree(newb);
 
 #ifdef INSTRUMENTED
-              inactive_memory += HEADER_SIZE;
-              free_memory -= HEADER_SIZE;
+          inactive_memory += HEADER_SIZE;
+          free_memory -= HEADER_SIZE;
 #endif
-            }
-
-          rover = block->next;           // set roving pointer for next search
+        }
 
 #ifdef INSTRUMENTED
-          inactive_memory += block->extra = block->size - size_orig;
-          if (tag >= PU_PURGELEVEL)
-            purgable_memory += size_orig;
-          else
-            active_memory += size_orig;
-          free_memory -= block->size;
+      inactive_memory += block->extra = block->size - size_orig;
+      if (tag >= PU_PURGELEVEL)
+        purgable_memory += size_orig;
+      else
+        active_memory += size_orig;
+      free_memory -= block->size;
 #endif
+    }
+  else
+    {
+      // We've run out of physical memory, or so we think.
+      // Although less efficient, we'll just use ordinary malloc.
+      // This will squeeze the remaining juice out of this machine
+      // and start cutting into virtual memory if it has it.
 
-allocated:
+      if (!(block = (malloc)(size + HEADER_SIZE)))
+        I_Error ("Z_Malloc: Failure trying to allocate %lu bytes"
+                 "\nSource: %s:%d",(unsigned long) size, file, line);
+      block->vm = 1;
+      block->size = size;
+      block->below = NULL;
 
 #ifdef INSTRUMENTED
-          block->file = file;
-          block->line = line;
-#endif
-
-#ifdef ZONEIDCHECK
-          block->id = ZONEID;         // signature required in block header
+      virtual_memory += size + HEADER_SIZE;
 #endif
-          block->tag = tag;           // tag
-          block->user = user;         // user
-          block = (memblock_t *)((char *) block + HEADER_SIZE);
-          if (user)                   // if there is a user
-            *user = block;            // set user to point to new block
+    }
 
 #ifdef INSTRUMENTED
-          Z_PrintStats();           // print memory allocation stats
-          // scramble memory -- weed out any bugs
-          memset(block, gametic & 0xff, size);
+  block->file = file;
+  block->line = line;
 #endif
-          return block;
-        }
-    }
-  while ((block = block->next) != start);   // detect cycles as failure
-
-  // We've run out of physical memory, or so we think.
-  // Although less efficient, we'll just use ordinary malloc.
-  // This will squeeze the remaining juice out of this machine
-  // and start cutting into virtual memory if it has it.
 
-  while (!(block = (malloc)(size + HEADER_SIZE)))
-    {
-      if (!blockbytag[PU_CACHE])
-        I_Error ("Z_Malloc: Failure trying to allocate %lu bytes"
-                 "\nSource: %s:%d",(unsigned long) size, file, line);
-      Z_FreeTags(PU_CACHE,PU_CACHE);
-    }
-
-  if ((block->next = blockbytag[tag]))
-    block->next->prev = (memblock_t *) &block->next;
-  blockbytag[tag] = block;
-  block->prev = (memblock_t *) &blockbytag[tag];
-  block->vm = 1;
+#ifdef ZONEIDCHECK
+  block->id = ZONEID;         // signature required in block header
+#endif
+  block->tag = tag;           // tag
+  block->user = user;         // user
+  Z_LinkBefore(block, &taglist[tag]);
+  block = (memblock_t *)((char *) block + HEADER_SIZE);
+  if (user)                   // if there is a user
+    *user = block;            // set user to point to new block
 
 #ifdef INSTRUMENTED
-  virtual_memory += 
+  Z_PrintStats();           // print memory allocation stats
+  // scramble memory -- weed out any bugs
+  memset(block, gametic & 0xff, size);
 #endif
-    block->size = size + HEADER_SIZE; // CPhipps - this was lost in the #ifdef above
-
-  goto allocated;
+  return block;
 }
 
 void (Z_Free)(void *p, const char *file, int line)
@@ -429,16 +503,18 @@ void (Z_Free)(void *p, const char *file, int line)
       memset(p, gametic & 0xff, block->size - block->extra);
 #endif
 
+      if (block->tag >= PU_PURGELEVEL && zone_purge_hook)
+        zone_purge_hook();
+
       if (block->user)            // Nullify user if one exists
         *block->user = NULL;
 
+      Z_Unlink(block);            // Off its tag list
+
       if (block->vm)
         {
-          if ((*(memblock_t **) block->prev = block->next))
-            block->next->prev = block->prev;
-
 #ifdef INSTRUMENTED
-          virtual_memory -= block->size;
+          virtual_memory -= block->size + HEADER_SIZE;
 #endif
           (free)(block);
         }
@@ -454,32 +530,23 @@ void (Z_Free)(void *p, const char *file, int line)
             active_memory -= block->size - block->extra;
 #endif
 
-          block->tag = PU_FREE;       // Mark block freed
-
-          if (block != zone)
+          other = block->below;       // Possibly merge with previous block
+          if (other && other->tag == PU_FREE)
             {
-              other = block->prev;        // Possibly merge with previous block
-              if (other->tag == PU_FREE)
-                {
-                  if (rover == block)  // Move back rover if it points at block
-                    rover = other;
-                  (other->next = block->next)->prev = other;
-                  other->size += block->size + HEADER_SIZE;
-                  block = other;
+              Z_Unlink(other);
+              other->size += block->size + HEADER_SIZE;
+              block = other;
 
 #ifdef INSTRUMENTED
-                  inactive_memory -= HEADER_SIZE;
-                  free_memory += HEADER_SIZE;
+              inactive_memory -= HEADER_SIZE;
+              free_memory += HEADER_SIZE;
 #endif
-                }
             }
 
-          other = block->next;        // Possibly merge with next block
-          if (other->tag == PU_FREE && other != zone)
+          other = Z_Above(block);     // Possibly merge with next block
+          if (other && other->tag == PU_FREE)
             {
-              if (rover == other) // Move back rover if it points at next block
-                rover = block;
-              (block->next = other->next)->prev = block;
+              Z_Unlink(other);
               block->size += other->size + HEADER_SIZE;
 
 #ifdef INSTRUMENTED
@@ -487,6 +554,10 @@ void (Z_Free)(void *p, const char *file, int line)
               free_memory += HEADER_SIZE;
 #endif
             }
+
+          if ((other = Z_Above(block)))
+            other->below = block;
+          Z_AddFree(block);           // Mark block freed
         }
 
 #ifdef INSTRUMENTED
@@ -495,59 +566,23 @@ void (Z_Free)(void *p, const char *file, int line)
     }
 }
 
+// Only visits blocks that are actually being freed
 void (Z_FreeTags)(int lowtag, int hightag, const char *file, int line)
 {
-  memblock_t *block = zone;
-
   if (lowtag <= PU_FREE)
     lowtag = PU_FREE+1;
 
-  do               // Scan through list, searching for tags in range
-    if (block->tag >= lowtag && block->tag <= hightag)
-      {
-        memblock_t *prev = block->prev;
-        (Z_Free)((char *) block + HEADER_SIZE, file, line);
-        block = prev->next;
-      }
-  while ((block=block->next) != zone);
-
-  if (hightag > PU_CACHE)
-    hightag = PU_CACHE;
+  if (hightag >= PU_MAX)
+    hightag = PU_MAX-1;
 
   for (;lowtag <= hightag; lowtag++)
-    for (block = blockbytag[lowtag], blockbytag[lowtag] = NULL; block;)
-      {
-        memblock_t *next = block->next;
-
-#ifdef ZONEIDCHECK
-        if (block->id != ZONEID)
-          I_Error("Z_Free: freed a pointer without ZONEID\n"
-                  "Source: %s:%d"
-
-#ifdef INSTRUMENTED
-                  "\nSource of malloc: %s:%d"
-                  , file, line, block->file, block->line
-#else
-                  , file, line
-#endif
-                  );
-
-        block->id = 0;              // Nullify id so another free fails
-#endif
-
-#ifdef INSTRUMENTED
-        virtual_memory -= block->size;
-#endif
-
-        if (block->user)            // Nullify user if one exists
-          *block->user = NULL;
-
-        (free)(block);              // Free the block
-
-        block = next;               // Advance to next block
-      }
+    while (taglist[lowtag].next != &taglist[lowtag])
+      (Z_Free)((char *) taglist[lowtag].next + HEADER_SIZE, file, line);
 }
 
+// Moves the block to the end of the new tag's list, so changing a block
+// to PU_CACHE (as unlocking a lump does) marks it most recently used
+
 void (Z_ChangeTag)(void *ptr, int tag, const char *file, int line)
 {
   memblock_t *block = (memblock_t *)((char *) ptr - HEADER_SIZE);
@@ -584,18 +619,12 @@ void (Z_ChangeTag)(void *ptr, int tag, const char *file, int line)
 
 #endif // ZONEIDCHECK
 
-  if (block->vm)
-    {
-      if ((*(memblock_t **) block->prev = block->next))
-        block->next->prev = block->prev;
-      if ((block->next = blockbytag[tag]))
-        block->next->prev = (memblock_t *) &block->next;
-      block->prev = (memblock_t *) &blockbytag[tag];
-      blockbytag[tag] = block;
-    }
-  else
-    {
+  Z_Unlink(block);
+  Z_LinkBefore(block, &taglist[tag]);
+
 #ifdef INSTRUMENTED
+  if (!block->vm)
+    {
       if (block->tag < PU_PURGELEVEL && tag >= PU_PURGELEVEL)
         {
           active_memory -= block->size - block->extra;
@@ -607,8 +636,8 @@ void (Z_ChangeTag)(void *ptr, int tag, const char *file, int line)
             active_memory += block->size - block->extra;
             purgable_memory -= block->size - block->extra;
           }
-#endif
     }
+#endif
   block->tag = tag;
 }
 
@@ -642,11 +671,12 @@ char *(Z_Strdup)(const char *s, int tag, void **user,
 
 void (Z_CheckHeap)(const char *file, int line)
 {
-  memblock_t *block = zone;   // Start at base of zone mem
-  do                          // Consistency check (last node treated special)
-    if ((block->next != zone &&
-         (memblock_t *)((char *) block+HEADER_SIZE+block->size) != block->next)
-        || block->next->prev != block || block->prev->next != block)
+  memblock_t *block = zone, *below = NULL;   // Start at base of zone mem
+
+  for (; block; below = block, block = Z_Above(block))
+    if (block->below != below || block->tag >= PU_MAX ||
+        block->next->prev != block || block->prev->next != block ||
+        (block->tag == PU_FREE && below && below->tag == PU_FREE))
       I_Error("Z_CheckHeap: Block size does not touch the next block\n"
               "Source: %s:%d"
 #ifdef INSTRUMENTED
@@ -656,7 +686,6 @@ void (Z_CheckHeap)(const char *file, int line)
               , file, line
 #endif
               );
-  while ((block=block->next) != zone);
 }
 
 //-----------------------------------------------------------------------------
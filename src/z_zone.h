@@ -76,6 +76,10 @@ char *(Z_Strdup)(const char *s, int tag, void **user, const char *, int);
 void (Z_CheckHeap)(const char *,int);   // killough 3/22/98: add file/line info
 void Z_DumpHistory(char *);
 
+/* Called before a purgable block is freed, for anything still using
+ * cached data without holding a lock on it */
+extern void (*zone_purge_hook)(void);
+
 #define Z_Free(a)          (Z_Free)     (a,      __FILE__,__LINE__)
 #define Z_FreeTags(a,b)    (Z_FreeTags) (a,b,    __FILE__,__LINE__)
 #define Z_ChangeTag(a,b)   (Z_ChangeTag)(a,b,    __FILE__,__LINE__)